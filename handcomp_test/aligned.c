@@ -0,0 +1,182 @@
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Sum 0 to n-1 into opadd reducers whose view types are aligned to 64 bytes,
+ * and check that every view the runtime creates is aligned.  The views are
+ * sized to come from a small and a large internal-malloc bucket and from the
+ * system.
+ *
+ * alignas(64) struct { long sum; ... } small, medium, large;  // reducers
+ *
+ * void sum(long lo, long hi) {
+ *     if (hi - lo <= GRAIN) {
+ *         for (long i = lo; i < hi; ++i)
+ *             small.sum += i, medium.sum += i, large.sum += i;
+ *         return;
+ *     }
+ *     long mid = lo + (hi - lo) / 2;
+ *     cilk_spawn sum(lo, mid);
+ *     sum(mid, hi);
+ *     cilk_sync;
+ * }
+ */
+
+#define GRAIN 256
+
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+typedef struct small {
+    alignas(64) long sum;
+} small;
+
+typedef struct medium {
+    alignas(64) long sum;
+    char pad[72];
+} medium;
+
+typedef struct large {
+    alignas(64) long sum;
+    char pad[2992];
+} large;
+
+static small small_sum;
+static medium medium_sum;
+static large large_sum;
+static long misaligned; // views not aligned to their type
+
+// The sum is the first member of each view type.
+static void zero_small(void *v) { memset(v, 0, sizeof(small)); }
+static void zero_medium(void *v) { memset(v, 0, sizeof(medium)); }
+static void zero_large(void *v) { memset(v, 0, sizeof(large)); }
+static void add(void *l, void *r) { *(long *)l += *(long *)r; }
+
+static long *lookup(void *key, size_t size, __cilk_identity_fn identity) {
+    void *view = __cilkrts_reducer_lookup(key, size, identity, add);
+    if ((uintptr_t)view & 63)
+        __atomic_fetch_add(&misaligned, 1, __ATOMIC_RELAXED);
+    return (long *)view;
+}
+
+static void __attribute__((noinline))
+sum_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent);
+
+static void sum(long lo, long hi) {
+    if (hi - lo <= GRAIN) {
+        long *s = lookup(&small_sum, sizeof(small), zero_small);
+        long *m = lookup(&medium_sum, sizeof(medium), zero_medium);
+        long *l = lookup(&large_sum, sizeof(large), zero_large);
+        for (long i = lo; i < hi; ++i) {
+            *s += i;
+            *m += i;
+            *l += i;
+        }
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+    /* spawn sum(lo, mid) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        sum_spawn_helper(lo, mid, &sf);
+    }
+
+    sum(mid, hi);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+sum_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    sum(lo, hi);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+// Register the sums as reducers for the duration of a parallel sum.
+static void sum_all(long n) {
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    __cilkrts_reducer_register(&small_sum, sizeof(small), zero_small, add);
+    __cilkrts_reducer_register(&medium_sum, sizeof(medium), zero_medium, add);
+    __cilkrts_reducer_register(&large_sum, sizeof(large), zero_large, add);
+
+    /* spawn sum(0, n / 2) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        sum_spawn_helper(0, n / 2, &sf);
+    }
+
+    sum(n / 2, n);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilkrts_reducer_unregister(&small_sum);
+    __cilkrts_reducer_unregister(&medium_sum);
+    __cilkrts_reducer_unregister(&large_sum);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+int main(int argc, char *args[]) {
+    long n = 1000000;
+    uint64_t running_time[TIMING_COUNT];
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: aligned [<cilk-options>] [<n>]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        n = atol(args[1]);
+
+    long expected = n * (n - 1) / 2;
+    int wrong = 0;
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        zero_small(&small_sum);
+        zero_medium(&medium_sum);
+        zero_large(&large_sum);
+        clockmark_t begin = ktiming_getmark();
+        sum_all(n);
+        clockmark_t end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+        if (small_sum.sum != expected || medium_sum.sum != expected ||
+            large_sum.sum != expected)
+            wrong++;
+    }
+    if (misaligned) {
+        fprintf(stderr, "%ld misaligned views\n", misaligned);
+        exit(1);
+    }
+    if (wrong) {
+        fprintf(stderr, "%d wrong results\n", wrong);
+        exit(1);
+    }
+
+    printf("aligned sums of %ld elements: correct\n", n);
+    print_runtime(running_time, TIMING_COUNT);
+    return 0;
+}
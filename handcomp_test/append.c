@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Collect 0 to n-1 in order with a vector-append reducer, whose reduction
+ * copies the right vector onto the end of the left one, to measure the cost of
+ * reducing large views.  Run with CILK_LAZY_REDUCE to defer reductions.
+ *
+ * vector out;  // an append reducer
+ *
+ * void collect(long lo, long hi) {
+ *     if (hi - lo <= GRAIN) {
+ *         for (long i = lo; i < hi; ++i)
+ *             push(&out, i);
+ *         return;
+ *     }
+ *     long mid = lo + (hi - lo) / 2;
+ *     cilk_spawn collect(lo, mid);
+ *     collect(mid, hi);
+ *     cilk_sync;
+ * }
+ */
+
+#define GRAIN 1024
+
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+typedef struct vector {
+    long *data;
+    long size;
+    long capacity;
+} vector;
+
+static vector out;
+static long copied; // elements copied by reductions
+
+static void push(vector *v, long x) {
+    if (v->size == v->capacity) {
+        v->capacity = v->capacity ? 2 * v->capacity : GRAIN;
+        v->data = (long *)realloc(v->data, v->capacity * sizeof(long));
+    }
+    v->data[v->size++] = x;
+}
+
+static void identity(void *v) { memset(v, 0, sizeof(vector)); }
+
+static void append(void *l, void *r) {
+    vector *left = (vector *)l, *right = (vector *)r;
+    if (left->size + right->size > left->capacity) {
+        left->capacity = 2 * (left->size + right->size);
+        left->data = (long *)realloc(left->data, left->capacity * sizeof(long));
+    }
+    memcpy(left->data + left->size, right->data, right->size * sizeof(long));
+    left->size += right->size;
+    __atomic_fetch_add(&copied, right->size, __ATOMIC_RELAXED);
+    free(right->data);
+}
+
+static void __attribute__((noinline))
+collect_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent);
+
+static void collect(long lo, long hi) {
+    if (hi - lo <= GRAIN) {
+        vector *view = (vector *)__cilkrts_reducer_lookup(
+            &out, sizeof(vector), identity, append);
+        for (long i = lo; i < hi; ++i)
+            push(view, i);
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+    /* spawn collect(lo, mid) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        collect_spawn_helper(lo, mid, &sf);
+    }
+
+    collect(mid, hi);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+collect_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    collect(lo, hi);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+// Register the vector as a reducer for the duration of a parallel collect.
+static void collect_all(long n) {
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    __cilkrts_reducer_register(&out, sizeof(vector), identity, append);
+
+    /* spawn collect(0, n / 2) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        collect_spawn_helper(0, n / 2, &sf);
+    }
+
+    collect(n / 2, n);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilkrts_reducer_unregister(&out);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+int main(int argc, char *args[]) {
+    long n = 10000000;
+    uint64_t running_time[TIMING_COUNT];
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: append [<cilk-options>] [<n>]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        n = atol(args[1]);
+
+    int wrong = 0;
+    long total_copied = 0;
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        identity(&out);
+        copied = 0;
+        clockmark_t begin = ktiming_getmark();
+        collect_all(n);
+        clockmark_t end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+        total_copied += copied;
+        if (out.size != n)
+            wrong++;
+        else
+            for (long j = 0; j < n; ++j)
+                if (out.data[j] != j) {
+                    wrong++;
+                    break;
+                }
+        free(out.data);
+    }
+    if (wrong) {
+        fprintf(stderr, "%d wrong results\n", wrong);
+        exit(1);
+    }
+
+    printf("append of %ld elements: correct\n", n);
+    print_runtime(running_time, TIMING_COUNT);
+    printf("Copies by reductions: %.2f per element\n",
+           (double)total_copied / TIMING_COUNT / n);
+    return 0;
+}
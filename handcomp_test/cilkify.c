@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Measure the round-trip latency of entering and leaving a cilkified region,
+ * for an empty region and for a tiny region that spawns one small task.
+ *
+ * void empty(void) {}
+ *
+ * int tiny(int n) {
+ *     int x = cilk_spawn work(n);
+ *     int y = work(n);
+ *     cilk_sync;
+ *     return x + y;
+ * }
+ */
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static int __attribute__((noinline)) work(int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += i ^ (sum >> 1);
+    return sum;
+}
+
+static void __attribute__((noinline)) empty(void) {
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+tiny_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent);
+
+static int __attribute__((noinline)) tiny(int n) {
+    int x = 0, y, _tmp;
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    /* x = spawn work(n) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        tiny_spawn_helper(&x, n, &sf);
+    }
+
+    y = work(n);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__((noinline))
+tiny_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = work(n);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+int main(int argc, char *args[]) {
+    int i, r;
+    int reps = 100000, n = 1000, res = 0;
+    clockmark_t begin, end;
+    uint64_t empty_time[TIMING_COUNT], tiny_time[TIMING_COUNT];
+
+    if (argc > 3) {
+        fprintf(stderr, "Usage: cilkify [<cilk-options>] [<reps> [<n>]]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        reps = atoi(args[1]);
+    if (argc > 2)
+        n = atoi(args[2]);
+
+    for (i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        for (r = 0; r < reps; r++)
+            empty();
+        end = ktiming_getmark();
+        empty_time[i] = ktiming_diff_nsec(&begin, &end) / reps;
+
+        begin = ktiming_getmark();
+        for (r = 0; r < reps; r++)
+            res += tiny(n);
+        end = ktiming_getmark();
+        tiny_time[i] = ktiming_diff_nsec(&begin, &end) / reps;
+    }
+    printf("Result: %d\n", res);
+    printf("Empty region, time per round trip:\n");
+    print_runtime(empty_time, TIMING_COUNT);
+    printf("Tiny region (n = %d), time per round trip:\n", n);
+    print_runtime(tiny_time, TIMING_COUNT);
+
+    return 0;
+}
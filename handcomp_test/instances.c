@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Run fib concurrently from two threads, each on its own runtime instance:
+ * a small "latency" instance and a larger "batch" instance.
+ */
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static void __attribute__((noinline))
+fib_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent);
+
+static int fib(int n) {
+    int x = 0, y, _tmp;
+
+    if (n < 2)
+        return n;
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    /* x = spawn fib(n-1) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        fib_spawn_helper(&x, n - 1, &sf);
+    }
+
+    y = fib(n - 2);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__((noinline))
+fib_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = fib(n);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+struct caller {
+    const char *instance;
+    unsigned nworkers;
+    int n;
+    int reps;
+    int res;
+    uint64_t running_time[TIMING_COUNT];
+};
+
+static void *caller_thread(void *arg) {
+    struct caller *c = (struct caller *)arg;
+    __cilkrts_use_instance(__cilkrts_find_instance(c->instance));
+    if (__cilkrts_get_nworkers() != c->nworkers) {
+        fprintf(stderr, "Instance %s has %u workers, expected %u\n",
+                c->instance, __cilkrts_get_nworkers(), c->nworkers);
+        exit(1);
+    }
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        clockmark_t begin = ktiming_getmark();
+        for (int r = 0; r < c->reps; r++)
+            c->res = fib(c->n);
+        clockmark_t end = ktiming_getmark();
+        c->running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    return NULL;
+}
+
+int main(int argc, char *args[]) {
+    int n = 30;
+    unsigned nworkers = __cilkrts_get_nworkers();
+    unsigned small = nworkers > 4 ? nworkers / 4 : 1;
+    unsigned big = nworkers > small ? nworkers - small : 1;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: instances [<cilk-options>] [<n>]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        n = atoi(args[1]);
+
+    if (!__cilkrts_create_instance("latency", small) ||
+        !__cilkrts_create_instance("batch", big)) {
+        fprintf(stderr, "Cannot create runtime instances\n");
+        exit(1);
+    }
+
+    struct caller callers[2] = {
+        {.instance = "latency", .nworkers = small, .n = n - 8, .reps = 100},
+        {.instance = "batch", .nworkers = big, .n = n, .reps = 1}};
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++)
+        pthread_create(&threads[i], NULL, caller_thread, &callers[i]);
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < 2; i++) {
+        int expected = fib(callers[i].n);
+        if (callers[i].res != expected) {
+            fprintf(stderr, "Wrong result on instance %s: %d, expected %d\n",
+                    callers[i].instance, callers[i].res, expected);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        printf("Instance %s, fib(%d) x %d:\n", callers[i].instance,
+               callers[i].n, callers[i].reps);
+        print_runtime(callers[i].running_time, TIMING_COUNT);
+    }
+
+    // Run on an instance from this thread, then destroy it and run on the
+    // default instance again.
+    __cilkrts_use_instance(__cilkrts_find_instance("latency"));
+    int res = fib(n - 8);
+    __cilkrts_use_instance(NULL);
+    __cilkrts_destroy_instance(__cilkrts_find_instance("latency"));
+    __cilkrts_destroy_instance(__cilkrts_find_instance("batch"));
+    if (__cilkrts_get_worker_number() != 0 || fib(n - 8) != res) {
+        fprintf(stderr, "Wrong state after destroying the instances\n");
+        exit(1);
+    }
+    return 0;
+}
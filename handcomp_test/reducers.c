@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Histogram with one opadd reducer per bin, to measure the cost of looking up
+ * and merging many scalar reducer views.
+ *
+ * long bins[nbins];  // each an opadd reducer
+ *
+ * void count(long lo, long hi) {
+ *     if (hi - lo <= GRAIN) {
+ *         for (long i = lo; i < hi; ++i)
+ *             bins[bin_of(i)] += 1;
+ *         return;
+ *     }
+ *     long mid = lo + (hi - lo) / 2;
+ *     cilk_spawn count(lo, mid);
+ *     count(mid, hi);
+ *     cilk_sync;
+ * }
+ */
+
+#define GRAIN 256
+
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static long *bins;
+static unsigned int nbins;
+
+static void zero(void *v) { *(long *)v = 0; }
+static void add(void *l, void *r) { *(long *)l += *(long *)r; }
+
+static inline unsigned int bin_of(long i) {
+    return (unsigned int)((uint32_t)i * 2654435761u) % nbins;
+}
+
+static void __attribute__((noinline))
+count_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent);
+
+static void count(long lo, long hi) {
+    if (hi - lo <= GRAIN) {
+        for (long i = lo; i < hi; ++i) {
+            long *view = (long *)__cilkrts_reducer_lookup(
+                &bins[bin_of(i)], sizeof(long), zero, add);
+            *view += 1;
+        }
+        return;
+    }
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    long mid = lo + (hi - lo) / 2;
+    /* spawn count(lo, mid) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        count_spawn_helper(lo, mid, &sf);
+    }
+
+    count(mid, hi);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+count_spawn_helper(long lo, long hi, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    count(lo, hi);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+// Register the bins as reducers for the duration of a parallel count.
+static void histogram(long n) {
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    for (unsigned int b = 0; b < nbins; ++b)
+        __cilkrts_reducer_register(&bins[b], sizeof(long), zero, add);
+
+    /* spawn count(0, n / 2) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        count_spawn_helper(0, n / 2, &sf);
+    }
+
+    count(n / 2, n);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+
+    for (unsigned int b = 0; b < nbins; ++b)
+        __cilkrts_reducer_unregister(&bins[b]);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+int main(int argc, char *args[]) {
+    long n = 10000000;
+    uint64_t running_time[TIMING_COUNT];
+
+    nbins = 4096;
+    if (argc > 3) {
+        fprintf(stderr, "Usage: reducers [<cilk-options>] [<nbins> [<n>]]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        nbins = atoi(args[1]);
+    if (argc > 2)
+        n = atol(args[2]);
+
+    bins = (long *)calloc(nbins, sizeof(long));
+    long *expected = (long *)calloc(nbins, sizeof(long));
+    for (long i = 0; i < n; ++i)
+        expected[bin_of(i)]++;
+
+    int wrong = 0;
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        for (unsigned int b = 0; b < nbins; ++b)
+            bins[b] = 0;
+        clockmark_t begin = ktiming_getmark();
+        histogram(n);
+        clockmark_t end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+        for (unsigned int b = 0; b < nbins; ++b)
+            if (bins[b] != expected[b])
+                wrong++;
+    }
+    if (wrong) {
+        fprintf(stderr, "%d wrong bins\n", wrong);
+        exit(1);
+    }
+
+    printf("histogram of %ld into %u reducers: correct\n", n, nbins);
+    print_runtime(running_time, TIMING_COUNT);
+    for (int i = 0; i < TIMING_COUNT; i++)
+        printf("Update latency: %.1f ns\n", (double)running_time[i] / n);
+    free(expected);
+    free(bins);
+    return 0;
+}
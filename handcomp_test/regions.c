@@ -0,0 +1,128 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Measure the throughput of parallel regions started concurrently by several
+ * caller threads that share the default runtime instance.  Each caller runs
+ * fib(n) as a separate region reps times.
+ */
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static void __attribute__((noinline))
+fib_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent);
+
+static int fib(int n) {
+    int x = 0, y, _tmp;
+
+    if (n < 2)
+        return n;
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    /* x = spawn fib(n-1) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        fib_spawn_helper(&x, n - 1, &sf);
+    }
+
+    y = fib(n - 2);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__((noinline))
+fib_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = fib(n);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+struct caller {
+    int n;
+    int reps;
+    int wrong;
+};
+
+static int expected;
+
+static void *caller_thread(void *arg) {
+    struct caller *c = (struct caller *)arg;
+    for (int r = 0; r < c->reps; r++)
+        if (fib(c->n) != expected)
+            c->wrong++;
+    return NULL;
+}
+
+int main(int argc, char *args[]) {
+    int ncallers = 4, n = 20, reps = 1000;
+    uint64_t running_time[TIMING_COUNT];
+
+    if (argc > 4) {
+        fprintf(stderr,
+                "Usage: regions [<cilk-options>] [<callers> [<n> [<reps>]]]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        ncallers = atoi(args[1]);
+    if (argc > 2)
+        n = atoi(args[2]);
+    if (argc > 3)
+        reps = atoi(args[3]);
+    if (ncallers < 1)
+        ncallers = 1;
+
+    expected = fib(n);
+    struct caller *callers =
+        (struct caller *)calloc(ncallers, sizeof(struct caller));
+    pthread_t *threads = (pthread_t *)calloc(ncallers, sizeof(pthread_t));
+
+    int wrong = 0;
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        clockmark_t begin = ktiming_getmark();
+        for (int c = 0; c < ncallers; c++) {
+            callers[c].n = n;
+            callers[c].reps = reps;
+            pthread_create(&threads[c], NULL, caller_thread, &callers[c]);
+        }
+        for (int c = 0; c < ncallers; c++)
+            pthread_join(threads[c], NULL);
+        clockmark_t end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    for (int c = 0; c < ncallers; c++)
+        wrong += callers[c].wrong;
+    if (wrong) {
+        fprintf(stderr, "%d wrong results\n", wrong);
+        exit(1);
+    }
+
+    printf("%d callers, fib(%d) x %d each:\n", ncallers, n, reps);
+    print_runtime(running_time, TIMING_COUNT);
+    for (int i = 0; i < TIMING_COUNT; i++)
+        printf("Regions per second: %.0f\n",
+               (double)ncallers * reps * 1e9 / running_time[i]);
+
+    free(threads);
+    free(callers);
+    return 0;
+}
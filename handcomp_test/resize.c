@@ -0,0 +1,128 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Run fib repeatedly while another thread keeps changing the number of active
+ * workers, both between and during parallel regions.
+ */
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static void __attribute__((noinline))
+fib_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent);
+
+static int fib(int n) {
+    int x = 0, y, _tmp;
+
+    if (n < 2)
+        return n;
+
+    dummy(alloca(ZERO));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    /* x = spawn fib(n-1) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        fib_spawn_helper(&x, n - 1, &sf);
+    }
+
+    y = fib(n - 2);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__((noinline))
+fib_spawn_helper(int *x, int n, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = fib(n);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+static atomic_bool stop;
+
+// Cycle the number of active workers between 1 and all of them.
+static void *resizer_thread(void *arg) {
+    unsigned nworkers = *(unsigned *)arg;
+    const struct timespec pause = {.tv_sec = 0, .tv_nsec = 200000};
+    unsigned active = nworkers;
+    while (!atomic_load(&stop)) {
+        active = active > 1 ? active - 1 : nworkers;
+        __cilkrts_set_active_workers(active);
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+int main(int argc, char *args[]) {
+    int n = 24, reps = 200;
+    uint64_t running_time[TIMING_COUNT];
+
+    if (argc > 3) {
+        fprintf(stderr, "Usage: resize [<cilk-options>] [<n> [<reps>]]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        n = atoi(args[1]);
+    if (argc > 2)
+        reps = atoi(args[2]);
+
+    unsigned nworkers = __cilkrts_get_nworkers();
+    int expected = fib(n);
+    int wrong = 0;
+
+    // Shrink and grow the worker set between regions.
+    for (unsigned active = nworkers; active > 0; --active) {
+        __cilkrts_set_active_workers(active);
+        if (fib(n) != expected)
+            wrong++;
+    }
+    for (unsigned active = 1; active <= nworkers; ++active) {
+        __cilkrts_set_active_workers(active);
+        if (fib(n) != expected)
+            wrong++;
+    }
+
+    // Resize the worker set while regions run.
+    pthread_t resizer;
+    pthread_create(&resizer, NULL, resizer_thread, &nworkers);
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        clockmark_t begin = ktiming_getmark();
+        for (int r = 0; r < reps; r++)
+            if (fib(n) != expected)
+                wrong++;
+        clockmark_t end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    atomic_store(&stop, true);
+    pthread_join(resizer, NULL);
+    __cilkrts_set_active_workers(nworkers);
+
+    if (wrong) {
+        fprintf(stderr, "%d wrong results\n", wrong);
+        exit(1);
+    }
+    printf("fib(%d) x %d while resizing %u workers:\n", n, reps, nworkers);
+    print_runtime(running_time, TIMING_COUNT);
+    printf("Active workers: %u\n", __cilkrts_get_active_workers());
+    return 0;
+}
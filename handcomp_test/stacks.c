@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../runtime/cilk2c.h"
+#include "../runtime/cilk2c_inlined.c"
+#include "ktiming.h"
+
+#ifndef TIMING_COUNT
+#define TIMING_COUNT 1
+#endif
+
+/*
+ * Measure the latency of getting fiber stacks.  The first parallel region
+ * starts the workers, which fill their fiber pools.  Each later region is a
+ * burst of steals: every stolen continuation runs on a fresh fiber and touches
+ * kb kilobytes of its stack, so the region pays for stack allocation and page
+ * faults.  If warmup is positive, __cilkrts_warmup fills each worker's pool
+ * with that many fibers before the first region.
+ */
+
+extern size_t ZERO;
+void __attribute__((weak)) dummy(void *p) { return; }
+
+static int kb = 16;
+
+// Resident memory of this process in KB, or -1 if unknown.
+static long resident_kb(void) {
+    long pages = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*ld %ld", &pages) != 1)
+            pages = -1;
+        fclose(f);
+    }
+    return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void __attribute__((noinline))
+burst_spawn_helper(long *x, int depth, __cilkrts_stack_frame *parent);
+
+static long burst(int depth) {
+    long x = 0, y, _tmp;
+
+    // Touch the stack below this frame.
+    char *buf = alloca(kb * 1024 + ZERO);
+    memset(buf, depth, kb * 1024);
+    dummy(buf);
+
+    if (depth == 0)
+        return 1 + buf[0];
+
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    /* x = spawn burst(depth-1) */
+    if (!__cilk_prepare_spawn(&sf)) {
+        burst_spawn_helper(&x, depth - 1, &sf);
+    }
+
+    y = burst(depth - 1);
+
+    /* cilk_sync */
+    __cilk_sync_nothrow(&sf);
+    _tmp = x + y;
+
+    __cilk_parent_epilogue(&sf);
+
+    return _tmp;
+}
+
+static void __attribute__((noinline))
+burst_spawn_helper(long *x, int depth, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    *x = burst(depth);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+int main(int argc, char *args[]) {
+    int depth = 12, reps = 100, warmup = 0;
+    uint64_t running_time[TIMING_COUNT];
+
+    if (argc > 5) {
+        fprintf(stderr, "Usage: stacks [<cilk-options>] "
+                        "[<depth> [<reps> [<kb> [<warmup>]]]]\n");
+        exit(1);
+    }
+    if (argc > 1)
+        depth = atoi(args[1]);
+    if (argc > 2)
+        reps = atoi(args[2]);
+    if (argc > 3)
+        kb = atoi(args[3]);
+    if (argc > 4)
+        warmup = atoi(args[4]);
+
+    clockmark_t begin, end;
+    if (warmup > 0) {
+        begin = ktiming_getmark();
+        if (__cilkrts_warmup(warmup, 64 * 1024) != 0) {
+            fprintf(stderr, "Warmup failed\n");
+            exit(1);
+        }
+        end = ktiming_getmark();
+        printf("Warmup time: %f s\n", ktiming_diff_sec(&begin, &end));
+    }
+
+    begin = ktiming_getmark();
+    long expected = burst(1);
+    end = ktiming_getmark();
+    printf("Startup latency: %f s\n", ktiming_diff_sec(&begin, &end));
+
+    expected = burst(depth);
+    int wrong = 0;
+    for (int i = 0; i < TIMING_COUNT; i++) {
+        begin = ktiming_getmark();
+        for (int r = 0; r < reps; r++)
+            if (burst(depth) != expected)
+                wrong++;
+        end = ktiming_getmark();
+        running_time[i] = ktiming_diff_nsec(&begin, &end);
+    }
+    if (wrong) {
+        fprintf(stderr, "%d wrong results\n", wrong);
+        exit(1);
+    }
+
+    printf("burst(%d) touching %d KB x %d:\n", depth, kb, reps);
+    print_runtime(running_time, TIMING_COUNT);
+    for (int i = 0; i < TIMING_COUNT; i++)
+        printf("Burst latency: %.1f us\n", running_time[i] * 1e-3 / reps);
+    long rss = resident_kb();
+    if (rss >= 0)
+        printf("Resident memory: %ld KB\n", rss);
+    return 0;
+}
@@ -17,6 +17,94 @@ unsigned __cilkrts_get_nworkers(void);
 unsigned __cilkrts_get_worker_number(void) __attribute__((deprecated));
 int __cilkrts_running_on_workers(void);
 
+/* Policy that idle workers use to back off, sleep, and disengage when they
+   fail to steal work.  Smaller values favor wake-up latency, larger values
+   favor saving CPU time.  The defaults can be overridden with the environment
+   variables named below. */
+typedef struct __cilkrts_sleep_policy {
+    /* Steal attempts per round; must divide sentinel_threshold.
+       CILK_STEAL_ATTEMPTS */
+    unsigned steal_attempts;
+    /* Consecutive failed steals after which a thief counts as a sentinel; must
+       be a power of 2.  CILK_SENTINEL_THRESHOLD */
+    unsigned sentinel_threshold;
+    /* Target ratio of active workers to sentinels.  CILK_AS_RATIO */
+    unsigned as_ratio;
+    /* Number of samples of worker counts used to decide when to disengage or
+       reengage workers, between 4 and 32.  CILK_SLEEP_HISTORY */
+    unsigned history_length;
+    /* Nanoseconds to nap, and to sleep after failing for much longer, when a
+       thief cannot disengage.  CILK_NAP_NSEC, CILK_SLEEP_NSEC */
+    unsigned nap_nsec;
+    unsigned sleep_nsec;
+    /* Delay per steal attempt between rounds, and additional delay for
+       thieves that have failed many attempts.  CILK_BACKOFF,
+       CILK_BACKOFF_FAIL */
+    unsigned backoff;
+    unsigned backoff_fail;
+    /* If nonzero, each thief scales its delay between rounds by its recent
+       steal success rate.  CILK_SLEEP_ADAPTIVE */
+    int adaptive;
+} __cilkrts_sleep_policy;
+
+/* Get or set the sleep policy.  A new policy takes effect at the start of the
+   next parallel region.  Both return 0 on success, and nonzero if the runtime
+   is not initialized or, for __cilkrts_set_sleep_policy, if the policy is
+   invalid or the caller is in a parallel region. */
+int __cilkrts_get_sleep_policy(__cilkrts_sleep_policy *policy);
+int __cilkrts_set_sleep_policy(const __cilkrts_sleep_policy *policy);
+
+/* Limit the number of workers that take part in parallel regions to at most
+   nworkers, between 1 and the number of workers the runtime started with.  The
+   limit applies to the instance targeted by the calling thread and takes
+   effect immediately, even within a parallel region: excess workers park as
+   soon as they run out of work, and parked workers cost no CPU time.  Returns
+   0 on success.  By default, the runtime starts no more workers than the CPU
+   quota of the process's cgroup allows (see CILK_QUOTA_POLICY), and then a
+   watcher thread updates the limit whenever the quota changes; the watcher
+   can also be enabled or disabled with CILK_CGROUP_WATCH_MSEC.
+   __cilkrts_get_active_workers returns the current limit. */
+int __cilkrts_set_active_workers(unsigned nworkers);
+unsigned __cilkrts_get_active_workers(void);
+
+/* Warm up the runtime before its first parallel region, so that region does
+   not pay for starting threads and faulting in memory.  Starts all workers of
+   the instance targeted by the calling thread, has each worker fill its own
+   fiber pool with nfibers fibers whose stacks are faulted in and preallocate
+   closure_bytes of closures, on its own NUMA node, and returns once every
+   worker is asleep.  Returns 0 on success, and nonzero if the workers were
+   already started or the caller is in a parallel region.  Setting
+   CILK_WARMUP=nfibers and CILK_WARMUP_CLOSURES=closure_bytes warms up the
+   default instance at startup. */
+int __cilkrts_warmup(unsigned nfibers, size_t closure_bytes);
+
+/* Independent runtime instances.  Each instance has its own workers, fiber
+   pools and sleep policy, configured from the environment like the default
+   instance.  A parallel region runs on the instance targeted by the thread
+   that starts it, which is the default instance unless the thread has called
+   __cilkrts_use_instance.  Regions started by different threads on different
+   instances run concurrently.  The sleep-policy functions above apply to the
+   instance targeted by the calling thread. */
+typedef struct __cilkrts_instance __cilkrts_instance;
+
+/* Create an instance with a unique name and nworkers workers, or the default
+   number of workers if nworkers is 0.  Returns NULL on failure. */
+__cilkrts_instance *__cilkrts_create_instance(const char *name,
+                                              unsigned nworkers);
+/* Destroy an instance that is not running a parallel region and that no
+   thread targets.  Returns 0 on success. */
+int __cilkrts_destroy_instance(__cilkrts_instance *instance);
+/* Find an instance by name, or return NULL. */
+__cilkrts_instance *__cilkrts_find_instance(const char *name);
+/* Make the calling thread target an instance, or the default instance if
+   instance is NULL.  Returns the previously targeted instance, or NULL for
+   the default instance. */
+__cilkrts_instance *__cilkrts_use_instance(__cilkrts_instance *instance);
+/* Reduce the number of workers of an instance before its first parallel
+   region.  Returns 0 on success. */
+int __cilkrts_set_instance_nworkers(__cilkrts_instance *instance,
+                                    unsigned nworkers);
+
 #include <inttypes.h>
 typedef struct __cilkrts_pedigree {
     uint64_t rank;
@@ -0,0 +1,251 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cgroup.h"
+#include "debug.h"
+#include "global.h"
+
+#define CGROUP_DIR "/sys/fs/cgroup"
+#define CGROUP_PATH_MAX 640
+
+// State of the thread that keeps the worker limit in line with the quota.
+struct cilk_cgroup_watch {
+    global_state *g;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond_var;
+    bool stop;
+};
+
+#ifdef __linux__
+// Find the path of this process's cgroup in the unified (v2) hierarchy, from
+// the "0::<path>" line of /proc/self/cgroup.  Returns false if there is none.
+static bool read_cgroup_path(char *buf, size_t len) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f)
+        return false;
+    bool found = false;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(buf, len, "%s", line + 3);
+            found = true;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// The tightest CPU quota on the path from this process's cgroup to the root,
+// and the directory of the cgroup that sets it.
+struct cgroup_quota {
+    unsigned long quota;
+    unsigned long period;
+    char dir[CGROUP_PATH_MAX];
+};
+
+// Read the quota in the cpu.max file of the cgroup directory dir.  Returns
+// false if the file has no quota or cannot be read.
+static bool read_cpu_max(const char *dir, unsigned long *quota,
+                         unsigned long *period) {
+    char path[CGROUP_PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/cpu.max", dir);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    char buf[32];
+    int n = fscanf(f, "%31s %lu", buf, period);
+    fclose(f);
+    if (n != 2 || *period == 0 || strcmp(buf, "max") == 0)
+        return false;
+    *quota = strtoul(buf, NULL, 10);
+    return *quota > 0;
+}
+
+// A quota on any ancestor also limits this process's cgroup, so find the
+// smallest quota on the path to the root.  Returns false if there is none.
+static bool read_quota(struct cgroup_quota *q) {
+    char cgroup[512];
+    if (!read_cgroup_path(cgroup, sizeof(cgroup)))
+        return false;
+
+    char dir[CGROUP_PATH_MAX];
+    snprintf(dir, sizeof(dir), CGROUP_DIR "%s",
+             strcmp(cgroup, "/") == 0 ? "" : cgroup);
+    size_t root_len = strlen(CGROUP_DIR);
+    bool found = false;
+    while (true) {
+        unsigned long quota, period;
+        if (read_cpu_max(dir, &quota, &period) &&
+            (!found || (unsigned long long)quota * q->period <
+                           (unsigned long long)q->quota * period)) {
+            q->quota = quota;
+            q->period = period;
+            snprintf(q->dir, sizeof(q->dir), "%s", dir);
+            found = true;
+        }
+        char *slash = strrchr(dir, '/');
+        if (!slash || (size_t)(slash - dir) < root_len)
+            break;
+        *slash = '\0';
+    }
+    return found;
+}
+
+// Read the number of throttled periods from the cpu.stat file of the cgroup
+// directory dir.  Returns false if it cannot be read.
+static bool read_nr_throttled(const char *dir, unsigned long *nr_throttled) {
+    char path[CGROUP_PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/cpu.stat", dir);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    bool found = false;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "nr_throttled %lu", nr_throttled) == 1) {
+            found = true;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static unsigned int round_quota(const struct cgroup_quota *q,
+                                enum cilk_quota_policy policy) {
+    switch (policy) {
+    case QUOTA_NONE:
+        return 0;
+    case QUOTA_FLOOR:
+        return q->quota >= q->period ? (unsigned int)(q->quota / q->period) : 1;
+    default:
+        return (unsigned int)((q->quota + q->period - 1) / q->period);
+    }
+}
+
+// Take one sample for the watcher of g.  *last is the worker limit the watcher
+// last applied, and *last_throttled the number of throttled periods at the
+// last sample, or ULONG_MAX if unknown.
+static void watch_sample(global_state *g, unsigned int *last,
+                         unsigned long *last_throttled) {
+    struct cgroup_quota q;
+    bool has_quota = read_quota(&q);
+    unsigned int quota =
+        has_quota
+            ? round_quota(&q, (enum cilk_quota_policy)g->options.quota_policy)
+            : 0;
+    // Only act on changes to the quota, so a limit set with
+    // __cilkrts_set_active_workers holds until the quota changes.
+    unsigned int limit = quota > 0 ? quota : g->nworkers;
+    if (limit != *last) {
+        cilkrts_alert(BOOT, "(watch_sample) CPU quota %u", quota);
+        *last = limit;
+        set_worker_limit(g, limit);
+    }
+
+    // The cgroup counts as throttled if it was throttled in any period since
+    // the last sample.
+    bool throttled = false;
+    unsigned long nr_throttled;
+    if (has_quota && read_nr_throttled(q.dir, &nr_throttled)) {
+        throttled =
+            *last_throttled != ULONG_MAX && nr_throttled > *last_throttled;
+        *last_throttled = nr_throttled;
+    }
+    if (throttled !=
+        atomic_load_explicit(&g->throttled, memory_order_relaxed)) {
+        cilkrts_alert(BOOT, "(watch_sample) throttled %d", throttled);
+        atomic_store_explicit(&g->throttled, throttled, memory_order_relaxed);
+    }
+}
+#endif // __linux__
+
+unsigned int cilk_cgroup_cpu_quota(enum cilk_quota_policy policy) {
+#ifdef __linux__
+    struct cgroup_quota q;
+    if (!read_quota(&q))
+        return 0;
+    return round_quota(&q, policy);
+#else
+    (void)policy;
+    return 0;
+#endif
+}
+
+static void *cgroup_watch_proc(void *arg) {
+    struct cilk_cgroup_watch *watch = (struct cilk_cgroup_watch *)arg;
+    global_state *g = watch->g;
+    unsigned int msec = g->options.cgroup_watch_msec;
+    __attribute__((unused)) unsigned int last =
+        atomic_load_explicit(&g->worker_limit, memory_order_relaxed);
+    __attribute__((unused)) unsigned long last_throttled = ULONG_MAX;
+
+    pthread_mutex_lock(&watch->lock);
+    while (!watch->stop) {
+#ifdef __linux__
+        watch_sample(g, &last, &last_throttled);
+#endif
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += msec / 1000;
+        deadline.tv_nsec += (long)(msec % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!watch->stop &&
+               pthread_cond_timedwait(&watch->cond_var, &watch->lock,
+                                      &deadline) != ETIMEDOUT)
+            ;
+    }
+    pthread_mutex_unlock(&watch->lock);
+    return NULL;
+}
+
+void cilk_cgroup_watch_start(global_state *g) {
+    if (g->options.cgroup_watch_msec == 0 || g->cgroup_watch)
+        return;
+    struct cilk_cgroup_watch *watch =
+        (struct cilk_cgroup_watch *)calloc(1, sizeof(*watch));
+    watch->g = g;
+    pthread_mutex_init(&watch->lock, NULL);
+    pthread_cond_init(&watch->cond_var, NULL);
+    int status = pthread_create(&watch->thread, NULL, cgroup_watch_proc, watch);
+    if (status != 0) {
+        cilkrts_alert(BOOT, "(cilk_cgroup_watch_start) failed: %s",
+                      strerror(status));
+        pthread_mutex_destroy(&watch->lock);
+        pthread_cond_destroy(&watch->cond_var);
+        free(watch);
+        return;
+    }
+    g->cgroup_watch = watch;
+}
+
+void cilk_cgroup_watch_stop(global_state *g) {
+    struct cilk_cgroup_watch *watch = g->cgroup_watch;
+    if (!watch)
+        return;
+    pthread_mutex_lock(&watch->lock);
+    watch->stop = true;
+    pthread_cond_signal(&watch->cond_var);
+    pthread_mutex_unlock(&watch->lock);
+    pthread_join(watch->thread, NULL);
+    pthread_mutex_destroy(&watch->lock);
+    pthread_cond_destroy(&watch->cond_var);
+    free(watch);
+    g->cgroup_watch = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+// CPU quota of the cgroup (v2) containing this process, read from cpu.max, for
+// choosing and limiting the number of active workers.
+
+#include "rts-config.h"
+#include "types.h"
+
+// Policies for deriving a number of workers from a fractional CPU quota,
+// selected with CILK_QUOTA_POLICY.
+enum cilk_quota_policy {
+    QUOTA_NONE = 0, // ignore the quota
+    QUOTA_CEIL,     // round the quota up to whole CPUs
+    QUOTA_FLOOR,    // round the quota down to whole CPUs, but at least 1
+};
+
+// Returns the number of CPUs that the cpu.max quotas of the cgroup of this
+// process and of its ancestors allow, rounded according to policy, or 0 if
+// there is no quota, it cannot be read, or policy is QUOTA_NONE.
+CHEETAH_INTERNAL unsigned int
+cilk_cgroup_cpu_quota(enum cilk_quota_policy policy);
+
+// Start and stop a thread that periodically rereads the CPU quota and sets the
+// worker limit of g to match whenever the quota changes.  The thread also sets
+// g->throttled while the cgroup with the binding quota is being throttled.
+// Starting does nothing unless g->options.cgroup_watch_msec is nonzero.
+CHEETAH_INTERNAL void cilk_cgroup_watch_start(global_state *g);
+CHEETAH_INTERNAL void cilk_cgroup_watch_stop(global_state *g);
+
+#endif /* _CGROUP_H */
@@ -47,7 +47,7 @@ extern bool __cilkrts_use_extension;
 #endif
 extern __thread __cilkrts_worker *__cilkrts_tls_worker;
 extern __thread struct cilk_fiber *__cilkrts_current_fh;
-extern bool __cilkrts_need_to_cilkify;
+extern __thread bool __cilkrts_need_to_cilkify;
 
 static inline __attribute__((always_inline)) __cilkrts_worker *
 __cilkrts_get_tls_worker(void) {
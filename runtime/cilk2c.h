@@ -73,6 +73,10 @@ CHEETAH_INTERNAL void __cilk_sync(__cilkrts_stack_frame *sf);
 // exception that needs to be handled.
 CHEETAH_INTERNAL void __cilk_sync_nothrow(__cilkrts_stack_frame *sf);
 
+// Reduces, in parallel, the views of large hypertables whose reductions the
+// joins at a cilk_sync deferred, once the frame has resumed after the sync.
+CHEETAH_API void __cilkrts_reduce_after_sync(void);
+
 // Deprecated?  Removes the current stack frame from the bottom of the stack.
 // (This logic has been manually inlined into __cilkrts_leave_frame,
 // __cilkrts_leave_frame_helper, and __cilkrts_pause_frame.)
@@ -29,8 +29,16 @@
 _Alignas(__cilkrts_stack_frame)
 size_t __cilkrts_stack_frame_align = __alignof__(__cilkrts_stack_frame);
 
+// Number of workers of the instance running the current region, or of the
+// instance that a region started by this thread would run on.
+static inline __attribute__((always_inline)) unsigned current_nworkers(void) {
+    if (__builtin_expect(!__cilkrts_need_to_cilkify, true))
+        return __cilkrts_get_tls_worker()->g->nworkers;
+    return __cilkrts_internal_target_nworkers();
+}
+
 __attribute__((always_inline)) unsigned __cilkrts_get_nworkers(void) {
-    return __cilkrts_nproc;
+    return current_nworkers();
 }
 
 // Internal method to get the Cilk worker ID.  Intended for debugging purposes.
@@ -51,10 +59,10 @@ void *__cilkrts_reducer_lookup(void *key, size_t size,
     if (__cilkrts_need_to_cilkify)
         return key;
     struct local_hyper_table *table = get_hyper_table();
-    struct bucket *b = find_hyperobject(table, (uintptr_t)key);
+    reducer_base *b = find_hyperobject(table, (uintptr_t)key);
     if (__builtin_expect(!!b, true)) {
         // Return the existing view.
-        return b->value.view;
+        return b->view;
     }
 
     return __cilkrts_insert_new_view(table, (uintptr_t)key, size,
@@ -169,6 +177,15 @@ __cilkrts_detach(__cilkrts_stack_frame *sf, __cilkrts_stack_frame *parent) {
     atomic_store_explicit(&w->tail, tail, memory_order_release);
 }
 
+// With CILK_PARALLEL_REDUCE, the joins at a sync defer the reductions of the
+// views of large hypertables.  Run them once the frame resumes.
+static inline __attribute__((always_inline)) void
+reduce_after_sync(__cilkrts_stack_frame *sf) {
+    struct local_hyper_table *table = get_worker_from_stack(sf)->hyper_table;
+    if (__builtin_expect(table && table->deferred, false))
+        __cilkrts_reduce_after_sync();
+}
+
 __attribute__((always_inline)) void __cilk_sync(__cilkrts_stack_frame *sf) {
     if (sf->flags & CILK_FRAME_UNSYNCHED || USE_EXTENSION) {
         if (sf->flags & CILK_FRAME_UNSYNCHED) {
@@ -180,6 +197,7 @@ __attribute__((always_inline)) void __cilk_sync(__cilkrts_stack_frame *sf) {
                 if (sf->flags & CILK_FRAME_EXCEPTION_PENDING) {
                     __cilkrts_check_exception_raise(sf);
                 }
+                reduce_after_sync(sf);
             }
         }
         if (USE_EXTENSION) {
@@ -198,6 +216,7 @@ __cilk_sync_nothrow(__cilkrts_stack_frame *sf) {
                 __cilkrts_sync(sf);
             } else {
                 sanitizer_finish_switch_fiber();
+                reduce_after_sync(sf);
             }
         }
         if (USE_EXTENSION) {
@@ -386,7 +405,7 @@ __internal_preserve_stack_frame_type_helper(void) {
 ///     grainsize = min(2048, ceil(n / (8 * nworkers)))
 #define __cilkrts_grainsize_fn_impl(NAME, INT_T)                               \
     __attribute__((always_inline)) INT_T NAME(INT_T n) {                       \
-        INT_T small_loop_grainsize = n / (8 * __cilkrts_nproc);                \
+        INT_T small_loop_grainsize = n / (8 * current_nworkers());             \
         if (small_loop_grainsize <= 1)                                         \
             return 1;                                                          \
         INT_T large_loop_grainsize = 2048;                                     \
@@ -399,10 +418,91 @@ __internal_preserve_stack_frame_type_helper(void) {
 
 __attribute__((always_inline)) uint8_t
 __cilkrts_cilk_for_grainsize_8(uint8_t n) {
-    uint8_t small_loop_grainsize = n / (8 * __cilkrts_nproc);
+    uint8_t small_loop_grainsize = n / (8 * current_nworkers());
     if (small_loop_grainsize <= 1)
         return 1;
     return small_loop_grainsize;
 }
 
 __cilkrts_grainsize_fn(16) __cilkrts_grainsize_fn(32) __cilkrts_grainsize_fn(64)
+
+static void __attribute__((noinline))
+reduce_view_pairs_spawn_helper(struct view_pair *pairs, int32_t lo, int32_t hi,
+                               int32_t grain, __cilkrts_stack_frame *parent);
+
+// Reduce the pairs of views in pairs[lo, hi), spawning the reductions of the
+// first half of any range of more than grain pairs.
+static void reduce_view_pairs(struct view_pair *pairs, int32_t lo, int32_t hi,
+                              int32_t grain) {
+    if (hi - lo <= grain) {
+        __cilkrts_reduce_view_pairs(pairs + lo, hi - lo);
+        return;
+    }
+
+    // Allocate dynamically from the stack so that the compiler addresses the
+    // locals of this frame from the frame pointer, which a thief keeps when it
+    // resumes the frame on another stack.
+    volatile size_t zero = 0;
+    __asm__ volatile("" : : "r"(__builtin_alloca(zero)));
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame(&sf);
+
+    int32_t mid = lo + (hi - lo) / 2;
+    if (!__cilk_prepare_spawn(&sf)) {
+        reduce_view_pairs_spawn_helper(pairs, lo, mid, grain, &sf);
+    }
+    reduce_view_pairs(pairs, mid, hi, grain);
+    __cilk_sync_nothrow(&sf);
+
+    __cilk_parent_epilogue(&sf);
+}
+
+static void __attribute__((noinline))
+reduce_view_pairs_spawn_helper(struct view_pair *pairs, int32_t lo, int32_t hi,
+                               int32_t grain, __cilkrts_stack_frame *parent) {
+    __cilkrts_stack_frame sf;
+    __cilkrts_enter_frame_helper(&sf, parent, false);
+    __cilkrts_detach(&sf, parent);
+    reduce_view_pairs(pairs, lo, hi, grain);
+    __cilk_helper_epilogue(&sf, parent, false);
+}
+
+void __cilkrts_reduce_after_sync(void) {
+    __cilkrts_worker *w = __cilkrts_get_tls_worker();
+    int32_t min_parallel = w->g->options.parallel_reduce;
+    if (min_parallel == 0)
+        return; // Leave the tables for CILK_LAZY_REDUCE.
+
+    // Fold the chain of deferred tables into the worker's table from the left.
+    // Merging a table only reorganizes the tables, after which the reductions
+    // of views of different keys are independent.  The rest of the chain stays
+    // off the worker's table while they run, so the syncs of the reductions
+    // leave it alone.
+    hyper_table *table = w->hyper_table;
+    hyper_table *next = table->deferred;
+    table->deferred = NULL;
+    table->chain_length = 0;
+    while (next) {
+        hyper_table *right = next;
+        next = right->deferred;
+        right->deferred = NULL;
+
+        struct view_pair *pairs;
+        int32_t npairs;
+        w->hyper_table =
+            __cilkrts_merge_hts_deferring(table, right, &pairs, &npairs);
+        cilkrts_alert(REDUCE, "(__cilkrts_reduce_after_sync) %d pairs of views",
+                      npairs);
+        if (npairs >= min_parallel)
+            reduce_view_pairs(pairs, 0, npairs,
+                              __cilkrts_cilk_for_grainsize_32(npairs));
+        else
+            __cilkrts_reduce_view_pairs(pairs, npairs);
+        free(pairs);
+
+        // The reductions may have finished on another worker.  Reducers they
+        // looked up may also have left deferred tables of their own.
+        w = __cilkrts_get_tls_worker();
+        table = get_local_hyper_table(w);
+    }
+}
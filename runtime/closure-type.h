@@ -38,6 +38,7 @@ struct Closure {
     enum ClosureStatus status : 8; /* doubles as magic number */
     bool has_cilk_callee;
     bool exception_pending;
+    bool root; /* root closure of a parallel region */
     unsigned int join_counter; /* number of outstanding spawned children */
     char *orig_rsp; /* the rsp one should use when sync successfully */
 
@@ -141,6 +141,7 @@ static inline void Closure_init(Closure *t, __cilkrts_stack_frame *frame) {
     t->status = CLOSURE_PRE_INVALID;
     t->has_cilk_callee = false;
     t->exception_pending = false;
+    t->root = false;
     t->join_counter = 0;
 
     t->frame = frame;
@@ -170,9 +171,8 @@ static inline void Closure_init(Closure *t, __cilkrts_stack_frame *frame) {
 
 static inline Closure *Closure_create(__cilkrts_worker *const w,
                                       __cilkrts_stack_frame *sf) {
-    /* cilk_internal_malloc returns sufficiently aligned memory */
-    Closure *new_closure =
-        cilk_internal_malloc(w, sizeof(*new_closure), IM_CLOSURE);
+    /* cilk_closure_alloc returns sufficiently aligned memory */
+    Closure *new_closure = (Closure *)cilk_closure_alloc(w);
     CILK_ASSERT(new_closure != NULL);
 
     Closure_init(new_closure, sf);
@@ -386,25 +386,26 @@ static inline void Closure_clean(Closure *t) {
     CILK_ASSERT_NULL(t->right_ht);
 }
 
-/* ANGE: destroy the closure and internally free it (put back to global
-   pool) */
+/* ANGE: destroy the closure and internally free it (put back to the slab of
+   the worker that allocated it) */
 static inline void Closure_destroy(struct __cilkrts_worker *const w,
                                    Closure *t) {
     cilkrts_alert(CLOSURE, "Deallocate closure %p", (void *)t);
     Closure_checkmagic(t);
     t->status = CLOSURE_POST_INVALID;
     Closure_clean(t);
-    cilk_internal_free(w, t, sizeof(*t), IM_CLOSURE);
+    cilk_closure_free(w, t);
 }
 
-/* Destroy the closure and internally free it (put back to global pool), after
-   workers have been terminated. */
+/* Destroy the closure and internally free it (put back to the slab of the
+   worker that allocated it), after workers have been terminated. */
 static inline void Closure_destroy_global(struct global_state *const g,
                                           Closure *t) {
     cilkrts_alert(CLOSURE, "Deallocate closure %p", (void *)t);
     t->status = CLOSURE_POST_INVALID;
     Closure_clean(t);
-    cilk_internal_free_global(g, t, sizeof(*t), IM_CLOSURE);
+    (void)g;
+    cilk_closure_free_global(t);
 }
 
 #endif
@@ -3,8 +3,12 @@
 
 #include "rts-config.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+
 struct __cilkrts_worker;
 struct __cilkrts_stack_frame;
+struct cilk_fiber_arena;
 
 // Structure inserted at the top of a fiber, to implement fiber-local storage.
 // The stack begins just below this structure.  See sysdep_get_stack_start().
@@ -26,8 +30,14 @@ struct cilk_fiber {
     // constant for the life of this structure.
     char *alloc_low;         // lowest byte of mapped region
     char *stack_low;         // lowest byte of stack region
+    struct cilk_fiber_arena *arena; // arena holding the stack, or NULL
+
+    // Deepest use of the stack seen when the fiber was trimmed, in bytes, and
+    // whether the fiber has been trimmed since it last left a pool.
+    size_t high_water;
+    bool trimmed;
 
-    // Three unused words remain 64 bit systems with 64 byte cache lines.
+    // No unused words remain on 64 bit systems with 64 byte cache lines.
 
 } __attribute__((aligned(CILK_CACHE_LINE)));
 
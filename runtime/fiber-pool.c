@@ -8,19 +8,22 @@
 #include "fiber.h"
 #include "global.h"
 #include "local.h"
-#include "mutex.h"
+#include "worker_coord.h"
 
 // When the pool becomes full (empty), free (allocate) this fraction
 // of the pool back to (from) parent / the OS.
 #define BATCH_FRACTION 2
 
+// Times to retry taking a batch from a shared pool that another worker holds.
+#define DEPOT_RETRIES 16
+
 //=========================================================================
 // Currently the fiber pools are organized into two-levels, like in Hoard
 // --- per-worker private pool plus a global pool.  The per-worker private
 // pool are accessed by the owner worker only and thus do not require
-// synchronization.  The global pool may be accessed concurrently and thus
-// require synchronization.  Thus, the pool->lock is initialized to NULL for
-// per-worker pools and cilk_mutex for the global one.
+// synchronization.  The global pool may be accessed concurrently, so it keeps
+// its fibers in a lock-free stack of batches rather than an array, and workers
+// move fibers to and from it a batch at a time without taking a lock.
 //
 // The per-worker pools are initlaized with some free fibers preallocated
 // already and the global one starts out empty.  A worker typically acquires
@@ -31,6 +34,14 @@
 //
 // For now, we don't ever allocate fibers into the global one --- we only use
 // the global one to load balance between per-worker pools.
+//
+// On machines with multiple NUMA nodes, if the topology is known, a shared
+// pool per node sits between the per-worker pools and the global one.  A
+// worker's pool then has its node's pool as its parent, and the global pool
+// as its grandparent, so fibers, whose stacks were first touched on a node,
+// preferably stay on that node.  A worker whose node's pool and the global
+// pool are both empty steals batches from the pools of the other nodes before
+// it maps new stacks.
 //=========================================================================
 
 //=========================================================
@@ -41,22 +52,71 @@ static void fiber_pool_stat_init(struct cilk_fiber_pool *pool) {
     pool->stats.in_use = 0;
     pool->stats.max_in_use = 0;
     pool->stats.max_free = 0;
+    pool->stats.max_stack = 0;
+    pool->stats.trimmed = 0;
+    atomic_store_explicit(&pool->depot_stats.in_use, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->depot_stats.max_in_use, 0,
+                          memory_order_relaxed);
+    atomic_store_explicit(&pool->depot_stats.max_free, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->depot_stats.takes, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->depot_stats.retries, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->depot_stats.stolen, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool->depot_stats.full, 0, memory_order_relaxed);
+}
+
+static inline void atomic_max_int(_Atomic int *max, int val) {
+    int old = atomic_load_explicit(max, memory_order_relaxed);
+    while (val > old && !atomic_compare_exchange_weak_explicit(
+                            max, &old, val, memory_order_relaxed,
+                            memory_order_relaxed))
+        ;
 }
 
 #define POOL_FMT "size %3u, %4d used %4d max used %4u max free"
 
+#define DEPOT_FMT ", %8lu takes %6lu retries %6lu stolen %6lu full"
+
+static void fiber_pool_stat_print_shared(const char *name,
+                                         struct cilk_fiber_pool *pool) {
+    struct fiber_depot_stats *stats = &pool->depot_stats;
+    fprintf(stderr, "[%s] " POOL_FMT DEPOT_FMT "\n", name,
+            atomic_load_explicit(&pool->nfree, memory_order_relaxed),
+            atomic_load_explicit(&stats->in_use, memory_order_relaxed),
+            atomic_load_explicit(&stats->max_in_use, memory_order_relaxed),
+            (unsigned)atomic_load_explicit(&stats->max_free,
+                                           memory_order_relaxed),
+            atomic_load_explicit(&stats->takes, memory_order_relaxed),
+            atomic_load_explicit(&stats->retries, memory_order_relaxed),
+            atomic_load_explicit(&stats->stolen, memory_order_relaxed),
+            atomic_load_explicit(&stats->full, memory_order_relaxed));
+}
+
+#define TRIM_FMT ", %5zu KB max stack %8zu KB trimmed"
+
 static void fiber_pool_stat_print_worker(__cilkrts_worker *w, void *data) {
     FILE *fp = (FILE *)data;
-    fprintf(fp, "[W%02" PRIu32 "] " POOL_FMT "\n", w->self,
+    fprintf(fp, "[W%02" PRIu32 "] " POOL_FMT TRIM_FMT "\n", w->self,
             w->l->fiber_pool.size, w->l->fiber_pool.stats.in_use,
-            w->l->fiber_pool.stats.max_in_use, w->l->fiber_pool.stats.max_free);
+            w->l->fiber_pool.stats.max_in_use, w->l->fiber_pool.stats.max_free,
+            w->l->fiber_pool.stats.max_stack / 1024,
+            w->l->fiber_pool.stats.trimmed / 1024);
 }
 
 static void fiber_pool_stat_print(struct global_state *g) {
-    fprintf(stderr, "\nFIBER POOL STATS\n[G  ] " POOL_FMT "\n",
-            g->fiber_pool.size, g->fiber_pool.stats.in_use,
-            g->fiber_pool.stats.max_in_use, g->fiber_pool.stats.max_free);
+    fprintf(stderr, "\nFIBER POOL STATS\n");
+    fiber_pool_stat_print_shared("G  ", &g->fiber_pool);
+    for (unsigned int i = 0; i < g->nnodes; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "N%02u", i);
+        fiber_pool_stat_print_shared(name, &g->node_fiber_pools[i]);
+    }
     for_each_worker(g, &fiber_pool_stat_print_worker, stderr);
+    struct cilk_fiber_arena *arena = g->fiber_arena;
+    if (arena)
+        fprintf(stderr,
+                "[A  ] size %3u, %4u used %4u max used %4u overflow\n",
+                arena->nslots, arena->in_use, arena->max_in_use,
+                arena->overflow);
     fprintf(stderr, "\n");
 }
 
@@ -65,33 +125,36 @@ static void fiber_pool_stat_print(struct global_state *g) {
 //=========================================================
 
 // forward decl
-static void fiber_pool_allocate_batch(worker_id self,
-                                      struct cilk_fiber_pool *pool,
-                                      unsigned int num_to_allocate);
-static void fiber_pool_free_batch(worker_id self,
-                                  struct cilk_fiber_pool *pool,
+static void fiber_pool_free_batch(struct cilk_fiber_pool *pool,
                                   unsigned int num_to_free);
 
 /* Helper function for initializing fiber pool */
 static void fiber_pool_init(struct cilk_fiber_pool *pool, size_t stacksize,
+                            struct cilk_fiber_arena *arena,
                             unsigned int bufsize,
                             struct cilk_fiber_pool *parent, int is_shared) {
-    cilk_mutex_init(&pool->lock);
-    pool->mutex_owner = NO_WORKER;
     pool->shared = is_shared;
     pool->stack_size = stacksize;
+    pool->arena = arena;
+    pool->trim = 0;
+    pool->trim_lazy = false;
     pool->parent = parent;
     pool->capacity = bufsize;
     pool->size = 0;
-    pool->fibers = calloc(bufsize, sizeof(*pool->fibers));
+    pool->idle = 0;
+    pool->clean = 0;
+    pool->fibers =
+        is_shared ? NULL : calloc(bufsize, sizeof(*pool->fibers));
+    atomic_store_explicit(&pool->batches, NULL, memory_order_relaxed);
+    atomic_store_explicit(&pool->nfree, 0, memory_order_relaxed);
 }
 
 /* Helper function for destroying fiber pool */
 static void fiber_pool_destroy(struct cilk_fiber_pool *pool) {
     CILK_ASSERT(pool->size == 0);
-    cilk_mutex_destroy(&pool->lock);
+    CILK_ASSERT(atomic_load_explicit(&pool->nfree, memory_order_relaxed) == 0);
     // pool->fibers might be NULL if the fiber pool was never actually
-    // initialized, e.g., because no Cilk code was run.
+    // initialized, e.g., because no Cilk code was run, or if it is shared.
     if (pool->fibers == NULL)
         return;
     free(pool->fibers);
@@ -99,47 +162,12 @@ static void fiber_pool_destroy(struct cilk_fiber_pool *pool) {
     pool->fibers = NULL;
 }
 
-static inline void fiber_pool_assert_ownership(worker_id self,
-                                               struct cilk_fiber_pool *pool) {
-    if (pool->shared)
-        CILK_ASSERT(pool->mutex_owner == self);
-}
-
-static inline void fiber_pool_assert_alienation(worker_id self,
-                                                struct cilk_fiber_pool *pool) {
-    if (pool->shared)
-        CILK_ASSERT(pool->mutex_owner != self);
-}
-
-static inline void fiber_pool_lock(worker_id self,
-                                   struct cilk_fiber_pool *pool) {
-    if (pool->shared) {
-        fiber_pool_assert_alienation(self, pool);
-        cilk_mutex_lock(&pool->lock);
-        pool->mutex_owner = self;
-    }
-}
-
-static inline void fiber_pool_unlock(worker_id self,
-                                     struct cilk_fiber_pool *pool) {
-    if (pool->shared) {
-        fiber_pool_assert_ownership(self, pool);
-        pool->mutex_owner = NO_WORKER;
-        cilk_mutex_unlock(&pool->lock);
-    }
-}
-
 /**
  * Increase the buffer size for the free fibers.  If the current size is
- * already larger than the new size, do nothing.  Assume lock acquired upon
- * entry.
+ * already larger than the new size, do nothing.
  */
-static void fiber_pool_increase_capacity(worker_id self,
-                                         struct cilk_fiber_pool *pool,
+static void fiber_pool_increase_capacity(struct cilk_fiber_pool *pool,
                                          unsigned int new_size) {
-
-    fiber_pool_assert_ownership(self, pool);
-
     if (pool->capacity < new_size) {
         struct cilk_fiber **larger =
             realloc(pool->fibers, new_size * sizeof(*pool->fibers));
@@ -152,19 +180,15 @@ static void fiber_pool_increase_capacity(worker_id self,
 
 /**
  * Decrease the buffer size for the free fibers.  If the current size is
- * already smaller than the new size, do nothing.  Assume lock acquired upon
- * entry.
+ * already smaller than the new size, do nothing.
  */
 __attribute__((unused)) // unused for now
 static void
-fiber_pool_decrease_capacity(worker_id self, struct cilk_fiber_pool *pool,
+fiber_pool_decrease_capacity(struct cilk_fiber_pool *pool,
                              unsigned int new_size) {
-
-    fiber_pool_assert_ownership(self, pool);
-
     if (pool->size > new_size) {
         int diff = pool->size - new_size;
-        fiber_pool_free_batch(self, pool, diff);
+        fiber_pool_free_batch(pool, diff);
         CILK_ASSERT(pool->size == new_size);
     }
     if (pool->capacity > new_size) {
@@ -177,37 +201,188 @@ fiber_pool_decrease_capacity(worker_id self, struct cilk_fiber_pool *pool,
     }
 }
 
+/**
+ * Release the pages of an idle fiber's stack below the top pool->trim bytes,
+ * unless it was already trimmed since it last left a pool.
+ */
+static void fiber_pool_trim(struct cilk_fiber_pool *pool,
+                            struct cilk_fiber *fiber) {
+    if (pool->trim == 0 || fiber->trimmed)
+        return;
+    pool->stats.trimmed += cilk_fiber_trim(fiber, pool->trim, pool->trim_lazy);
+    if (fiber->high_water > pool->stats.max_stack)
+        pool->stats.max_stack = fiber->high_water;
+}
+
+//=========================================================
+// Lock-free batches of fibers in shared pools
+//=========================================================
+
+// The batch link of an idle fiber sits at the top of its stack.
+static inline struct fiber_batch *fiber_link(struct cilk_fiber *fiber) {
+    return (struct fiber_batch *)sysdep_get_stack_start(fiber) - 1;
+}
+
+static inline struct cilk_fiber *link_fiber(struct fiber_batch *link) {
+    return (struct cilk_fiber *)(link + 1);
+}
+
+static void depot_push(struct cilk_fiber_pool *depot,
+                       struct fiber_batch *batch) {
+    struct fiber_batch *head =
+        atomic_load_explicit(&depot->batches, memory_order_relaxed);
+    atomic_fetch_add_explicit(&depot->nfree, batch->count,
+                              memory_order_relaxed);
+    while (true) {
+        batch->next_batch = head;
+        if (atomic_compare_exchange_weak_explicit(&depot->batches, &head, batch,
+                                                  memory_order_release,
+                                                  memory_order_relaxed))
+            break;
+        atomic_fetch_add_explicit(&depot->depot_stats.retries, 1,
+                                  memory_order_relaxed);
+    }
+}
+
+static inline struct fiber_batch *depot_grab(struct cilk_fiber_pool *depot) {
+    if (!atomic_load_explicit(&depot->batches, memory_order_relaxed))
+        return NULL;
+    return atomic_exchange_explicit(&depot->batches, NULL,
+                                    memory_order_acquire);
+}
+
+/**
+ * Take one batch of fibers from depot, or return NULL if it has none.
+ * Another worker may have briefly taken the whole stack to remove one batch,
+ * so retry a few times while the depot has free fibers.
+ */
+static struct fiber_batch *depot_take(struct cilk_fiber_pool *depot) {
+    struct fiber_batch *batch = depot_grab(depot);
+    for (int i = 0;
+         !batch && i < DEPOT_RETRIES &&
+         atomic_load_explicit(&depot->nfree, memory_order_relaxed) > 0;
+         ++i) {
+        atomic_fetch_add_explicit(&depot->depot_stats.retries, 1,
+                                  memory_order_relaxed);
+        busy_loop_pause();
+        batch = depot_grab(depot);
+    }
+    if (!batch)
+        return NULL;
+    struct fiber_batch *rest = batch->next_batch;
+    if (rest) {
+        // Put the other batches back.
+        struct fiber_batch *last = rest;
+        while (last->next_batch)
+            last = last->next_batch;
+        struct fiber_batch *head =
+            atomic_load_explicit(&depot->batches, memory_order_relaxed);
+        do {
+            last->next_batch = head;
+        } while (!atomic_compare_exchange_weak_explicit(
+            &depot->batches, &head, rest, memory_order_release,
+            memory_order_relaxed));
+    }
+    atomic_fetch_sub_explicit(&depot->nfree, batch->count,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&depot->depot_stats.takes, 1,
+                              memory_order_relaxed);
+    return batch;
+}
+
+/**
+ * Move up to wanted fibers from the shared pool depot into the array of the
+ * private pool, whose capacity must suffice.  Fibers of a batch beyond wanted
+ * go back to depot as a smaller batch.  Returns the number of fibers moved.
+ */
+static unsigned int fiber_pool_take(struct cilk_fiber_pool *pool,
+                                    struct cilk_fiber_pool *depot,
+                                    unsigned int wanted, bool stealing) {
+    unsigned int taken = 0;
+    while (taken < wanted) {
+        struct fiber_batch *batch = depot_take(depot);
+        if (!batch)
+            break;
+        if (stealing)
+            atomic_fetch_add_explicit(&depot->depot_stats.stolen, 1,
+                                      memory_order_relaxed);
+        unsigned int count = batch->count;
+        struct cilk_fiber *fiber = link_fiber(batch);
+        unsigned int n = count <= wanted - taken ? count : wanted - taken;
+        for (unsigned int i = 0; i < n; ++i) {
+            struct cilk_fiber *next = fiber_link(fiber)->next;
+            pool->fibers[pool->size++] = fiber;
+            fiber = next;
+        }
+        if (n < count) {
+            struct fiber_batch *rest = fiber_link(fiber);
+            rest->count = count - n;
+            depot_push(depot, rest);
+        }
+        taken += n;
+    }
+    if (taken > 0) {
+        int in_use = atomic_fetch_add_explicit(&depot->depot_stats.in_use,
+                                               taken, memory_order_relaxed);
+        atomic_max_int(&depot->depot_stats.max_in_use, in_use + taken);
+    }
+    return taken;
+}
+
+/**
+ * Move count fibers from the top of the array of the private pool to the
+ * shared pool depot, as one batch.
+ */
+static void fiber_pool_give(struct cilk_fiber_pool *pool,
+                            struct cilk_fiber_pool *depot,
+                            unsigned int count) {
+    CILK_ASSERT(count > 0 && count <= pool->size);
+    struct cilk_fiber *first = pool->fibers[--pool->size];
+    struct fiber_batch *batch = fiber_link(first);
+    batch->count = count;
+    struct fiber_batch *link = batch;
+    for (unsigned int i = 1; i < count; ++i) {
+        struct cilk_fiber *fiber = pool->fibers[--pool->size];
+        link->next = fiber;
+        link = fiber_link(fiber);
+    }
+    link->next = NULL;
+    depot_push(depot, batch);
+    atomic_fetch_sub_explicit(&depot->depot_stats.in_use, count,
+                              memory_order_relaxed);
+    atomic_max_int(&depot->depot_stats.max_free,
+                   atomic_load_explicit(&depot->nfree, memory_order_relaxed));
+}
+
 /**
  * Allocate num_to_allocate number of new fibers into the pool.
- * We will first look into the parent pool, and if the parent pool does not
- * have enough, we then get it from the system.
+ * We will first look into the parent pool, then into its ancestors, then into
+ * the pools of the other NUMA nodes, and if they do not have enough, we then
+ * get it from the system.
  */
-static void fiber_pool_allocate_batch(worker_id self,
+static void fiber_pool_allocate_batch(__cilkrts_worker *w,
                                       struct cilk_fiber_pool *pool,
                                       const unsigned int batch_size) {
-
-    fiber_pool_assert_ownership(self, pool);
-    fiber_pool_increase_capacity(self, pool, batch_size + pool->size);
+    CILK_ASSERT(!pool->shared);
+    fiber_pool_increase_capacity(pool, batch_size + pool->size);
 
     unsigned int from_parent = 0;
-    if (pool->parent) {
-        struct cilk_fiber_pool *parent = pool->parent;
-        fiber_pool_lock(self, parent);
-        from_parent = parent->size <= batch_size ? parent->size : batch_size;
-        for (unsigned int i = 0; i < from_parent; i++) {
-            pool->fibers[pool->size++] = parent->fibers[--parent->size];
-        }
-        // update parent pool stats before releasing the lock on it
-        parent->stats.in_use += from_parent;
-        if (parent->stats.in_use > parent->stats.max_in_use) {
-            parent->stats.max_in_use = parent->stats.in_use;
-        }
-        fiber_pool_unlock(self, parent);
+    for (struct cilk_fiber_pool *parent = pool->parent;
+         parent && from_parent < batch_size; parent = parent->parent) {
+        from_parent +=
+            fiber_pool_take(pool, parent, batch_size - from_parent, false);
+    }
+    global_state *g = w->g;
+    for (unsigned int i = 0; i < g->nnodes && from_parent < batch_size; ++i) {
+        struct cilk_fiber_pool *node_pool = &g->node_fiber_pools[i];
+        if (node_pool != pool->parent)
+            from_parent += fiber_pool_take(pool, node_pool,
+                                           batch_size - from_parent, true);
     }
     if (batch_size > from_parent) { // if we need more still
         for (unsigned int i = from_parent; i < batch_size; i++) {
             pool->fibers[pool->size++] =
-                cilk_fiber_allocate(pool->stack_size);
+                cilk_fiber_allocate(pool->arena, pool->stack_size);
         }
     }
     if (pool->size > pool->stats.max_free) {
@@ -216,39 +391,50 @@ static void fiber_pool_allocate_batch(worker_id self,
 }
 
 /**
- * Free num_to_free fibers from this pool back to either the parent
- * or the system.
+ * Free num_to_free fibers from this pool back to either the parent, its
+ * ancestors, or the system.
  */
-static void fiber_pool_free_batch(worker_id self,
-                                  struct cilk_fiber_pool *pool,
+static void fiber_pool_free_batch(struct cilk_fiber_pool *pool,
                                   const unsigned int batch_size) {
-    fiber_pool_assert_ownership(self, pool);
+    CILK_ASSERT(!pool->shared);
     CILK_ASSERT(batch_size <= pool->size);
 
+    // Fibers given to the parent may stay idle for a long time.
+    if (pool->parent) {
+        for (unsigned int i = pool->size - batch_size; i < pool->size; i++)
+            fiber_pool_trim(pool, pool->fibers[i]);
+    }
+
     unsigned int to_parent = 0;
-    if (pool->parent) { // first try to free into the parent
-        struct cilk_fiber_pool *parent = pool->parent;
-        fiber_pool_lock(self, parent);
-        to_parent = (batch_size <= (parent->capacity - parent->size))
-                        ? batch_size
-                        : (parent->capacity - parent->size);
+    // first try to free into the parent, then into its ancestors
+    for (struct cilk_fiber_pool *parent = pool->parent;
+         parent && to_parent < batch_size; parent = parent->parent) {
+        unsigned int remaining = batch_size - to_parent;
+        unsigned int nfree =
+            atomic_load_explicit(&parent->nfree, memory_order_relaxed);
         // free what we can within the capacity of the parent pool
-        for (unsigned int i = 0; i < to_parent; i++) {
-            parent->fibers[parent->size++] = pool->fibers[--pool->size];
-        }
-        CILK_ASSERT(parent->size <= parent->capacity);
-        parent->stats.in_use -= to_parent;
-        if (parent->size > parent->stats.max_free) {
-            parent->stats.max_free = parent->size;
-        }
-        fiber_pool_unlock(self, parent);
+        unsigned int room =
+            nfree < parent->capacity ? parent->capacity - nfree : 0;
+        unsigned int given = remaining <= room ? remaining : room;
+        if (given > 0)
+            fiber_pool_give(pool, parent, given);
+        to_parent += given;
     }
     if ((batch_size - to_parent) > 0) { // still need to free more
+        struct cilk_fiber_pool *top = pool->parent;
+        while (top && top->parent)
+            top = top->parent;
+        if (top)
+            atomic_fetch_add_explicit(&top->depot_stats.full,
+                                      batch_size - to_parent,
+                                      memory_order_relaxed);
         for (unsigned int i = to_parent; i < batch_size; i++) {
             struct cilk_fiber *fiber = pool->fibers[--pool->size];
             cilk_fiber_deallocate(fiber);
         }
     }
+    if (pool->size < pool->idle)
+        pool->idle = pool->size;
 }
 
 //=========================================================
@@ -260,30 +446,69 @@ void cilk_fiber_pool_global_init(global_state *g) {
 
     unsigned int bufsize = g->options.nproc * g->options.fiber_pool_cap;
     struct cilk_fiber_pool *pool = &(g->fiber_pool);
-    fiber_pool_init(pool, g->options.stacksize, bufsize, NULL, 1 /*shared*/);
-    CILK_ASSERT(NULL != pool->fibers);
+    cilk_fiber_stack_check_init(g);
+    g->fiber_arena = cilk_fiber_arena_create(g);
+    fiber_pool_init(pool, g->options.stacksize, g->fiber_arena, bufsize, NULL,
+                    1 /*shared*/);
     fiber_pool_stat_init(pool);
     /* let's not preallocate for global fiber pool for now */
+
+    if (g->nnodes > 0) {
+        // Size each node's pool for its share of the workers.
+        unsigned int node_bufsize = bufsize / g->nnodes;
+        if (node_bufsize < g->options.fiber_pool_cap)
+            node_bufsize = g->options.fiber_pool_cap;
+        g->node_fiber_pools = (struct cilk_fiber_pool *)cilk_aligned_alloc(
+            __alignof__(struct cilk_fiber_pool),
+            g->nnodes * sizeof(struct cilk_fiber_pool));
+        for (unsigned int i = 0; i < g->nnodes; ++i) {
+            struct cilk_fiber_pool *node_pool = &g->node_fiber_pools[i];
+            fiber_pool_init(node_pool, g->options.stacksize, g->fiber_arena,
+                            node_bufsize, pool, 1 /*shared*/);
+            fiber_pool_stat_init(node_pool);
+        }
+    }
+}
+
+static void fiber_pool_global_drain(global_state *g,
+                                    struct cilk_fiber_pool *pool) {
+    struct fiber_batch *batch = depot_grab(pool);
+    while (batch) {
+        struct fiber_batch *next_batch = batch->next_batch;
+        unsigned int count = batch->count;
+        struct cilk_fiber *fiber = link_fiber(batch);
+        for (unsigned int i = 0; i < count; ++i) {
+            struct cilk_fiber *next = fiber_link(fiber)->next;
+            cilk_fiber_deallocate_global(g, fiber);
+            fiber = next;
+        }
+        atomic_fetch_sub_explicit(&pool->nfree, count, memory_order_relaxed);
+        batch = next_batch;
+    }
 }
 
 /* This does not yet destroy the fiber pool; merely collects
  * stats and print them out (if FIBER_STATS is set)
  */
 void cilk_fiber_pool_global_terminate(global_state *g) {
-    struct cilk_fiber_pool *pool = &g->fiber_pool;
-    cilk_mutex_lock(&pool->lock); /* probably not needed */
-    while (pool->size > 0) {
-        struct cilk_fiber *fiber = pool->fibers[--pool->size];
-        cilk_fiber_deallocate_global(g, fiber);
-    }
-    cilk_mutex_unlock(&pool->lock);
+    for (unsigned int i = 0; i < g->nnodes; ++i)
+        fiber_pool_global_drain(g, &g->node_fiber_pools[i]);
+    fiber_pool_global_drain(g, &g->fiber_pool);
     if (ALERT_ENABLED(FIBER_SUMMARY))
         fiber_pool_stat_print(g);
 }
 
 /* Global fiber pool clean up. */
 void cilk_fiber_pool_global_destroy(global_state *g) {
+    if (g->node_fiber_pools) {
+        for (unsigned int i = 0; i < g->nnodes; ++i)
+            fiber_pool_destroy(&g->node_fiber_pools[i]);
+        free(g->node_fiber_pools);
+        g->node_fiber_pools = NULL;
+    }
     fiber_pool_destroy(&g->fiber_pool); // worker 0 should have freed everything
+    cilk_fiber_arena_destroy(g->fiber_arena);
+    g->fiber_arena = NULL;
 }
 
 /**
@@ -297,25 +522,69 @@ void cilk_fiber_pool_global_destroy(global_state *g) {
 void cilk_fiber_pool_per_worker_zero_init(__cilkrts_worker *w) {
     struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
     pool->size = 0;
+    pool->idle = 0;
+    pool->clean = 0;
     pool->fibers = NULL;
 }
 
 /**
  * Per-worker fiber pool initialization: should be called per worker so
  * so that fiber comes from the core on which the worker is running on.
+ * The worker's NUMA node, if any, should already be known.
  */
 void cilk_fiber_pool_per_worker_init(__cilkrts_worker *w) {
 
     global_state *g = w->g;
     unsigned int bufsize = g->options.fiber_pool_cap;
     struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
-    fiber_pool_init(pool, g->options.stacksize, bufsize, &(g->fiber_pool),
-                    0 /* private */);
+    struct cilk_fiber_pool *parent = &(g->fiber_pool);
+    if (g->nnodes > 0 && w->l->node_domain >= 0)
+        parent = &g->node_fiber_pools[w->l->node_domain];
+    fiber_pool_init(pool, g->options.stacksize, g->fiber_arena, bufsize,
+                    parent, 0 /* private */);
+    pool->trim = g->options.fiber_trim;
+    pool->trim_lazy = g->options.fiber_trim_lazy;
     CILK_ASSERT(NULL != pool->fibers);
     CILK_ASSERT(g->fiber_pool.stack_size == pool->stack_size);
 
     fiber_pool_stat_init(pool);
-    fiber_pool_allocate_batch(w->self, pool, bufsize / BATCH_FRACTION);
+    fiber_pool_allocate_batch(w, pool, bufsize / BATCH_FRACTION);
+}
+
+/**
+ * Fill the worker's fiber pool with at least nfibers fibers, and fault in the
+ * part of their stacks that idle fibers keep resident, or the whole stacks if
+ * trimming is disabled.  Called by the thread of the worker after it is
+ * pinned, so the pages come from the worker's NUMA node.
+ */
+void cilk_fiber_pool_warmup(__cilkrts_worker *w, unsigned int nfibers) {
+    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
+    if (nfibers > pool->size)
+        fiber_pool_allocate_batch(w, pool, nfibers - pool->size);
+    size_t bytes = pool->trim > 0 ? pool->trim : pool->stack_size;
+    for (unsigned int i = 0; i < pool->size; ++i)
+        cilk_fiber_prefault(pool->fibers[i], bytes);
+}
+
+/**
+ * Trim the fibers at the bottom of the worker's pool that no allocation took
+ * since the last call, which stayed idle for at least the time in between.
+ * The pool is LIFO, so the fibers the worker reuses stay at the top, and it
+ * does not trim them.  Called before the worker goes to sleep, so the system
+ * calls stay off the paths that allocate and free fibers.
+ */
+void cilk_fiber_pool_trim_idle(__cilkrts_worker *w) {
+    struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
+    if (pool->trim > 0) {
+        // The fibers below the clean mark, and still below the idle one, were
+        // trimmed by the last call and not taken since.
+        unsigned int begin =
+            pool->clean < pool->idle ? pool->clean : pool->idle;
+        for (unsigned int i = begin; i < pool->idle; ++i)
+            fiber_pool_trim(pool, pool->fibers[i]);
+    }
+    pool->clean = pool->idle;
+    pool->idle = pool->size;
 }
 
 /* This does not yet destroy the fiber pool; merely collects
@@ -345,10 +614,11 @@ void cilk_fiber_pool_per_worker_destroy(__cilkrts_worker *w) {
 struct cilk_fiber *cilk_fiber_allocate_from_pool(__cilkrts_worker *w) {
     struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
     if (pool->size == 0) {
-        fiber_pool_allocate_batch(w->self, pool,
-                                  pool->capacity / BATCH_FRACTION);
+        fiber_pool_allocate_batch(w, pool, pool->capacity / BATCH_FRACTION);
     }
     struct cilk_fiber *ret = pool->fibers[--pool->size];
+    if (pool->size < pool->idle)
+        pool->idle = pool->size;
     pool->stats.in_use++;
     if (pool->stats.in_use > pool->stats.max_in_use) {
         pool->stats.max_in_use = pool->stats.in_use;
@@ -365,21 +635,21 @@ struct cilk_fiber *cilk_fiber_allocate_from_pool(__cilkrts_worker *w) {
  */
 void cilk_fiber_deallocate_to_pool(__cilkrts_worker *w,
                                    struct cilk_fiber *fiber_to_return) {
-    if (fiber_to_return)
-        sanitizer_poison_fiber(fiber_to_return);
     struct cilk_fiber_pool *pool = &(w->l->fiber_pool);
+    if (fiber_to_return) {
+        sanitizer_poison_fiber(fiber_to_return);
+        deinit_fiber_header(fiber_to_return);
+        pool->stats.in_use--;
+    }
     if (pool->size == pool->capacity) {
-        fiber_pool_free_batch(w->self, pool, pool->capacity / BATCH_FRACTION);
+        fiber_pool_free_batch(pool, pool->capacity / BATCH_FRACTION);
         CILK_ASSERT((pool->capacity - pool->size) >=
                            (pool->capacity / BATCH_FRACTION));
     }
     if (fiber_to_return) {
-        deinit_fiber_header(fiber_to_return);
         pool->fibers[pool->size++] = fiber_to_return;
-        pool->stats.in_use--;
         if (pool->size > pool->stats.max_free) {
             pool->stats.max_free = pool->size;
         }
-        fiber_to_return = NULL;
     }
 }
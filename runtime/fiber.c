@@ -3,9 +3,12 @@
 #endif
 
 #include <dlfcn.h> // For dynamically loading ASan functions
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #ifdef __BSD__
 #include <sys/cpuset.h>
 #include <sys/param.h>
@@ -15,6 +18,7 @@
 #include "debug.h"
 #include "fiber.h"
 #include "fiber-header.h"
+#include "global.h"
 #include "init.h"
 
 #include <string.h> /* memset() */
@@ -35,19 +39,31 @@
    not defined.
 
    On Linux MAP_STACK does nothing and is provided for BSD compatibility.
-   MAP_GROWSDOWN has the same meaning as FreeBSD's MAP_STACK.  There is
-   a single guard page at the bottom of the region, and stack_guard_gap
-   unmapped pages between any two stacks. */
-
-#ifndef MAP_GROWSDOWN
-#define MAP_GROWSDOWN 0
+   MAP_GROWSDOWN would let the kernel extend the region below its
+   lowest page when the stack overflows, past the end of the fiber as
+   the runtime knows it, so it is not used.  Instead the lowest page is
+   protected as an explicit guard page, and a fault in it is reported as
+   a stack overflow.
+
+   Where available, MAP_NORESERVE keeps the system from reserving swap
+   space for the whole stack, so large stacks cost only address space
+   until they are used. */
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
 #endif
-#ifdef MAP_STACK
+#if defined MAP_STACK && !defined __linux__
+#define MAP_STACK_FLAGS \
+  (MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE)
+#define STACK_NEEDS_GUARD_PAGE 0
+#elif defined MAP_STACK
 #define MAP_STACK_FLAGS \
-  (MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_GROWSDOWN)
+  (MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE)
+#define STACK_NEEDS_GUARD_PAGE 1
 #else
 #define MAP_STACK_FLAGS \
-  (MAP_PRIVATE | MAP_ANONYMOUS)
+  (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+#define STACK_NEEDS_GUARD_PAGE 1
 #endif
 
 //===============================================================
@@ -279,10 +295,10 @@ void sanitizer_poison_fiber(struct cilk_fiber *fiber) {
 // Private helper functions
 //===============================================================
 
-struct cilk_fiber *make_stack(size_t stack_size) {
-    const int page_shift = cheetah_page_shift;
-    const size_t page_size = 1U << page_shift;
-
+// Number of pages to map for a stack of stack_size bytes, including the guard
+// page.
+static size_t stack_pages_for(size_t stack_size) {
+    const size_t page_size = 1U << cheetah_page_shift;
     size_t stack_pages = (stack_size + page_size - 1) >> cheetah_page_shift;
 
     if (stack_pages < MIN_NUM_PAGES_PER_STACK) {
@@ -290,6 +306,30 @@ struct cilk_fiber *make_stack(size_t stack_size) {
     } else if (stack_pages > MAX_NUM_PAGES_PER_STACK) {
         stack_pages = MAX_NUM_PAGES_PER_STACK;
     }
+    return stack_pages;
+}
+
+// Place the fiber header at the top of the region of alloc_size bytes at
+// alloc_low, whose lowest page is the guard page.
+static struct cilk_fiber *init_stack(char *alloc_low, size_t alloc_size,
+                                     struct cilk_fiber_arena *arena) {
+    const size_t page_size = 1U << cheetah_page_shift;
+    char *alloc_high = alloc_low + alloc_size;
+    char *stack_low = alloc_low + page_size;
+    char *stack_high = alloc_high - sizeof(struct cilk_fiber);
+    struct cilk_fiber *f = (struct cilk_fiber *)stack_high;
+    f->alloc_low = alloc_low;
+    f->stack_low = stack_low;
+    f->arena = arena;
+    f->high_water = 0;
+    if (DEBUG_ENABLED(MEMORY_SLOW))
+        memset(stack_low, 0x11, stack_high - stack_low);
+    return f;
+}
+
+struct cilk_fiber *make_stack(size_t stack_size) {
+    const size_t page_size = 1U << cheetah_page_shift;
+    size_t stack_pages = stack_pages_for(stack_size);
     char *alloc_low = (char *)mmap(
         0, stack_pages * page_size, PROT_READ | PROT_WRITE,
         MAP_STACK_FLAGS, -1, 0);
@@ -299,26 +339,25 @@ struct cilk_fiber *make_stack(size_t stack_size) {
            error handling. */
         return NULL;
     }
-    char *alloc_high = alloc_low + stack_pages * page_size;
-    char *stack_low = alloc_low + page_size;
-    char *stack_high = alloc_high - sizeof(struct cilk_fiber);
-#ifndef MAP_STACK
-    (void)mprotect(alloc_low, page_size, PROT_NONE);
-#endif
-    struct cilk_fiber *f = (struct cilk_fiber *)stack_high;
-    f->alloc_low = alloc_low;
-    f->stack_low = stack_low;
-    if (DEBUG_ENABLED(MEMORY_SLOW))
-        memset(stack_low, 0x11, stack_high - stack_low);
-    return f;
+    if (STACK_NEEDS_GUARD_PAGE &&
+        mprotect(alloc_low, page_size, PROT_NONE) < 0)
+        cilkrts_bug("Cilk: stack guard page mprotect failed");
+    return init_stack(alloc_low, stack_pages * page_size, NULL);
 }
 
+static void arena_free_stack(struct cilk_fiber_arena *arena,
+                             struct cilk_fiber *f);
+
 static void free_stack(struct cilk_fiber *f) {
     if (DEBUG_ENABLED(MEMORY_SLOW)) {
         char *stack_low = f->stack_low;
         char *stack_high = sysdep_get_stack_start(f);
         memset(stack_low, 0xbb, stack_high - stack_low);
     }
+    if (f->arena) {
+        arena_free_stack(f->arena, f);
+        return;
+    }
     char *alloc_low = sysdep_get_fiber_start(f);
     char *alloc_high = sysdep_get_fiber_end(f);
     if (munmap(f->alloc_low, alloc_high - alloc_low) < 0)
@@ -326,12 +365,200 @@ static void free_stack(struct cilk_fiber *f) {
     /* f is now an invalid pointer */
 }
 
+//===============================================================
+// Fiber stack arena
+//===============================================================
+
+#define MAP_ARENA_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+
+struct cilk_fiber_arena *cilk_fiber_arena_create(global_state *g) {
+    unsigned int nslots = g->options.fiber_arena;
+    if (nslots == 0)
+        return NULL;
+    const size_t page_size = 1U << cheetah_page_shift;
+    size_t stack_pages = stack_pages_for(g->options.stacksize);
+    size_t slot_size = stack_pages * page_size;
+    size_t size = (size_t)nslots * slot_size;
+
+    // Reserve the whole arena at once.  Each slot then only needs its guard
+    // page protected, so stacks can be handed out without system calls.
+    char *base = (char *)mmap(0, size, PROT_READ | PROT_WRITE,
+                              MAP_ARENA_FLAGS, -1, 0);
+    if (MAP_FAILED == base) {
+        cilkrts_alert(BOOT, "(cilk_fiber_arena_create) mmap of %zu bytes failed",
+                      size);
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages can only back the parts of the arena between
+    // guard pages that span whole huge pages, so this helps with large stacks.
+    if (g->options.fiber_arena_thp)
+        (void)madvise(base, size, MADV_HUGEPAGE);
+#endif
+    size_t prefault = g->options.fiber_prefault;
+    if (prefault > stack_pages - 1)
+        prefault = stack_pages - 1;
+    for (unsigned int i = 0; i < nslots; ++i) {
+        char *slot = base + (size_t)i * slot_size;
+        if (mprotect(slot, page_size, PROT_NONE) < 0)
+            cilkrts_bug("Cilk: arena guard page mprotect failed");
+        // Touch the pages at the top of the stack, which every fiber uses.
+        for (size_t p = 1; p <= prefault; ++p)
+            ((volatile char *)slot)[slot_size - p * page_size] = 0;
+    }
+
+    struct cilk_fiber_arena *arena = (struct cilk_fiber_arena *)calloc(
+        1, sizeof(struct cilk_fiber_arena));
+    arena->free_slots = (unsigned int *)calloc(nslots, sizeof(unsigned int));
+    CILK_CHECK(g, arena->free_slots,
+               "Cannot allocate free list for %u fiber stacks", nslots);
+    arena->base = base;
+    arena->slot_size = slot_size;
+    arena->nslots = nslots;
+    cilk_mutex_init(&arena->lock);
+    cilkrts_alert(BOOT, "(cilk_fiber_arena_create) %u stacks of %zu bytes",
+                  nslots, slot_size);
+    return arena;
+}
+
+void cilk_fiber_arena_destroy(struct cilk_fiber_arena *arena) {
+    if (!arena)
+        return;
+    CILK_ASSERT(arena->in_use == 0);
+    munmap(arena->base, (size_t)arena->nslots * arena->slot_size);
+    cilk_mutex_destroy(&arena->lock);
+    free(arena->free_slots);
+    free(arena);
+}
+
+// Take a stack from the arena, or return NULL if the arena is full.  Reuse
+// the most recently freed stack, whose pages are most likely to be resident.
+static struct cilk_fiber *arena_make_stack(struct cilk_fiber_arena *arena) {
+    unsigned int slot;
+    cilk_mutex_lock(&arena->lock);
+    if (arena->nfree > 0) {
+        slot = arena->free_slots[--arena->nfree];
+    } else if (arena->next < arena->nslots) {
+        slot = arena->next++;
+    } else {
+        arena->overflow++;
+        cilk_mutex_unlock(&arena->lock);
+        return NULL;
+    }
+    if (++arena->in_use > arena->max_in_use)
+        arena->max_in_use = arena->in_use;
+    cilk_mutex_unlock(&arena->lock);
+    return init_stack(arena->base + (size_t)slot * arena->slot_size,
+                      arena->slot_size, arena);
+}
+
+static void arena_free_stack(struct cilk_fiber_arena *arena,
+                             struct cilk_fiber *f) {
+    unsigned int slot = (f->alloc_low - arena->base) / arena->slot_size;
+    CILK_ASSERT(slot < arena->nslots);
+    cilk_mutex_lock(&arena->lock);
+    arena->free_slots[arena->nfree++] = slot;
+    arena->in_use--;
+    cilk_mutex_unlock(&arena->lock);
+}
+
+//===============================================================
+// Stack overflow detection
+//===============================================================
+
+// Bytes of the alternate signal stack given to each thread that runs fibers.
+#define ALTSTACK_SIZE (SIGSTKSZ > 16384 ? SIGSTKSZ : 16384)
+
+static pthread_once_t stack_check_once = PTHREAD_ONCE_INIT;
+static bool stack_check_installed = false;
+static struct sigaction stack_check_prev; // disposition the handler replaced
+static pthread_key_t altstack_key;
+static __thread bool altstack_ready = false;
+
+// A fault in the guard page of the fiber the thread is running on is a stack
+// overflow.  The handler runs on an alternate signal stack, since the stack of
+// the fiber is exhausted.  It reports the overflow and restores the disposition
+// it replaced, so the fault repeats on return and is handled as it would have
+// been without the check.
+static void stack_check_handler(int sig, siginfo_t *info, void *context) {
+    (void)context;
+    struct cilk_fiber *fh = __cilkrts_current_fh;
+    char *addr = (char *)info->si_addr;
+    if (info->si_code > 0 && fh && addr >= fh->alloc_low &&
+        addr < fh->stack_low) {
+        static const char msg[] =
+            "Cilk: fiber stack overflow, set CILK_STACKSIZE to a larger size\n";
+        (void)!write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    }
+    sigaction(sig, &stack_check_prev, NULL);
+    // A signal sent by a process does not repeat on return.
+    if (info->si_code <= 0)
+        raise(sig);
+}
+
+static void altstack_destroy(void *stack) {
+    stack_t cur;
+    if (sigaltstack(NULL, &cur) == 0 && cur.ss_sp == stack) {
+        stack_t off = {.ss_flags = SS_DISABLE};
+        (void)sigaltstack(&off, NULL);
+    }
+    free(stack);
+}
+
+static void stack_check_install(void) {
+    // Leave a handler that the program installed alone.
+    struct sigaction *prev = &stack_check_prev;
+    if (sigaction(SIGSEGV, NULL, prev) < 0 || (prev->sa_flags & SA_SIGINFO) ||
+        prev->sa_handler != SIG_DFL)
+        return;
+    if (pthread_key_create(&altstack_key, altstack_destroy) != 0)
+        return;
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = stack_check_handler;
+    act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&act.sa_mask);
+    if (sigaction(SIGSEGV, &act, NULL) < 0)
+        return;
+    stack_check_installed = true;
+    cilkrts_alert(BOOT, "(stack_check_install) SIGSEGV handler installed");
+}
+
+void cilk_fiber_stack_check_init(global_state *g) {
+    if (g->options.stack_check)
+        pthread_once(&stack_check_once, stack_check_install);
+}
+
+void cilk_fiber_stack_check_thread_init(void) {
+    if (altstack_ready || !stack_check_installed)
+        return;
+    altstack_ready = true;
+    // Keep an alternate signal stack that the thread already has.
+    stack_t cur;
+    if (sigaltstack(NULL, &cur) < 0 || !(cur.ss_flags & SS_DISABLE))
+        return;
+    size_t size = ALTSTACK_SIZE;
+    void *stack = malloc(size);
+    if (!stack)
+        return;
+    stack_t ss = {.ss_sp = stack, .ss_size = size, .ss_flags = 0};
+    if (sigaltstack(&ss, NULL) < 0) {
+        free(stack);
+        return;
+    }
+    // Free the stack when the thread exits.
+    pthread_setspecific(altstack_key, stack);
+}
+
 //===============================================================
 // Supported public functions
 //===============================================================
 
-struct cilk_fiber *cilk_fiber_allocate(size_t stacksize) {
-    struct cilk_fiber *fiber = make_stack(stacksize);
+struct cilk_fiber *cilk_fiber_allocate(struct cilk_fiber_arena *arena,
+                                       size_t stacksize) {
+    struct cilk_fiber *fiber = arena ? arena_make_stack(arena) : NULL;
+    if (!fiber)
+        fiber = make_stack(stacksize);
     init_fiber_header(fiber);
     cilkrts_alert(FIBER, "Allocate fiber %p [%p--%p]", (void *)fiber,
                   (void *)fiber->stack_low,
@@ -358,6 +585,86 @@ void cilk_fiber_deallocate_global(struct global_state *g,
     free_stack(fiber);
 }
 
+// Pages of a stack whose residency cilk_fiber_trim() checks at a time.
+#define TRIM_CHUNK_PAGES 1024
+
+size_t cilk_fiber_trim(struct cilk_fiber *fiber, size_t keep, bool lazy) {
+    fiber->trimmed = true;
+#if defined __linux__ && defined MADV_DONTNEED
+    const size_t page_size = 1U << cheetah_page_shift;
+    char *stack_low = fiber->stack_low;
+    char *stack_high = sysdep_get_stack_start(fiber);
+    size_t stack_size = stack_high - stack_low;
+    if (stack_size <= keep)
+        return 0;
+    size_t stack_pages = (stack_size + page_size - 1) >> cheetah_page_shift;
+    // Whole pages below the top keep bytes, which may be released.
+    size_t end = (stack_size - keep) >> cheetah_page_shift;
+
+    // The stack grows down, so the lowest resident page marks its deepest use.
+    unsigned char resident[TRIM_CHUNK_PAGES];
+    size_t deepest = stack_pages;
+    size_t released = 0;
+    for (size_t base = 0; base < stack_pages; base += TRIM_CHUNK_PAGES) {
+        size_t n = stack_pages - base;
+        if (n > TRIM_CHUNK_PAGES)
+            n = TRIM_CHUNK_PAGES;
+        if (mincore(stack_low + (base << cheetah_page_shift),
+                    n << cheetah_page_shift, resident) < 0)
+            return 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (!(resident[i] & 1))
+                continue;
+            if (deepest == stack_pages)
+                deepest = base + i;
+            if (base + i < end)
+                ++released;
+        }
+        if (deepest < stack_pages && base + n >= end)
+            break;
+    }
+    if (deepest == stack_pages)
+        return 0;
+    size_t used = stack_size - (deepest << cheetah_page_shift);
+    if (used > fiber->high_water)
+        fiber->high_water = used;
+    if (released == 0)
+        return 0;
+
+    // Release the whole pages below the top keep bytes.
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    // Lazily freed pages stay resident until the system needs the memory.
+    if (lazy)
+        advice = MADV_FREE;
+#endif
+    if (madvise(stack_low + (deepest << cheetah_page_shift),
+                (end - deepest) << cheetah_page_shift, advice) < 0)
+        return 0;
+    cilkrts_alert(FIBER, "Trim fiber %p: %zu of %zu bytes used", (void *)fiber,
+                  used, stack_size);
+    return released << cheetah_page_shift;
+#else
+    (void)keep;
+    (void)lazy;
+    return 0;
+#endif
+}
+
+void cilk_fiber_prefault(struct cilk_fiber *fiber, size_t bytes) {
+    const size_t page_size = 1U << cheetah_page_shift;
+    char *stack_low = fiber->stack_low;
+    char *stack_high = sysdep_get_stack_start(fiber);
+    if (bytes > (size_t)(stack_high - stack_low))
+        bytes = stack_high - stack_low;
+    // Write to each page, because reading anonymous memory that was never
+    // written only maps the shared zero page.
+    for (size_t off = 1; off <= bytes; off += page_size) {
+        volatile char *p = stack_high - off;
+        *p = *p;
+    }
+}
+
 int in_fiber(struct cilk_fiber *fiber, void *p) {
     void *stack_high = sysdep_get_stack_start(fiber);
     void *stack_low = fiber->stack_low;
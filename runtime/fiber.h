@@ -20,21 +20,72 @@ struct fiber_pool_stats {
     int in_use;     // number of fibers allocated - freed from / into the pool
     int max_in_use; // high watermark for in_use
     unsigned max_free; // high watermark for number of free fibers in the pool
+    size_t max_stack;  // deepest stack use seen when trimming fibers
+    size_t trimmed;    // bytes of idle stacks released to the system
+};
+
+// A contiguous region reserved up front for fiber stacks, to avoid an mmap and
+// munmap per fiber.  Each slot has the layout of a stack from make_stack(),
+// with a guard page at its low end.  When the arena is full, fibers are
+// allocated with their own mmap as usual.
+struct cilk_fiber_arena {
+    char *base;                // lowest byte of the arena
+    size_t slot_size;          // bytes per stack, including the guard page
+    unsigned int nslots;       // number of stacks in the arena
+    unsigned int next;         // slots at and above next were never used
+    unsigned int nfree;        // number of slots in free_slots
+    unsigned int *free_slots;  // stack of freed slots, most recent on top
+    unsigned int in_use;       // slots in use
+    unsigned int max_in_use;   // high watermark of in_use
+    unsigned int overflow;     // fibers allocated outside the full arena
+    cilk_mutex lock;
+};
+
+// Link stored at the top of the stack of each idle fiber in a shared pool.  The
+// fibers of a batch are chained through next, and the first fiber of each
+// batch also holds the link to the next batch and the size of its batch.
+struct fiber_batch {
+    struct cilk_fiber *next;        // next fiber in the batch
+    struct fiber_batch *next_batch; // next batch in the shared pool
+    unsigned int count;             // number of fibers in the batch
+};
+
+// Statistics on a shared pool, which workers update concurrently.
+struct fiber_depot_stats {
+    _Atomic int in_use;            // fibers taken - fibers given back
+    _Atomic int max_in_use;        // high watermark for in_use
+    _Atomic int max_free;          // high watermark for nfree
+    _Atomic unsigned long takes;   // batches taken from the pool
+    _Atomic unsigned long retries; // waits for another worker holding all
+                                   // batches, and failed pushes
+    _Atomic unsigned long stolen;  // batches taken by workers of other nodes
+    _Atomic unsigned long full;    // fibers unmapped because the pool was full
 };
 
 struct cilk_fiber_pool {
-    worker_id mutex_owner;
     int shared;
     size_t stack_size;              // Size of stacks for fibers in this pool.
+    struct cilk_fiber_arena *arena; // Arena for new stacks, or NULL.
+    size_t trim;                    // Stack bytes idle fibers keep, or 0.
+    bool trim_lazy;                 // Trim with MADV_FREE, not MADV_DONTNEED.
     struct cilk_fiber_pool *parent; // Parent pool.
                                     // If this pool is empty, get from parent
-    // Describes inactive fibers stored in the pool.
+    // Describes inactive fibers stored in a per-worker pool.
     struct cilk_fiber **fibers; // Array of max_size fiber pointers
     unsigned int capacity;      // Limit on number of fibers in pool
     unsigned int size;          // Number of fibers currently in the pool
+    unsigned int idle;          // Bottom fibers not taken since the last pass
+    unsigned int clean;         // Bottom fibers trimmed by the last pass
     struct fiber_pool_stats stats;
 
-    cilk_mutex lock __attribute__((aligned(CILK_CACHE_LINE)));
+    // A shared pool, global or per NUMA node, holds its inactive fibers in a
+    // lock-free stack of batches instead.  Workers push whole batches, and
+    // take the whole stack with an atomic exchange, which avoids the ABA
+    // problem, then push back the batches they do not need.
+    _Atomic(struct fiber_batch *) batches
+        __attribute__((aligned(CILK_CACHE_LINE)));
+    _Atomic unsigned int nfree; // Number of fibers in batches
+    struct fiber_depot_stats depot_stats;
 };
 
 //===============================================================
@@ -127,6 +178,8 @@ static inline void init_fiber_header(struct cilk_fiber *fh) {
     fh->worker = INVALID_WORKER;
     fh->current_stack_frame = NULL;
     fh->fake_stack_save = NULL;
+    if (fh->trimmed)
+        fh->trimmed = false;
 }
 
 static inline void deinit_fiber_header(struct cilk_fiber *fh) {
@@ -143,13 +196,40 @@ CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_init(__cilkrts_worker *w);
 CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_terminate(__cilkrts_worker *w);
 CHEETAH_INTERNAL void cilk_fiber_pool_per_worker_destroy(__cilkrts_worker *w);
 
-// allocate / deallocate one fiber from / back to OS
+// install the handler that reports fiber stack overflows, if enabled in g, and
+// give the calling thread the alternate signal stack the handler runs on
+CHEETAH_INTERNAL void cilk_fiber_stack_check_init(global_state *g);
+CHEETAH_INTERNAL void cilk_fiber_stack_check_thread_init(void);
+
+// create / destroy the fiber stack arena of g, if g->options.fiber_arena > 0
 CHEETAH_INTERNAL
-struct cilk_fiber *cilk_fiber_allocate(size_t stacksize);
+struct cilk_fiber_arena *cilk_fiber_arena_create(global_state *g);
+CHEETAH_INTERNAL
+void cilk_fiber_arena_destroy(struct cilk_fiber_arena *arena);
+
+// allocate / deallocate one fiber from / back to the arena, if any, or OS
+CHEETAH_INTERNAL
+struct cilk_fiber *cilk_fiber_allocate(struct cilk_fiber_arena *arena,
+                                       size_t stacksize);
 CHEETAH_INTERNAL
 void cilk_fiber_deallocate(struct cilk_fiber *fiber);
 CHEETAH_INTERNAL
 void cilk_fiber_deallocate_global(global_state *, struct cilk_fiber *fiber);
+// release the pages of an idle fiber's stack below the top keep bytes,
+// returning the number of resident bytes released
+CHEETAH_INTERNAL
+size_t cilk_fiber_trim(struct cilk_fiber *fiber, size_t keep, bool lazy);
+// fault in the top bytes of a fiber's stack
+CHEETAH_INTERNAL
+void cilk_fiber_prefault(struct cilk_fiber *fiber, size_t bytes);
+// fill the per-worker pool with at least nfibers fibers and fault in their
+// stacks, from the calling thread of the worker
+CHEETAH_INTERNAL
+void cilk_fiber_pool_warmup(__cilkrts_worker *w, unsigned int nfibers);
+// trim the fibers of the per-worker pool that stayed idle since the last call,
+// from the calling thread of the worker before it goes to sleep
+CHEETAH_INTERNAL
+void cilk_fiber_pool_trim_idle(__cilkrts_worker *w);
 // allocate / deallocate one fiber from / back to per-worker pool
 CHEETAH_INTERNAL
 struct cilk_fiber *cilk_fiber_allocate_from_pool(__cilkrts_worker *w);
@@ -12,10 +12,13 @@
 #include <string.h>
 #include <unistd.h> /* _SC_NPROCESSORS_ONLN */
 
+#include "cgroup.h"
 #include "debug.h"
 #include "global.h"
 #include "init.h"
 #include "readydeque.h"
+#include "topology.h"
+#include "worker_coord.h"
 
 #if defined __FreeBSD__ && __FreeBSD__ < 13
 typedef cpuset_t cpu_set_t;
@@ -62,9 +65,13 @@ static global_state *global_state_allocate() {
     // TODO: Convert to cilk_* equivalents
     pthread_mutex_init(&g->cilkified_lock, NULL);
     pthread_cond_init(&g->cilkified_cond_var, NULL);
+    pthread_mutex_init(&g->region_lock, NULL);
+    pthread_cond_init(&g->region_cond_var, NULL);
 
     pthread_mutex_init(&g->disengaged_lock, NULL);
     pthread_cond_init(&g->disengaged_cond_var, NULL);
+    pthread_mutex_init(&g->park_lock, NULL);
+    pthread_cond_init(&g->park_cond_var, NULL);
 
     return g;
 }
@@ -93,6 +100,113 @@ static void set_fiber_pool_cap(global_state *g, unsigned int fiber_pool_cap) {
     g->options.fiber_pool_cap = fiber_pool_cap;
 }
 
+static void set_steal_batch(global_state *g, unsigned int steal_batch) {
+    CILK_ASSERT(!g->workers_started);
+    if (steal_batch > MAX_STEAL_BATCH)
+        steal_batch = MAX_STEAL_BATCH;
+    g->options.steal_batch = steal_batch;
+}
+
+static void set_pin_policy(global_state *g, const char *policy) {
+    // Names of the policies, indexed by enum cilk_pin_policy.
+    static const char *const names[] = {"none", "compact", "scatter",
+                                        "cores-only"};
+    CILK_ASSERT(!g->workers_started);
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (0 == strcmp(policy, names[i])) {
+            g->options.pin_policy = i;
+            return;
+        }
+    }
+    fprintf(stderr, "Invalid CILK_PIN value: %s\n", policy);
+}
+
+static void set_quota_policy(global_state *g, const char *policy) {
+    // Names of the policies, indexed by enum cilk_quota_policy.
+    static const char *const names[] = {"none", "ceil", "floor"};
+    CILK_ASSERT(!g->workers_started);
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (0 == strcmp(policy, names[i])) {
+            g->options.quota_policy = i;
+            return;
+        }
+    }
+    fprintf(stderr, "Invalid CILK_QUOTA_POLICY value: %s\n", policy);
+}
+
+static bool sleep_policy_is_valid(const __cilkrts_sleep_policy *policy) {
+    unsigned int threshold = policy->sentinel_threshold;
+    return policy->steal_attempts >= 1 && threshold >= 1 &&
+           threshold <= 65536 && (threshold & (threshold - 1)) == 0 &&
+           threshold % policy->steal_attempts == 0 && policy->as_ratio >= 1 &&
+           policy->history_length >= 4 &&
+           policy->history_length <= MAX_SLEEP_HISTORY_LENGTH &&
+           policy->nap_nsec < 1000000000 && policy->sleep_nsec < 1000000000;
+}
+
+// Set *field from the environment variable var, if it is set.
+static void sleep_policy_field_from_env(unsigned int *field, const char *var) {
+    if (getenv(var)) {
+        long val = env_get_int(var);
+        *field = val > 0 ? val : 0;
+    }
+}
+
+static void parse_sleep_policy_environment(global_state *g) {
+    __cilkrts_sleep_policy policy = g->sleep_policy;
+    sleep_policy_field_from_env(&policy.steal_attempts, "CILK_STEAL_ATTEMPTS");
+    sleep_policy_field_from_env(&policy.sentinel_threshold,
+                                "CILK_SENTINEL_THRESHOLD");
+    sleep_policy_field_from_env(&policy.as_ratio, "CILK_AS_RATIO");
+    sleep_policy_field_from_env(&policy.history_length, "CILK_SLEEP_HISTORY");
+    sleep_policy_field_from_env(&policy.nap_nsec, "CILK_NAP_NSEC");
+    sleep_policy_field_from_env(&policy.sleep_nsec, "CILK_SLEEP_NSEC");
+    sleep_policy_field_from_env(&policy.backoff, "CILK_BACKOFF");
+    sleep_policy_field_from_env(&policy.backoff_fail, "CILK_BACKOFF_FAIL");
+    if (getenv("CILK_SLEEP_ADAPTIVE"))
+        policy.adaptive = env_get_int("CILK_SLEEP_ADAPTIVE") != 0;
+
+    if (sleep_policy_is_valid(&policy))
+        g->sleep_policy = policy;
+    else
+        fprintf(stderr, "Invalid Cilk sleep policy in environment; "
+                        "using the default policy\n");
+}
+
+int __cilkrts_get_sleep_policy(__cilkrts_sleep_policy *policy) {
+    global_state *g = cilkrts_target_instance();
+    if (!g)
+        return -1;
+    *policy = g->sleep_policy;
+    return 0;
+}
+
+int __cilkrts_set_sleep_policy(const __cilkrts_sleep_policy *policy) {
+    global_state *g = cilkrts_target_instance();
+    if (!g || !sleep_policy_is_valid(policy) ||
+        atomic_load_explicit(&g->nregions, memory_order_acquire) > 0)
+        return -1;
+    // Thieves copy the policy when they start stealing in a parallel region,
+    // so the new policy takes effect at the start of the next region.
+    g->sleep_policy = *policy;
+    return 0;
+}
+
+int __cilkrts_set_active_workers(unsigned nworkers) {
+    global_state *g = cilkrts_target_instance();
+    if (!g || nworkers == 0)
+        return -1;
+    set_worker_limit(g, nworkers);
+    return 0;
+}
+
+unsigned __cilkrts_get_active_workers(void) {
+    global_state *g = cilkrts_target_instance();
+    if (!g)
+        return 0;
+    return atomic_load_explicit(&g->worker_limit, memory_order_relaxed);
+}
+
 // not marked as static as it's called by __cilkrts_internal_set_nworkers
 // used by Cilksan to set nworker to 1 
 void set_nworkers(global_state *g, unsigned int nworkers) {
@@ -100,10 +214,45 @@ void set_nworkers(global_state *g, unsigned int nworkers) {
     CILK_ASSERT(nworkers <= g->options.nproc);
     CILK_ASSERT(nworkers > 0);
     g->nworkers = nworkers;
+    atomic_store_explicit(&g->worker_limit, nworkers, memory_order_relaxed);
+}
+
+// Change the number of workers that may take part in parallel regions of g,
+// at any time.  Workers beyond the new limit finish what they are doing and
+// park, disengaged, until the limit is raised again.
+void set_worker_limit(global_state *g, unsigned int limit) {
+    if (limit < 1)
+        limit = 1;
+    if (limit > g->nworkers)
+        limit = g->nworkers;
+    cilkrts_alert(BOOT, "(set_worker_limit) %u of %u workers", limit,
+                  g->nworkers);
+
+    // Update the limit under region_lock, so that a thread starting a guest
+    // region either sees the new limit or queues the region before thieves
+    // that might park check for pending regions.
+    pthread_mutex_lock(&g->region_lock);
+    uint32_t old = atomic_exchange_explicit(&g->worker_limit, limit,
+                                            memory_order_acq_rel);
+    // Threads waiting for the boss because no thief could run a guest region
+    // can now start guest regions.
+    if (limit > 1 && g->boss_waiters > 0)
+        pthread_cond_broadcast(&g->region_cond_var);
+    bool running = atomic_load_explicit(&g->nregions, memory_order_relaxed) > 0;
+    pthread_mutex_unlock(&g->region_lock);
+
+    if (limit > old) {
+        wake_parked(g);
+        // Unparked workers join a running region like disengaged thieves.
+        if (running)
+            request_more_thieves(g, limit - old);
+    }
 }
 
-// Set global RTS options from environment variables.
-static void parse_rts_environment(global_state *g) {
+// Set global RTS options from environment variables.  Returns the initial
+// limit on active workers, or 0 for no limit below the number of workers.
+static unsigned int parse_rts_environment(global_state *g) {
+    unsigned int initial_limit = 0;
     size_t stacksize = env_get_int("CILK_STACKSIZE");
     if (stacksize > 0)
         set_stacksize(g, stacksize);
@@ -113,6 +262,70 @@ static void parse_rts_environment(global_state *g) {
     unsigned int fiber_pool_cap = env_get_int("CILK_FIBER_POOL");
     if (fiber_pool_cap > 0)
         set_fiber_pool_cap(g, fiber_pool_cap);
+    if (getenv("CILK_FIBER_ARENA")) {
+        long fiber_arena = env_get_int("CILK_FIBER_ARENA");
+        g->options.fiber_arena = fiber_arena > 0 ? fiber_arena : 0;
+    }
+    if (getenv("CILK_FIBER_PREFAULT")) {
+        long prefault = env_get_int("CILK_FIBER_PREFAULT");
+        g->options.fiber_prefault = prefault > 0 ? prefault : 0;
+    }
+    if (getenv("CILK_FIBER_ARENA_THP"))
+        g->options.fiber_arena_thp = env_get_int("CILK_FIBER_ARENA_THP") != 0;
+    if (getenv("CILK_FIBER_TRIM")) {
+        long fiber_trim = env_get_int("CILK_FIBER_TRIM");
+        g->options.fiber_trim = fiber_trim > 0 ? fiber_trim : 0;
+    }
+    if (getenv("CILK_FIBER_TRIM_LAZY"))
+        g->options.fiber_trim_lazy = env_get_int("CILK_FIBER_TRIM_LAZY") != 0;
+    if (getenv("CILK_STACK_CHECK"))
+        g->options.stack_check = env_get_int("CILK_STACK_CHECK") != 0;
+    if (getenv("CILK_WARMUP")) {
+        long warmup = env_get_int("CILK_WARMUP");
+        g->options.warmup_fibers = warmup > 0 ? warmup : 0;
+    }
+    if (getenv("CILK_WARMUP_CLOSURES")) {
+        long warmup_closures = env_get_int("CILK_WARMUP_CLOSURES");
+        g->options.warmup_closures = warmup_closures > 0 ? warmup_closures : 0;
+    }
+    if (getenv("CILK_LAZY_REDUCE")) {
+        long lazy_reduce = env_get_int("CILK_LAZY_REDUCE");
+        if (lazy_reduce > MAX_LAZY_REDUCE)
+            lazy_reduce = MAX_LAZY_REDUCE;
+        g->options.lazy_reduce = lazy_reduce > 0 ? lazy_reduce : 0;
+    }
+    if (getenv("CILK_PARALLEL_REDUCE")) {
+        long parallel_reduce = env_get_int("CILK_PARALLEL_REDUCE");
+        if (parallel_reduce > INT32_MAX)
+            parallel_reduce = INT32_MAX;
+        g->options.parallel_reduce = parallel_reduce > 0 ? parallel_reduce : 0;
+    }
+    unsigned int steal_batch = env_get_int("CILK_STEAL_BATCH");
+    if (steal_batch > 0)
+        set_steal_batch(g, steal_batch);
+    if (getenv("CILK_STEAL_LOCAL")) {
+        long steal_local = env_get_int("CILK_STEAL_LOCAL");
+        g->options.steal_local = steal_local > 0 ? steal_local : 0;
+    }
+    const char *pin_policy = getenv("CILK_PIN");
+    if (pin_policy)
+        set_pin_policy(g, pin_policy);
+    if (getenv("CILK_HOT_SPIN_USEC")) {
+        long hot_spin_usec = env_get_int("CILK_HOT_SPIN_USEC");
+        g->options.hot_spin_usec = hot_spin_usec > 0 ? hot_spin_usec : 0;
+    }
+    if (getenv("CILK_WAKE_FANOUT")) {
+        long wake_fanout = env_get_int("CILK_WAKE_FANOUT");
+        g->options.wake_fanout = wake_fanout > 0 ? wake_fanout : 0;
+    }
+    if (getenv("CILK_CGROUP_WATCH_MSEC")) {
+        long watch_msec = env_get_int("CILK_CGROUP_WATCH_MSEC");
+        g->options.cgroup_watch_msec = watch_msec > 0 ? watch_msec : 0;
+    }
+    const char *quota_policy = getenv("CILK_QUOTA_POLICY");
+    if (quota_policy)
+        set_quota_policy(g, quota_policy);
+    parse_sleep_policy_environment(g);
 
     long proc_override = env_get_int("CILK_NWORKERS");
     if (g->options.nproc == 0) {
@@ -140,12 +353,35 @@ static void parse_rts_environment(global_state *g) {
             }
         }
 #endif
+        // Don't let more workers take part than the CPU quota of the cgroup
+        // allows, since the extra workers would only get the process
+        // throttled.  Still create a worker for every available core, parked
+        // beyond the limit, so the limit can rise with the quota.
+        unsigned int quota = proc_override > 0
+                                 ? 0
+                                 : cilk_cgroup_cpu_quota(
+                                       (enum cilk_quota_policy)
+                                           g->options.quota_policy);
+        if (quota > 0 && (g->options.nproc == 0 || quota < g->options.nproc)) {
+            cilkrts_alert(BOOT, "(parse_rts_environment) CPU quota %u", quota);
+            if (g->options.nproc == 0)
+                g->options.nproc = quota;
+            else
+                initial_limit = quota;
+            // Keep following the quota, and watch for throttling, unless the
+            // user chose otherwise.
+            if (!getenv("CILK_CGROUP_WATCH_MSEC"))
+                g->options.cgroup_watch_msec = DEFAULT_QUOTA_WATCH_MSEC;
+        }
     } else {
         CILK_ASSERT(g->options.nproc < 10000);
     }
+    return initial_limit;
 }
 
-global_state *global_state_init(int argc, char *argv[]) {
+// Initialize a global state with nworkers workers, or with the number of
+// workers given by the environment if nworkers is 0.
+global_state *global_state_init(int argc, char *argv[], unsigned int nworkers) {
     cilkrts_alert(BOOT, "(global_state_init) Initializing global state");
 
     (void)argc; // not currently used
@@ -159,14 +395,29 @@ global_state *global_state_init(int argc, char *argv[]) {
     global_state *g = global_state_allocate();
 
     g->options = (struct rts_options)DEFAULT_OPTIONS;
-    parse_rts_environment(g);
+    g->sleep_policy = (__cilkrts_sleep_policy){
+        .steal_attempts = DEFAULT_STEAL_ATTEMPTS,
+        .sentinel_threshold = DEFAULT_SENTINEL_THRESHOLD,
+        .as_ratio = DEFAULT_AS_RATIO,
+        .history_length = DEFAULT_SLEEP_HISTORY_LENGTH,
+        .nap_nsec = DEFAULT_NAP_NSEC,
+        .sleep_nsec = DEFAULT_SLEEP_NSEC,
+        .backoff = DEFAULT_BACKOFF,
+        .backoff_fail = DEFAULT_BACKOFF_FAIL,
+        .adaptive = DEFAULT_SLEEP_ADAPTIVE};
+    if (nworkers > 0)
+        g->options.nproc = nworkers;
+    unsigned int initial_limit = parse_rts_environment(g);
 
     unsigned active_size = g->options.nproc;
     CILK_ASSERT(active_size > 0);
     g->nworkers = active_size;
-    __cilkrts_nproc = active_size;
+    atomic_store_explicit(&g->worker_limit,
+                          initial_limit > 0 ? initial_limit : active_size,
+                          memory_order_relaxed);
 
     g->workers_started = false;
+    g->boss_initialized = false;
     g->root_closure_initialized = false;
     atomic_store_explicit(&g->done, 0, memory_order_relaxed);
     atomic_store_explicit(&g->cilkified, 0, memory_order_relaxed);
@@ -183,6 +434,15 @@ global_state *global_state_init(int argc, char *argv[]) {
     g->threads = (pthread_t *)calloc(active_size, sizeof(pthread_t));
     g->index_to_worker = (worker_id *)calloc(active_size, sizeof(worker_id));
     g->worker_to_index = (worker_id *)calloc(active_size, sizeof(worker_id));
+    if (g->options.steal_local > 0 || g->options.pin_policy != PIN_NONE) {
+        g->topology = cilk_topology_init(active_size);
+        if (!g->topology) {
+            g->options.steal_local = 0;
+            g->options.pin_policy = PIN_NONE;
+        } else if (g->topology->nnodes > 1) {
+            g->nnodes = g->topology->nnodes;
+        }
+    }
     cilk_internal_malloc_global_init(g); // initialize internal malloc first
     cilk_fiber_pool_global_init(g);
     cilk_global_sched_stats_init(&(g->stats));
@@ -21,6 +21,7 @@ extern unsigned __cilkrts_nproc;
 
 struct __cilkrts_worker;
 struct Closure;
+struct cilk_cgroup_watch;
 
 // clang-format off
 #define DEFAULT_OPTIONS                                            \
@@ -28,7 +29,24 @@ struct Closure;
         DEFAULT_STACK_SIZE,     /* stack size to use for fiber */  \
         DEFAULT_NPROC,          /* num of workers to create */     \
         DEFAULT_DEQ_DEPTH,      /* num of entries in deque */      \
-        DEFAULT_FIBER_POOL_CAP  /* alloc_batch_size */             \
+        DEFAULT_FIBER_POOL_CAP, /* alloc_batch_size */             \
+        DEFAULT_STEAL_BATCH,    /* max frames promoted per steal */\
+        DEFAULT_STEAL_LOCAL,    /* local steal attempts per level */\
+        DEFAULT_PIN_POLICY,     /* how to pin workers to CPUs */   \
+        DEFAULT_HOT_SPIN_USEC,  /* spin time after a region ends */\
+        DEFAULT_WAKE_FANOUT,    /* thieves each woken thief wakes */\
+        DEFAULT_CGROUP_WATCH_MSEC, /* cgroup quota polling interval */\
+        DEFAULT_QUOTA_POLICY,   /* how nproc follows the CPU quota */\
+        DEFAULT_FIBER_ARENA,    /* fiber stacks reserved up front */\
+        DEFAULT_FIBER_PREFAULT, /* pages prefaulted per arena stack */\
+        0,                      /* use huge pages for the arena */ \
+        DEFAULT_FIBER_TRIM,     /* stack bytes idle fibers keep */ \
+        0,                      /* trim stacks with MADV_FREE */   \
+        DEFAULT_STACK_CHECK,    /* report fiber stack overflows */ \
+        0,                      /* fibers each worker warms up */  \
+        0,                      /* closure bytes each worker warms up */\
+        DEFAULT_LAZY_REDUCE,    /* hypertables a join may defer */ \
+        DEFAULT_PARALLEL_REDUCE /* entries to reduce in parallel */\
     }
 // clang-format on
 
@@ -37,6 +55,29 @@ struct rts_options {
     unsigned int nproc;          /* can be set via env variable CILK_NWORKERS */
     unsigned int deqdepth;       /* can be set via env variable CILK_DEQDEPTH */
     unsigned int fiber_pool_cap; /* can be set via env variable CILK_FIBER_POOL */
+    unsigned int steal_batch;    /* can be set via env variable CILK_STEAL_BATCH */
+    unsigned int steal_local;    /* can be set via env variable CILK_STEAL_LOCAL */
+    unsigned int pin_policy;     /* can be set via env variable CILK_PIN */
+    unsigned int hot_spin_usec;  /* can be set via env variable CILK_HOT_SPIN_USEC */
+    unsigned int wake_fanout;    /* can be set via env variable CILK_WAKE_FANOUT */
+    unsigned int cgroup_watch_msec; /* can be set via env variable
+                                       CILK_CGROUP_WATCH_MSEC */
+    unsigned int quota_policy;   /* can be set via env variable CILK_QUOTA_POLICY */
+    unsigned int fiber_arena;    /* can be set via env variable CILK_FIBER_ARENA */
+    unsigned int fiber_prefault; /* can be set via env variable
+                                    CILK_FIBER_PREFAULT */
+    bool fiber_arena_thp;        /* can be set via env variable
+                                    CILK_FIBER_ARENA_THP */
+    size_t fiber_trim;           /* can be set via env variable CILK_FIBER_TRIM */
+    bool fiber_trim_lazy;        /* can be set via env variable
+                                    CILK_FIBER_TRIM_LAZY */
+    bool stack_check;            /* can be set via env variable CILK_STACK_CHECK */
+    unsigned int warmup_fibers;  /* can be set via env variable CILK_WARMUP */
+    size_t warmup_closures;      /* can be set via env variable
+                                    CILK_WARMUP_CLOSURES */
+    unsigned int lazy_reduce;    /* can be set via env variable CILK_LAZY_REDUCE */
+    unsigned int parallel_reduce; /* can be set via env variable
+                                     CILK_PARALLEL_REDUCE */
 };
 
 struct worker_args {
@@ -44,9 +85,35 @@ struct worker_args {
     global_state *g;
 };
 
+// A parallel region started while the boss of its instance is busy with
+// another region.  A thief starts the region by taking its root closure, and
+// the thread that started the region waits for it to finish without acting as
+// a worker.  Regions are recycled through a free list in global_state.
+struct cilk_region {
+    struct cilk_region *next;
+    struct Closure *root_closure;
+    void *orig_rsp;
+    void *extension;
+
+    // Set while the region is running, like the cilkified fields of
+    // global_state.
+    _Atomic uint32_t running_futex;
+    atomic_bool running;
+    _Atomic uint32_t waiters;
+    pthread_mutex_t running_lock;
+    pthread_cond_t running_cond_var;
+};
+
 struct global_state {
+    /* name of a runtime instance created with __cilkrts_create_instance, or
+       NULL for the default instance */
+    char *name;
+    struct global_state *next_instance; /* list of named instances */
+
     /* globally-visible options (read-only after init) */
     struct rts_options options;
+    /* policy for idle thieves; copied by each thief when it starts stealing */
+    __cilkrts_sleep_policy sleep_policy;
 
     unsigned int nworkers; /* size of next 4 arrays */
     struct worker_args *worker_args;
@@ -56,16 +123,33 @@ struct global_state {
     pthread_t *threads;
     struct Closure *root_closure;
 
+    /* machine topology, or NULL if not needed or not available */
+    struct cilk_topology *topology;
+
     struct cilk_fiber_pool fiber_pool __attribute__((aligned(CILK_CACHE_LINE)));
+    struct cilk_fiber_arena *fiber_arena; /* NULL unless enabled */
     struct global_im_pool im_pool __attribute__((aligned(CILK_CACHE_LINE)));
     struct cilk_im_desc im_desc __attribute__((aligned(CILK_CACHE_LINE)));
-    cilk_mutex im_lock; // lock for accessing global im_desc
+    cilk_mutex im_lock; // lock for the list of chunks in im_pool
+    struct im_depot im_depot __attribute__((aligned(CILK_CACHE_LINE)));
+    atomic_bool im_releasing; // a worker is releasing idle chunks
+    // All closure and reducer-view slabs of the workers, to free at shutdown.
+    _Atomic(struct slab *) closure_slabs;
+    _Atomic(struct slab *) view_slabs;
+
+    /* Per-NUMA-node tiers of the fiber pool and of internal malloc, between
+       the per-worker and the global tiers.  Only used if the topology is
+       known and has more than one node, in which case nnodes > 0. */
+    unsigned int nnodes;
+    struct cilk_fiber_pool *node_fiber_pools;
+    struct cilk_im_node *im_nodes;
 
     // These fields are accessed exclusively by the boss thread.
 
     jmpbuf boss_ctx __attribute__((aligned(CILK_CACHE_LINE)));
     void *orig_rsp;
     bool workers_started;
+    bool boss_initialized;
 
     // These fields are shared between the boss thread and a couple workers.
 
@@ -75,15 +159,49 @@ struct global_state {
     // optimization would improve performance.
     _Atomic uint32_t cilkified_futex __attribute__((aligned(CILK_CACHE_LINE)));
     atomic_bool cilkified;
+    // Number of threads that might be waiting on cilkified_futex.
+    _Atomic uint32_t cilkified_waiters;
 
     pthread_mutex_t cilkified_lock;
     pthread_cond_t cilkified_cond_var;
 
+    // Reducer views and extension of the worker that finished the boss's
+    // region, for the boss to take back once it leaves the work-stealing loop.
+    struct local_hyper_table *boss_hyper_table;
+    void *boss_extension;
+    // TLS worker of the boss thread before its region, restored at the end of
+    // the region so that it never refers to the workers of this instance
+    // outside of the region.
+    __cilkrts_worker *boss_prev_tls_worker;
+
+    // Bookkeeping for concurrent regions, protected by region_lock.  A thread
+    // that starts a region while another thread is using workers[0] as its
+    // boss starts a guest region instead, which waits on the pending list until
+    // a thief takes it.
+    pthread_mutex_t region_lock;
+    pthread_cond_t region_cond_var;
+    bool boss_busy;
+    unsigned int boss_waiters;
+    struct cilk_region *pending_regions;
+    struct cilk_region *pending_tail;
+    struct cilk_region *running_regions;
+    struct cilk_region *free_regions;
+    // Number of running regions, including the boss's region.
+    _Atomic uint32_t nregions;
+
     // These fields are shared among all workers in the work-stealing loop.
 
     atomic_bool done __attribute__((aligned(CILK_CACHE_LINE)));
     bool terminate;
     bool root_closure_initialized;
+    // Number of guest regions waiting for a thief to start them.
+    _Atomic uint32_t npending;
+    // Number of workers that may take part in parallel regions, at most
+    // nworkers.  Workers whose IDs are not below the limit park until it is
+    // raised.  Also serves as the futex on which parked workers wait.
+    _Atomic uint32_t worker_limit;
+    // Set by the cgroup watcher while the cgroup is being throttled.
+    atomic_bool throttled;
 
     worker_id *index_to_worker __attribute__((aligned(CILK_CACHE_LINE)));
     worker_id *worker_to_index;
@@ -99,10 +217,20 @@ struct global_state {
 #define DISENGAGED_SENTINEL(A, B) (((uint64_t)(A) << 32) | (uint32_t)(B))
 
     _Atomic uint32_t disengaged_thieves_futex __attribute__((aligned(CILK_CACHE_LINE)));
+    // Number of thieves that might be waiting on disengaged_thieves_futex.
+    _Atomic uint32_t disengaged_waiters;
 
     pthread_mutex_t disengaged_lock;
     pthread_cond_t disengaged_cond_var;
 
+    // Number of workers that might be waiting on worker_limit.
+    _Atomic uint32_t parked_waiters;
+    pthread_mutex_t park_lock;
+    pthread_cond_t park_cond_var;
+
+    // Thread that adjusts worker_limit to the cgroup CPU quota, or NULL.
+    struct cilk_cgroup_watch *cgroup_watch;
+
     cilk_mutex print_lock; // global lock for printing messages
 
     // This dummy worker structure is used to support lazy initialization of
@@ -122,7 +250,11 @@ CHEETAH_INTERNAL extern __cilkrts_worker default_worker;
 CHEETAH_INTERNAL
 __cilkrts_worker *__cilkrts_init_tls_worker(worker_id i, global_state *g);
 CHEETAH_INTERNAL void set_nworkers(global_state *g, unsigned int nworkers);
-CHEETAH_INTERNAL global_state *global_state_init(int argc, char *argv[]);
+CHEETAH_INTERNAL void set_worker_limit(global_state *g, unsigned int limit);
+CHEETAH_INTERNAL global_state *global_state_init(int argc, char *argv[],
+                                                 unsigned int nworkers);
+CHEETAH_INTERNAL global_state *cilkrts_target_instance(void);
+CHEETAH_INTERNAL void worker_warmup(__cilkrts_worker *w);
 CHEETAH_INTERNAL void for_each_worker(global_state *,
                                       void (*)(__cilkrts_worker *, void *),
                                       void *data);
@@ -10,14 +10,12 @@
 // the reducer_base structure as long as the reducer_lookup function
 // gets them as parameters.
 //
-// TODO: For small reducer views of size less than sizeof(void *),
-// consider storing the view directly within the reducer_base
-// structure.
-// - Problem: A reducer_base structure may move around in the hash
-//   table as other reducers are inserted.  As a result, a pointer to
-//   a view may be invalidated by other hyper_lookup operations.
-// - Problem: Need a way to keep track of whether the view in a
-//   reducer_base is storing a pointer to the view or the view itself.
+// Small views are not stored within the reducer_base structure itself, since
+// it moves around in the hash table as other reducers are inserted, which
+// would invalidate pointers to the view.  Instead, views of at most
+// VIEW_SLOT_SIZE bytes come from per-worker slabs with stable addresses, larger
+// ones from internal malloc, and the enclosing bucket records the view's size
+// so that any worker can return it to the right pool.
 typedef struct reducer_base {
     void *view;
     __cilk_reduce_fn reduce_fn;
@@ -18,8 +18,10 @@
 #ifdef __FreeBSD__
 #include <pthread_np.h>
 #endif
+#include <time.h>
 #include <unistd.h>
 
+#include "cgroup.h"
 #include "cilk-internal.h"
 #include "debug.h"
 #include "fiber.h"
@@ -29,6 +31,7 @@
 #include "readydeque.h"
 #include "sched_stats.h"
 #include "scheduler.h"
+#include "topology.h"
 #include "worker_coord.h"
 
 #if defined __FreeBSD__ && __FreeBSD__ < 13
@@ -37,6 +40,13 @@ typedef cpuset_t cpu_set_t;
 
 extern local_state default_worker_local_state;
 
+// Runtime instances created with __cilkrts_create_instance.
+static global_state *instances = NULL;
+static pthread_mutex_t instances_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Runtime instance targeted by this thread, or NULL for the default instance.
+static __thread global_state *thread_instance = NULL;
+
 static local_state *worker_local_init(local_state *l, global_state *g) {
     l->shadow_stack = (__cilkrts_stack_frame **)calloc(
         g->options.deqdepth, sizeof(struct __cilkrts_stack_frame *));
@@ -46,9 +56,15 @@ static local_state *worker_local_init(local_state *l, global_state *g) {
     l->state = WORKER_IDLE;
     l->provably_good_steal = false;
     l->exiting = false;
+    l->exiting_region = NULL;
     l->returning = false;
     l->rand_next = 0; /* will be reset in scheduler loop */
     l->wake_val = 0;
+    l->llc_domain = -1;
+    l->node_domain = -1;
+    l->steal_level = STEAL_LEVEL_LLC;
+    l->local_fails = 0;
+    l->pinned_cpu = -1;
     cilk_sched_stats_init(&(l->stats));
 
     return l;
@@ -63,9 +79,7 @@ static void worker_local_destroy(local_state *l, global_state *g) {
 static void deques_init(global_state *g) {
     cilkrts_alert(BOOT, "(deques_init) Initializing deques");
     for (unsigned int i = 0; i < g->options.nproc; i++) {
-        g->deques[i].top = NULL;
-        g->deques[i].bottom = NULL;
-        g->deques[i].mutex_owner = NO_WORKER;
+        deque_init(g->deques, i);
     }
 }
 
@@ -96,8 +110,8 @@ static void workers_init(global_state *g) {
 __cilkrts_worker *__cilkrts_init_tls_worker(worker_id i, global_state *g) {
     cilkrts_alert(BOOT, "(workers_init) Initializing worker %u", i);
     __cilkrts_worker *w;
-    if (i == 0) {
-        // Use default_worker structure for worker 0.
+    if (i == 0 && !g->name) {
+        // Use default_worker structure for worker 0 of the default instance.
         w = &default_worker;
         *(struct local_state **)(&w->l) =
             worker_local_init(&default_worker_local_state, g);
@@ -124,7 +138,7 @@ __cilkrts_worker *__cilkrts_init_tls_worker(worker_id i, global_state *g) {
     atomic_store_explicit(&w->tail, init, memory_order_relaxed);
     atomic_store_explicit(&w->head, init, memory_order_relaxed);
     atomic_store_explicit(&w->exc, init, memory_order_relaxed);
-    if (i != 0) {
+    if (w != &default_worker) {
         w->hyper_table = NULL;
     }
     // initialize internal malloc first
@@ -135,89 +149,46 @@ __cilkrts_worker *__cilkrts_init_tls_worker(worker_id i, global_state *g) {
     return w;
 }
 
-#if ENABLE_WORKER_PINNING
 #ifdef CPU_SETSIZE
-
-/**
- * Move the <code>cpu<\code> bit from the <code>cpu_set_t<\code>
- * <code>from<\code> to the <code>cpu_set_t<\code> <code>to<\code>, iff the bit
- * is set in <code>from<\code>.
- *
- * @param cpu  the id of the cpu to move
- * @param to   the set to move the cpu into
- * @param from the set to move the cpu out of
- */
-static void move_bit(int cpu, cpu_set_t *to, cpu_set_t *from) {
-    if (CPU_ISSET(cpu, from)) {
-        CPU_CLR(cpu, from);
-        CPU_SET(cpu, to);
-    }
-}
-
 /**
- * Fill in the passed in <code>worker_mask<\code> to contain all the cpus in
- * the next group of cpus, as defined by <code>group_size<\code>,
- * <code>step_in<\code>, and <code>step_out<\code>. The
- * <code>unassigned_mask<\code> is cleared of these bits to avoid reusing cpus
- * for different workers.
- *
- * @param worker_mask     (output) the processor mask that will store the set
- *                        of all cpu ids to assigne to worker <code>w_id<\code>
- * @param w_id            the id of the worker that will be pinned using the
- *                        <code>worker_mask<\code> (used for debug messages)
- * @param cpu_start       the cpu id from which to start searching in the
- *                        <code>unassigned_mask<\code> for an available cpu
- * @param unassigned_mask the set of cores in the process that are unassigned
- *                        to any workers
- * @param group_size      the number of cpus to allow <code>w_id<\code> to use
- * @param step_in         the offset between cpus in the same group
- * @param step_out        the offset between the start of one group and the
- *                        next
- * @param available_cores the total number of cores available to the process
- *                        (used for debug messages)
+ * Choose a CPU for each worker other than the boss, according to the pinning
+ * policy, and record it in the worker's local state.  Each worker pins itself
+ * to its CPU when it starts.  Workers are not pinned if the process affinity
+ * mask does not contain enough suitable CPUs for all of them.
  *
- * @return                the first possible cpu id for the next group (not
- *                        guaranteed to be available in the
- *                        <code>unassigned_mask<\code>)
+ * @param g the global state whose workers should be pinned
  */
-static inline int fill_worker_mask_and_get_next_cpu(
-    cpu_set_t *const worker_mask, int const w_id, int const cpu_start,
-    cpu_set_t *const unassigned_mask, int const group_size, int const step_in,
-    int const step_out, int const available_cores) {
-    int cpu = cpu_start;
-
-    while (!CPU_ISSET(cpu, unassigned_mask)) {
-        ++cpu;
-    }
-
-    CPU_CLR(cpu, unassigned_mask);
+static void assign_worker_cpus(global_state *g) {
+    cpu_set_t process_mask;
+    if (0 != pthread_getaffinity_np(pthread_self(), sizeof(process_mask),
+                                    &process_mask))
+        return;
+
+    int *cpus = (int *)calloc(CPU_SETSIZE, sizeof(int));
+    int ncpus = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &process_mask))
+            cpus[ncpus++] = cpu;
+    ncpus = cilk_topology_pin_order(
+        g->topology, (enum cilk_pin_policy)g->options.pin_policy, cpus, ncpus);
 
-    CPU_ZERO(worker_mask);
-    CPU_SET(cpu, worker_mask);
-    for (int off = 1; off < group_size; ++off) {
-        move_bit(cpu + off * step_in, worker_mask, unassigned_mask);
-        cilkrts_alert(BOOT, NULL, "Bind worker %u to core %d of %d", w_id,
-                      cpu + off * step_in, available_cores);
+    /* If cores are overallocated it doesn't make sense to pin threads. */
+    unsigned int n_threads = g->nworkers;
+    if (n_threads - 1 > (unsigned int)ncpus) {
+        cilkrts_alert(BOOT,
+                      "(assign_worker_cpus) Not pinning %u workers to %d CPUs",
+                      n_threads - 1, ncpus);
+    } else {
+        for (unsigned int w = 1; w < n_threads; ++w) {
+            g->workers[w]->l->pinned_cpu = cpus[w - 1];
+            cilkrts_alert(BOOT,
+                          "(assign_worker_cpus) Bind worker %u to cpu %d", w,
+                          cpus[w - 1]);
+        }
     }
-    cpu += step_out;
-
-    return cpu;
-}
-
-/**
- * Pins the passed in thread to the set of cpus in the <code>worker_mask<\code>.
- *
- * @param thread_id   the id of the thread that should be pinned
- * @param worker_mask the set of cpus to which the thread should be pinned
- */
-static inline void pin_thread(pthread_t const thread_id,
-                              cpu_set_t *const worker_mask) {
-    int const err =
-        pthread_setaffinity_np(thread_id, sizeof(*worker_mask), worker_mask);
-    CILK_ASSERT_G(err == 0);
+    free(cpus);
 }
-#endif
-#endif // ENABLE_WORKER_PINNING
+#endif // CPU_SETSIZE
 
 /**
  * Initializes all other threads in the runtime, and then enters the
@@ -237,51 +208,6 @@ void *init_threads_and_enter_scheduler(void *args) {
     /* TODO: Mac OS has a better interface allowing the application
        to request that two threads run as far apart as possible by
        giving them distinct "affinity tags". */
-#if ENABLE_WORKER_PINNING
-#ifdef CPU_SETSIZE
-    int const my_id = worker_start - 1;
-
-    // Affinity setting, from cilkplus-rts
-    cpu_set_t process_mask;
-    int available_cores = 0;
-    // Get the mask from the parent thread (master thread)
-    if (0 == pthread_getaffinity_np(pthread_self(), sizeof(process_mask),
-                                    &process_mask)) {
-        available_cores = CPU_COUNT(&process_mask);
-    }
-
-    /* pin_strategy controls how threads are spread over cpu numbers.
-       Based on very limited testing FreeBSD groups hyperthreads of a
-       core together (consecutive IDs) and Linux separates them.
-       This is not guaranteed and may not even be consistent.
-       The order is influenced by board firmware.
-       When sysfs is enabled, Linux offers
-       /sys/devices/system/cpu/cpu0/topology/core_siblings
-       which is in a format compatible with cpulist_parse().
-       FreeBSD exports sysctl kern.sched.topology_spec, an XML representation
-       of the processor topology. */
-    /* TODO: Fix pinning strategy to better utilize cpu architecture.  For
-       example, we probably do not want to pin a worker to cpus on different
-       NUMA nodes. */
-#ifdef __FreeBSD__
-    int pin_strategy = 1; /* (0, 1), (2, 3), ... */
-#else
-    int pin_strategy = 0; /* (0, N/2), (1, N/2 + 1), ... */
-#endif
-
-    switch (env_get_int("CILK_PIN")) {
-    case 1:
-        pin_strategy = 0;
-        break;
-    case 2:
-        pin_strategy = 1;
-        break;
-    case 3:
-        available_cores = 0;
-        break;
-    }
-#endif
-#endif // ENABLE_WORKER_PINNING
     int n_threads = g->nworkers;
     CILK_ASSERT(n_threads > 0);
 
@@ -289,41 +215,8 @@ void *init_threads_and_enter_scheduler(void *args) {
 
     cilkrts_alert(BOOT, "(threads_init) Setting up threads");
 
-#if ENABLE_WORKER_PINNING
-#ifdef CPU_SETSIZE
-    cpu_set_t my_worker_mask;
-
-    /* Three cases: core count at least twice worker count, allocate
-       groups of floor(worker count / core count) CPUs.
-       Core count greater than worker count, do not bind workers to CPUs.
-       Otherwise, bind workers to single CPUs. */
-    int cpu = 0;
-    int group_size = 1;
-    int step_in = 1, step_out = 1;
-
-    /* If cores are overallocated it doesn't make sense to pin threads. */
-    if (n_threads > available_cores) {
-        available_cores = 0;
-    } else {
-        group_size = available_cores / n_threads;
-        if (pin_strategy != 0) {
-            step_in = 1;
-            step_out = group_size;
-        } else {
-            step_out = 1;
-            step_in = n_threads;
-        }
-
-        // Get my CPU first, but don't pin yet; special OS permissions are
-        // required to pin a thread to a cpu not in the current thread's
-        // cpu affinity set
-        cpu = fill_worker_mask_and_get_next_cpu(
-            &my_worker_mask, my_id, cpu, &process_mask, group_size, step_in,
-            step_out, available_cores);
-    }
-#endif
-#endif // ENABLE_WORKER_PINNING
-
+    // This thread pins itself in scheduler_thread_proc only after creating the
+    // other workers, so they do not inherit its affinity mask.
     for (int w = worker_start; w < n_threads; w++) {
         int status = pthread_create(&g->threads[w], NULL, scheduler_thread_proc,
                                     &g->worker_args[w]);
@@ -332,35 +225,19 @@ void *init_threads_and_enter_scheduler(void *args) {
             cilkrts_bug(NULL, "Cilk: thread creation (%u) failed: %s", w,
                         strerror(status));
         }
-
-#if ENABLE_WORKER_PINNING
-#ifdef CPU_SETSIZE
-        if (available_cores > 0) {
-            cpu_set_t worker_mask;
-            /* Skip to the next active CPU ID.  */
-            cpu = fill_worker_mask_and_get_next_cpu(
-                &worker_mask, w, cpu, &process_mask, group_size, step_in,
-                step_out, available_cores);
-            pin_thread(g->threads[w], &worker_mask);
-        }
-#endif
-#endif // ENABLE_WORKER_PINNING
     }
 
-#if ENABLE_WORKER_PINNING
-#ifdef CPU_SETSIZE
-    if (available_cores > 0) {
-        pin_thread(g->threads[my_id], &my_worker_mask);
-    }
-#endif
-#endif
-
     return scheduler_thread_proc(args);
 }
 
 static void threads_init(global_state *g) {
     int const worker_start = 1;
 
+#ifdef CPU_SETSIZE
+    if (g->options.pin_policy != PIN_NONE && g->topology)
+        assign_worker_cpus(g);
+#endif
+
     // Make sure we are supposed to create worker threads
     if (worker_start < (int)g->nworkers) {
         int status = pthread_create(&g->threads[worker_start], NULL,
@@ -374,9 +251,8 @@ static void threads_init(global_state *g) {
     }
 }
 
-global_state *__cilkrts_startup(int argc, char *argv[]) {
-    cilkrts_alert(BOOT, "(__cilkrts_startup) argc %d", argc);
-    global_state *g = global_state_init(argc, argv);
+// Initialize the workers, deques, and root closure of g.
+static void instance_init(global_state *g) {
     workers_init(g);
     deques_init(g);
 
@@ -384,22 +260,38 @@ global_state *__cilkrts_startup(int argc, char *argv[]) {
     // allocate the closure and fiber.
     __cilkrts_worker *w0 = g->workers[0];
     Closure *t = Closure_create(w0, NULL);
-    struct cilk_fiber *fiber = cilk_fiber_allocate(g->options.stacksize);
+    struct cilk_fiber *fiber =
+        cilk_fiber_allocate(g->fiber_arena, g->options.stacksize);
     t->fiber = fiber;
+    t->root = true;
     g->root_closure = t;
+}
 
+global_state *__cilkrts_startup(int argc, char *argv[]) {
+    cilkrts_alert(BOOT, "(__cilkrts_startup) argc %d", argc);
+    global_state *g = global_state_init(argc, argv, 0);
+    instance_init(g);
     return g;
 }
 
+static int instance_warmup(global_state *g, unsigned int nfibers,
+                           size_t closure_bytes);
+
 // Global constructor for starting up the default cilkrts.
 __attribute__((constructor)) void __default_cilkrts_startup() {
     default_cilkrts = __cilkrts_startup(0, NULL);
+    __cilkrts_nproc = default_cilkrts->nworkers;
 
     for (unsigned i = 0; i < cilkrts_callbacks.last_init; ++i)
         cilkrts_callbacks.init[i]();
 
     /* Any attempt to register more initializers should fail. */
     cilkrts_callbacks.after_init = true;
+
+    struct rts_options *options = &default_cilkrts->options;
+    if (options->warmup_fibers > 0 || options->warmup_closures > 0)
+        instance_warmup(default_cilkrts, options->warmup_fibers,
+                        options->warmup_closures);
 }
 
 void __cilkrts_internal_set_nworkers(unsigned int nworkers) {
@@ -411,6 +303,7 @@ void __cilkrts_internal_set_nworkers(unsigned int nworkers) {
 static void __cilkrts_start_workers(global_state *g) {
     threads_init(g);
     g->workers_started = true;
+    cilk_cgroup_watch_start(g);
 }
 
 // Stop the Cilk workers in g, for example, by joining their underlying
@@ -419,10 +312,16 @@ static void __cilkrts_stop_workers(global_state *g) {
     /* CILK_ASSERT( */
     /*     !atomic_load_explicit(&g->start_thieves, memory_order_acquire)); */
 
+    cilk_cgroup_watch_stop(g);
+
     // Set g->start and g->terminate, to allow the workers to exit their
     // outermost scheduling loop.
     g->terminate = true;
 
+    // Unpark any parked workers, so they see g->terminate.
+    atomic_store_explicit(&g->worker_limit, g->nworkers, memory_order_release);
+    wake_parked(g);
+
     // Wake up all the workers.
     // We call wake_all_disengaged, rather than wake_thieves, to properly
     // terminate all thieves, whether they're disengaged inside or outside the
@@ -441,6 +340,182 @@ static void __cilkrts_stop_workers(global_state *g) {
     g->workers_started = false;
 }
 
+// Initialize the boss thread's runtime structures of g, if necessary.  Called
+// by the thread that uses workers[0] of g as its boss.
+static void boss_init(global_state *g) {
+    if (g->boss_initialized)
+        return;
+    __cilkrts_worker *w0 = g->workers[0];
+    if (g->topology)
+        cilk_topology_register_worker(w0);
+    cilk_fiber_pool_per_worker_init(w0);
+    w0->l->rand_next = 162347;
+    if (USE_EXTENSION) {
+        g->root_closure->ext_fiber =
+            cilk_fiber_allocate(g->fiber_arena, g->options.stacksize);
+    }
+    g->boss_initialized = true;
+}
+
+// Fill the fiber pool and closure cache of w as much as the warm-up options of
+// its instance ask for.  Called by the thread running w.
+void worker_warmup(__cilkrts_worker *w) {
+    global_state *g = w->g;
+    if (g->options.warmup_fibers > 0)
+        cilk_fiber_pool_warmup(w, g->options.warmup_fibers);
+    if (g->options.warmup_closures > 0)
+        cilk_closure_warmup(w, g->options.warmup_closures);
+}
+
+// Let another thread use workers[0] of g as its boss.  Called by the boss
+// thread once it no longer uses workers[0] or the boss's fields of g.
+static void release_boss(global_state *g) {
+    pthread_mutex_lock(&g->region_lock);
+    g->boss_busy = false;
+    if (g->boss_waiters > 0)
+        pthread_cond_signal(&g->region_cond_var);
+    pthread_mutex_unlock(&g->region_lock);
+}
+
+// Warm up g before its first parallel region: initialize the boss, start the
+// workers, have every worker fill its own pools with nfibers fibers and
+// closure_bytes of closures, and wait until all workers are asleep.  Returns
+// nonzero if the workers of g have already started or g is busy.
+static int instance_warmup(global_state *g, unsigned int nfibers,
+                           size_t closure_bytes) {
+    pthread_mutex_lock(&g->region_lock);
+    bool busy = g->boss_busy || g->workers_started;
+    if (!busy)
+        g->boss_busy = true;
+    pthread_mutex_unlock(&g->region_lock);
+    if (busy)
+        return -1;
+
+    cilkrts_alert(BOOT, "(instance_warmup) %u fibers, %zu closure bytes",
+                  nfibers, closure_bytes);
+    g->options.warmup_fibers = nfibers;
+    g->options.warmup_closures = closure_bytes;
+    boss_init(g);
+    worker_warmup(g->workers[0]);
+    __cilkrts_start_workers(g);
+
+    // Each worker warms up before it first disengages, whether it then waits
+    // for a parallel region or parks beyond the worker limit.
+    const struct timespec naptime = {.tv_sec = 0, .tv_nsec = 100000};
+    while (GET_DISENGAGED(atomic_load_explicit(&g->disengaged_sentinel,
+                                               memory_order_acquire)) <
+           g->nworkers - 1)
+        nanosleep(&naptime, NULL);
+    cilkrts_alert(BOOT, "(instance_warmup) All workers asleep");
+
+    release_boss(g);
+    return 0;
+}
+
+static struct cilk_region *region_create(global_state *g) {
+    struct cilk_region *r =
+        (struct cilk_region *)calloc(1, sizeof(struct cilk_region));
+    // Guest regions are started by threads that are not workers, so allocate
+    // the root closure outside of internal malloc.
+    Closure *t =
+        (Closure *)cilk_aligned_alloc(__alignof__(Closure), sizeof(Closure));
+    Closure_init(t, NULL);
+    t->fiber = cilk_fiber_allocate(g->fiber_arena, g->options.stacksize);
+    if (USE_EXTENSION)
+        t->ext_fiber =
+            cilk_fiber_allocate(g->fiber_arena, g->options.stacksize);
+    t->root = true;
+    r->root_closure = t;
+    pthread_mutex_init(&r->running_lock, NULL);
+    pthread_cond_init(&r->running_cond_var, NULL);
+    return r;
+}
+
+static void regions_destroy(global_state *g) {
+    CILK_ASSERT_NULL(g->pending_regions);
+    CILK_ASSERT_NULL(g->running_regions);
+    struct cilk_region *r;
+    while ((r = g->free_regions)) {
+        g->free_regions = r->next;
+        Closure *t = r->root_closure;
+        cilk_fiber_deallocate_global(g, t->fiber);
+        if (USE_EXTENSION)
+            cilk_fiber_deallocate_global(g, t->ext_fiber);
+        t->status = CLOSURE_POST_INVALID;
+        free(t);
+        pthread_mutex_destroy(&r->running_lock);
+        pthread_cond_destroy(&r->running_cond_var);
+        free(r);
+    }
+}
+
+// Start a guest region for sf on g, whose boss is busy with another region,
+// and wait for the workers to finish it.  Executed by the Cilkifying thread
+// with g->region_lock held.
+static __attribute__((noreturn)) void
+invoke_guest_region(global_state *g, __cilkrts_stack_frame *sf) {
+    struct cilk_region *r = g->free_regions;
+    if (r)
+        g->free_regions = r->next;
+    pthread_mutex_unlock(&g->region_lock);
+    if (!r)
+        r = region_create(g);
+    cilkrts_alert(BOOT, "(invoke_guest_region) root closure %p",
+                  (void *)r->root_closure);
+
+    // Set up the root closure as __cilkrts_internal_invoke_cilkified_root does
+    // for the boss, except that the thief who takes the closure will run it as
+    // stolen work.
+    Closure *root_closure = r->root_closure;
+    if (USE_EXTENSION)
+        sf->extension = r->extension;
+    Closure_make_ready(root_closure);
+    r->orig_rsp = SP(sf);
+    void *new_rsp =
+        (void *)sysdep_reset_stack_for_resume(root_closure->fiber, sf);
+    USE_UNUSED(new_rsp);
+    CILK_ASSERT_POINTER_EQUAL(SP(sf), new_rsp);
+    sf->flags |= CILK_FRAME_LAST;
+    __cilkrts_set_stolen(sf);
+    Closure_clear_frame(root_closure);
+    Closure_set_frame(root_closure, sf);
+    set_region_running(r);
+
+    // Queue the region for a thief to take.  If no other region is running,
+    // start the thieves as for a new boss region; otherwise make sure at least
+    // one thief is awake to notice the region.
+    pthread_mutex_lock(&g->region_lock);
+    r->next = NULL;
+    if (g->pending_tail)
+        g->pending_tail->next = r;
+    else
+        g->pending_regions = r;
+    g->pending_tail = r;
+    atomic_fetch_add_explicit(&g->npending, 1, memory_order_release);
+    bool first =
+        atomic_fetch_add_explicit(&g->nregions, 1, memory_order_relaxed) == 0;
+    if (first)
+        atomic_store_explicit(&g->done, 0, memory_order_release);
+    pthread_mutex_unlock(&g->region_lock);
+    if (first)
+        wake_thieves(g);
+    else
+        request_more_thieves(g, 1);
+
+    wait_while_region_running(r);
+
+    // The worker that finished the region saved its state at the end of the
+    // Cilk function in sf->ctx.  Resume there on this thread's stack.
+    SP(sf) = r->orig_rsp;
+    pthread_mutex_lock(&g->region_lock);
+    r->next = g->free_regions;
+    g->free_regions = r;
+    pthread_mutex_unlock(&g->region_lock);
+    sysdep_restore_fp_state(sf);
+    sanitizer_start_switch_fiber(NULL);
+    __builtin_longjmp(sf->ctx, 1);
+}
+
 // Block until signaled the Cilkified region is done.  Executed by the Cilkfying
 // thread.
 static inline void wait_until_cilk_done(global_state *g) {
@@ -454,14 +529,24 @@ static inline __attribute__((noinline)) void boss_wait_helper(void) {
     // function arguments and local variables in this function.  Get
     // fresh copies of these arguments from the runtime's global
     // state.
-    global_state *g = __cilkrts_tls_worker->g;
+    __cilkrts_worker *w = __cilkrts_tls_worker;
+    global_state *g = w->g;
     __cilkrts_stack_frame *sf = g->root_closure->frame;
     CILK_BOSS_START_TIMING(g);
 
     // Wait until the cilkified region is done executing.
     wait_until_cilk_done(g);
 
+    // Take over the reducer views and extension of the worker that finished
+    // the region.
+    w->hyper_table = g->boss_hyper_table;
+    g->boss_hyper_table = NULL;
+    w->extension = g->boss_extension;
+    g->boss_extension = NULL;
+
     __cilkrts_need_to_cilkify = true;
+    __cilkrts_set_tls_worker(g->boss_prev_tls_worker);
+    g->boss_prev_tls_worker = NULL;
 
     // At this point, some Cilk worker must have completed the
     // Cilkified region and executed uncilkify at the end of the Cilk
@@ -474,6 +559,7 @@ static inline __attribute__((noinline)) void boss_wait_helper(void) {
     // Restore the boss's original rsp, so the boss completes the Cilk
     // function on its original stack.
     SP(sf) = g->orig_rsp;
+    release_boss(g);
     sysdep_restore_fp_state(sf);
     sanitizer_start_switch_fiber(NULL);
     __builtin_longjmp(sf->ctx, 1);
@@ -482,20 +568,31 @@ static inline __attribute__((noinline)) void boss_wait_helper(void) {
 // Setup runtime structures to start a new Cilkified region.  Executed by the
 // Cilkifying thread in cilkify().
 void __cilkrts_internal_invoke_cilkified_root(__cilkrts_stack_frame *sf) {
-    global_state *g = default_cilkrts;
-
-    // Initialize the boss thread's runtime structures, if necessary.
-    static bool boss_initialized = false;
-    if (!boss_initialized) {
-        __cilkrts_worker *w0 = g->workers[0];
-        cilk_fiber_pool_per_worker_init(w0);
-        w0->l->rand_next = 162347;
-        if (USE_EXTENSION) {
-            g->root_closure->ext_fiber =
-                cilk_fiber_allocate(g->options.stacksize);
-        }
-        boss_initialized = true;
+    global_state *g = cilkrts_target_instance();
+
+    // Claim workers[0] of g, so this thread acts as the boss of g for this
+    // region.  If another thread is using workers[0], start a guest region
+    // instead, unless g has no active thieves to run it.
+    pthread_mutex_lock(&g->region_lock);
+    while (g->boss_busy &&
+           atomic_load_explicit(&g->worker_limit, memory_order_relaxed) == 1) {
+        ++g->boss_waiters;
+        pthread_cond_wait(&g->region_cond_var, &g->region_lock);
+        --g->boss_waiters;
     }
+    if (g->boss_busy)
+        invoke_guest_region(g, sf);
+    g->boss_busy = true;
+    bool first =
+        atomic_fetch_add_explicit(&g->nregions, 1, memory_order_relaxed) == 0;
+    if (first)
+        atomic_store_explicit(&g->done, 0, memory_order_release);
+    pthread_mutex_unlock(&g->region_lock);
+
+    g->boss_prev_tls_worker = __cilkrts_get_tls_worker();
+    __cilkrts_set_tls_worker(g->workers[0]);
+    cilk_fiber_stack_check_thread_init();
+    boss_init(g);
 
     __cilkrts_need_to_cilkify = false;
 
@@ -539,25 +636,16 @@ void __cilkrts_internal_invoke_cilkified_root(__cilkrts_stack_frame *sf) {
     // flags.
 
     /* reset_disengaged_var(g); */
-    if (__builtin_expect(
-            atomic_load_explicit(&g->cilkified, memory_order_relaxed), false)) {
-        cilkrts_bug(
-            NULL,
-            "ERROR: OpenCilk runtime already executing a Cilk computation.\n");
-    }
+    CILK_ASSERT(!atomic_load_explicit(&g->cilkified, memory_order_relaxed));
     set_cilkified(g);
 
-    // Set g->done = 0, so Cilk workers will continue trying to steal.
-    atomic_store_explicit(&g->done, 0, memory_order_release);
-
-    // Wake up the thieves, to allow them to begin work stealing.
-    //
-    // NOTE: We might want to wake thieves gradually, as successful steals
-    // occur, rather than all at once.  Initial testing of this approach did not
-    // seem to perform well, however.  One possible reason why could be because
-    // of the extra kernel interactions involved in waking workers gradually.
-    wake_thieves(g);
-    /* request_more_thieves(g, g->nworkers); */
+    // Wake up the thieves, to allow them to begin work stealing.  With a wake
+    // fanout, wake only the first level of a tree of thieves, and let each
+    // thief wake the next level once it finds work to steal.
+    if (g->options.wake_fanout > 0 && g->nworkers > 1)
+        request_more_thieves(g, g->options.wake_fanout);
+    else
+        wake_thieves(g);
 
     // Start the workers if necessary
     if (__builtin_expect(!g->workers_started, false)) {
@@ -585,25 +673,56 @@ void __cilkrts_internal_exit_cilkified_root(global_state *g,
     CILK_SWITCH_TIMING(w, INTERVAL_WORK, INTERVAL_CILKIFY_EXIT);
 
     worker_id self = w->self;
-    const bool is_boss = (0 == self);
     ReadyDeque *deques = g->deques;
 
-    // Mark the computation as done.  Also "sleep" the workers: update global
-    // flags so workers who exit the work-stealing loop will return to waiting
-    // for the start of the next Cilkified region.
-    sleep_thieves(g);
-
-    atomic_store_explicit(&g->done, 1, memory_order_release);
+    // Find the running guest region that sf is the root of, if any.
+    // Otherwise sf is the root of the boss's region.
+    struct cilk_region *region = NULL;
+    Closure *root_closure = g->root_closure;
+    pthread_mutex_lock(&g->region_lock);
+    for (struct cilk_region **p = &g->running_regions; *p; p = &(*p)->next) {
+        if ((*p)->root_closure->frame == sf) {
+            region = *p;
+            *p = region->next;
+            root_closure = region->root_closure;
+            break;
+        }
+    }
+    // If this is the last running region, mark the computation as done.  Also
+    // "sleep" the workers: update global flags so workers who exit the
+    // work-stealing loop will return to waiting for the start of the next
+    // Cilkified region.
+    if (atomic_fetch_sub_explicit(&g->nregions, 1, memory_order_relaxed) ==
+        1) {
+        sleep_thieves(g);
+        atomic_store_explicit(&g->done, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&g->region_lock);
     /* wake_all_disengaged(g); */
 
+    const bool is_boss = (0 == self) && !region;
+    // Reduce any views whose reduction was deferred, since code outside the
+    // region reads the leftmost views directly.
+    if (w->hyper_table && w->hyper_table->deferred)
+        w->hyper_table = __cilkrts_reduce_deferred_hts(w->hyper_table);
+    if (region) {
+        // The region started without the leftmost views of its reducers, so
+        // fold its views into them now.
+        if (w->hyper_table)
+            reduce_views_into_keys(w->hyper_table);
+        region->extension = w->extension;
+    } else {
+        // Leave these for the boss to take back in boss_wait_helper.  If
+        // another worker finished the region, the boss might be running work
+        // from a guest region at this point.
+        g->boss_hyper_table = w->hyper_table;
+        g->boss_extension = w->extension;
+    }
+    w->hyper_table = NULL;
+    w->extension = NULL;
     if (!is_boss) {
         w->l->exiting = true;
-        __cilkrts_worker **workers = g->workers;
-        __cilkrts_worker *w0 = workers[0];
-        w0->hyper_table = w->hyper_table;
-        w->hyper_table = NULL;
-        w0->extension = w->extension;
-        w->extension = NULL;
+        w->l->exiting_region = region;
     }
 
     // Clear this worker's deque.  Nobody can successfully steal from this deque
@@ -612,9 +731,8 @@ void __cilkrts_internal_exit_cilkified_root(global_state *g,
     // deque lock to make sure no other worker has a lingering pointer to the
     // closure.
     deque_lock_self(deques, self);
-    deques[self].bottom = (Closure *)NULL;
-    deques[self].top = (Closure *)NULL;
-    WHEN_CILK_DEBUG(g->root_closure->owner_ready_deque = NO_WORKER);
+    deque_reset(deques, self, self);
+    WHEN_CILK_DEBUG(root_closure->owner_ready_deque = NO_WORKER);
     deque_unlock_self(deques, self);
 
     // Clear the flags in sf.  This routine runs before leave_frame in a Cilk
@@ -627,18 +745,14 @@ void __cilkrts_internal_exit_cilkified_root(global_state *g,
     CILK_STOP_TIMING(w, INTERVAL_CILKIFY_EXIT);
     if (is_boss) {
         // We finished the computation on the boss thread.  No need to jump to
-        // the runtime in this case; just return normally.
+        // the runtime in this case.  But this thread is still running on the
+        // root closure's fiber, which another thread may use as soon as the
+        // boss releases workers[0].  So finish in boss_wait_helper, on the
+        // boss's original stack, rather than returning directly.
         local_state *l = w->l;
         atomic_store_explicit(&g->cilkified, 0, memory_order_relaxed);
         l->state = WORKER_IDLE;
-        __cilkrts_need_to_cilkify = true;
-
-        // Restore the boss's original rsp, so the boss completes the Cilk
-        // function on its original stack.
-        SP(sf) = g->orig_rsp;
-        sysdep_restore_fp_state(sf);
-        sanitizer_start_switch_fiber(NULL);
-        __builtin_longjmp(sf->ctx, 1);
+        __builtin_longjmp(g->boss_ctx, 1);
     } else {
         // done; go back to runtime
         CILK_START_TIMING(w, INTERVAL_WORK);
@@ -662,10 +776,14 @@ static void global_state_deinit(global_state *g) {
     // TODO: Convert to cilk_* equivalents
     pthread_mutex_destroy(&g->cilkified_lock);
     pthread_cond_destroy(&g->cilkified_cond_var);
+    pthread_mutex_destroy(&g->region_lock);
+    pthread_cond_destroy(&g->region_cond_var);
     /* pthread_mutex_destroy(&g->start_thieves_lock); */
     /* pthread_cond_destroy(&g->start_thieves_cond_var); */
     pthread_mutex_destroy(&g->disengaged_lock);
     pthread_cond_destroy(&g->disengaged_cond_var);
+    pthread_mutex_destroy(&g->park_lock);
+    pthread_cond_destroy(&g->park_cond_var);
     free(g->worker_args);
     g->worker_args = NULL;
     free(g->workers);
@@ -679,6 +797,9 @@ static void global_state_deinit(global_state *g) {
     g->index_to_worker = NULL;
     free(g->worker_to_index);
     g->worker_to_index = NULL;
+    cilk_topology_destroy(g->topology);
+    g->topology = NULL;
+    free(g->name);
     free(g);
 }
 
@@ -742,7 +863,7 @@ static void workers_deinit(global_state *g) {
         free(w->l->shadow_stack);
         w->l->shadow_stack = NULL;
         *(struct local_state **)(&w->l) = NULL;
-        if (i != 0)
+        if (w != &default_worker)
             free(w);
     }
 
@@ -755,14 +876,17 @@ CHEETAH_INTERNAL void __cilkrts_shutdown(global_state *g) {
     if (g->workers_started)
         __cilkrts_stop_workers(g);
 
-    for (unsigned i = cilkrts_callbacks.last_exit; i > 0;)
-        cilkrts_callbacks.exit[--i]();
+    if (g == default_cilkrts) {
+        for (unsigned i = cilkrts_callbacks.last_exit; i > 0;)
+            cilkrts_callbacks.exit[--i]();
+    }
 
     // Deallocate the root closure and its fiber
     cilk_fiber_deallocate_global(g, g->root_closure->fiber);
     if (USE_EXTENSION)
         cilk_fiber_deallocate_global(g, g->root_closure->ext_fiber);
     Closure_destroy_global(g, g->root_closure);
+    regions_destroy(g);
 
     // Cleanup the global state
     workers_terminate(g);
@@ -786,3 +910,86 @@ CHEETAH_INTERNAL void __cilkrts_shutdown(global_state *g) {
 __attribute__((destructor)) void __default_cilkrts_shutdown() {
     __cilkrts_shutdown(default_cilkrts);
 }
+
+// Get the runtime instance that a parallel region started by this thread
+// would run on.  Within a parallel region, that is the instance running the
+// region.
+global_state *cilkrts_target_instance(void) {
+    if (!__cilkrts_need_to_cilkify)
+        return __cilkrts_get_tls_worker()->g;
+    return thread_instance ? thread_instance : default_cilkrts;
+}
+
+unsigned __cilkrts_internal_target_nworkers(void) {
+    return cilkrts_target_instance()->nworkers;
+}
+
+__cilkrts_instance *__cilkrts_create_instance(const char *name,
+                                              unsigned nworkers) {
+    if (!name || __cilkrts_find_instance(name))
+        return NULL;
+    cilkrts_alert(BOOT, "(__cilkrts_create_instance) %s with %u workers",
+                  name, nworkers);
+    global_state *g = global_state_init(0, NULL, nworkers);
+    g->name = strdup(name);
+    instance_init(g);
+
+    pthread_mutex_lock(&instances_lock);
+    g->next_instance = instances;
+    instances = g;
+    pthread_mutex_unlock(&instances_lock);
+    return (__cilkrts_instance *)g;
+}
+
+int __cilkrts_destroy_instance(__cilkrts_instance *instance) {
+    global_state *g = (global_state *)instance;
+    if (!g || !g->name ||
+        atomic_load_explicit(&g->nregions, memory_order_acquire) > 0)
+        return -1;
+
+    pthread_mutex_lock(&instances_lock);
+    global_state **p = &instances;
+    while (*p && *p != g)
+        p = &(*p)->next_instance;
+    if (*p)
+        *p = g->next_instance;
+    pthread_mutex_unlock(&instances_lock);
+    if (thread_instance == g)
+        thread_instance = NULL;
+
+    __cilkrts_shutdown(g);
+    return 0;
+}
+
+__cilkrts_instance *__cilkrts_find_instance(const char *name) {
+    if (!name)
+        return NULL;
+    pthread_mutex_lock(&instances_lock);
+    global_state *g = instances;
+    while (g && strcmp(g->name, name) != 0)
+        g = g->next_instance;
+    pthread_mutex_unlock(&instances_lock);
+    return (__cilkrts_instance *)g;
+}
+
+__cilkrts_instance *__cilkrts_use_instance(__cilkrts_instance *instance) {
+    global_state *prev = thread_instance;
+    thread_instance = (global_state *)instance;
+    return (__cilkrts_instance *)prev;
+}
+
+int __cilkrts_warmup(unsigned nfibers, size_t closure_bytes) {
+    if (!__cilkrts_need_to_cilkify)
+        return -1;
+    return instance_warmup(cilkrts_target_instance(), nfibers, closure_bytes);
+}
+
+int __cilkrts_set_instance_nworkers(__cilkrts_instance *instance,
+                                    unsigned nworkers) {
+    global_state *g = (global_state *)instance;
+    if (!g || g->workers_started || nworkers == 0 ||
+        nworkers > g->options.nproc)
+        return -1;
+    set_nworkers(g, nworkers);
+    return 0;
+}
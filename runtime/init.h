@@ -7,6 +7,10 @@
 void __cilkrts_internal_invoke_cilkified_root(__cilkrts_stack_frame *sf);
 void __cilkrts_internal_exit_cilkified_root(global_state *g, __cilkrts_stack_frame *sf);
 
+// Number of workers of the instance that a region started by this thread would
+// run on.
+unsigned __cilkrts_internal_target_nworkers(void);
+
 // Used by Cilksan to set nworkers to 1 and force reduction
 void __cilkrts_internal_set_nworkers(unsigned int nworkers);
 
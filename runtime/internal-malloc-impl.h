@@ -1,25 +1,42 @@
 #ifndef _INTERAL_MALLOC_IMPL_H
 #define _INTERAL_MALLOC_IMPL_H
 
+#include <stdbool.h>
+#include <stdatomic.h> /* must follow stdbool.h */
+
 #include "debug.h"
+#include "mutex.h"
 #include "rts-config.h"
 
 #include "internal-malloc.h"
 
 #define NUM_BUCKETS 7
+#define MIN_BUCKET_SHIFT 5 // bucket i holds blocks of 1 << (i + 5) bytes
 
-/* struct for managing global memory pool; each memory block in mem_list starts
-   out with size INTERNAL_MALLOC_CHUNK.  We will allocate small pieces off the
-   memory block and free the pieces into per-worker im_descriptor free list. */
+/* Registry of the chunks of memory obtained from the system.  Each chunk is
+   INTERNAL_MALLOC_CHUNK_SIZE bytes, aligned to its size, and is carved into
+   blocks of a single bucket by the worker that allocated it, without locking.
+   The global im_lock only protects mem_list, which changes when a chunk is
+   allocated or returned to the system. */
 struct global_im_pool {
-    char *mem_begin; // beginning of the free memory block that we are using
-    char *mem_end;   // end of the free memory block that we are using
-    char **mem_list; // list of memory blocks obtained from system
-    unsigned mem_list_index; // index to the current mem block in use
-    unsigned mem_list_size;  // length of the mem_list
-    size_t num_global_malloc;
-    size_t allocated; // bytes allocated into the pool
-    size_t wasted;    // bytes at the end of a chunk that could not be used
+    struct im_chunk **mem_list; // chunks obtained from the system
+    unsigned mem_list_count;    // number of chunks in mem_list
+    unsigned mem_list_size;     // length of the mem_list
+    size_t allocated;           // bytes allocated from the system
+    size_t released;            // bytes returned to the system
+};
+
+/* Header at the beginning of each chunk. */
+struct im_chunk {
+    unsigned int index;    // in the mem_list of the global pool
+    unsigned int bucket;   // bucket of the blocks in the chunk
+    unsigned int capacity; // number of blocks in the chunk
+    // Scratch space for releasing idle chunks, see im_release_idle_chunks.
+    unsigned int found;
+    bool releasing;
+    // Blocks of the chunk in shared free lists.  When it reaches capacity,
+    // the chunk may be idle.
+    _Atomic unsigned int shared;
 };
 
 struct im_bucket {
@@ -27,18 +44,71 @@ struct im_bucket {
     unsigned free_list_size;  // Current size of free list
     unsigned free_list_limit; // Maximum allowed size of free list
     // Allocation count and wasted space on a worker may be negative
-    // if it frees blocks allocated elsewhere.  In a global bucket
-    // these fields should never be negative.
+    // if it frees blocks allocated elsewhere.
     int allocated;     // Current allocations, in use or free
     int max_allocated; // high watermark of allocated
     long wasted;       // in bytes
+    char *mem_begin;   // unused part of the chunk this worker is carving
+    char *mem_end;
 };
 
-/* One of these per worker, and one global */
+/* One of these per worker, and one global for memory freed after the workers
+   have terminated. */
 struct cilk_im_desc {
     struct im_bucket buckets[NUM_BUCKETS];
     long used; // local alloc - local free, may be negative
     long num_malloc[IM_NUM_TAGS];
+    // Allocations and bytes allocated, including from slabs, for stats.
+    size_t tag_allocs[IM_NUM_TAGS];
+    size_t tag_bytes[IM_NUM_TAGS];
+};
+
+/* A batch of free blocks of one bucket in a shared free list.  The header is
+   in the first block of the batch, whose next field links the blocks of the
+   batch as in a per-worker free list. */
+struct im_batch {
+    void *next;
+    struct im_batch *next_batch; // next batch in the shared free list
+    unsigned int count;          // number of blocks in the batch
+};
+
+/* Shared free lists of one tier, global or per NUMA node, between the
+   per-worker free lists.  Each is a lock-free stack of batches.  Workers push
+   whole batches, and take the whole stack with an atomic exchange, which
+   avoids the ABA problem, then push back the batches they do not need. */
+struct im_depot {
+    _Atomic(struct im_batch *) batches[NUM_BUCKETS];
+    _Atomic unsigned int nfree[NUM_BUCKETS]; // blocks in batches
+    // Fewest blocks in batches since the start of the current release
+    // interval, and the time in nanoseconds at which it started.
+    _Atomic unsigned int low_water[NUM_BUCKETS];
+    _Atomic uint64_t interval_start[NUM_BUCKETS];
+};
+
+/* Header of a slab of fixed-size slots, in the first slot of a block aligned
+   to its size.  Closures and small reducer views come from such slabs. */
+struct slab {
+    struct slab_cache *owner; // cache of the worker that owns the slab
+    struct slab *next;        // in the list of all such slabs of an instance
 };
 
+/* One of these per worker and kind of slab.  Slots freed by the owning worker
+   go on its free list.  Slots freed by other workers go on its remote-free
+   list, which the owner takes over all at once when its free list is
+   empty. */
+struct slab_cache {
+    void *free_list;
+    char *slab_begin; // unused part of the worker's newest slab
+    char *slab_end;
+    unsigned int nslabs;
+    _Atomic(void *) remote_free __attribute__((aligned(CILK_CACHE_LINE)));
+};
+
+/* Shared free lists for the workers on one NUMA node, instead of the global
+   ones.  Memory freed by a worker goes to the free lists of its own node,
+   regardless of where it was allocated. */
+struct cilk_im_node {
+    struct im_depot depot;
+} __attribute__((aligned(CILK_CACHE_LINE)));
+
 #endif /* _INTERAL_MALLOC_IMPL_H */
@@ -3,24 +3,27 @@
 #include <stdlib.h>
 #include <strings.h> /* ffs */
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h> /* sysconf */
 
 #include "cilk-internal.h"
+#include "closure-type.h"
 #include "debug.h"
 #include "global.h"
 #include "local.h"
+#include "worker_coord.h"
 
 CHEETAH_INTERNAL int cheetah_page_shift = 0;
 
 #define MEM_LIST_SIZE 8U
 #define INTERNAL_MALLOC_CHUNK_SIZE (32 * 1024)
-#define SIZE_THRESH bucket_sizes[NUM_BUCKETS - 1]
+#define IM_CHUNK_HEADER (1U << MIN_BUCKET_SHIFT) // bytes for struct im_chunk
+#define IM_BLOCK_ALIGN 64 // blocks of at least this size are aligned to it
+#define SIZE_THRESH bucket_to_size(NUM_BUCKETS - 1)
+#define IM_DEPOT_RETRIES 16
 
-/* TODO: Use sizeof(fiber), sizeof(closure), etc. */
 /* NOTE: Allocator does not currently work with non-power-of-2 bucket sizes in
  * the mix. */
-static const unsigned int bucket_sizes[NUM_BUCKETS] = {32,  64,   128, 256,
-                                                       512, 1024, 2048};
 static const unsigned int bucket_capacity[NUM_BUCKETS] = {
     256, /*   32 bytes a piece; 2 pages */
     128, /*   64 bytes a piece; 2 pages */
@@ -31,6 +34,14 @@ static const unsigned int bucket_capacity[NUM_BUCKETS] = {
     8    /* 2048 bytes a piece; 4 pages */
 };
 
+_Static_assert((INTERNAL_MALLOC_CHUNK_SIZE &
+                (INTERNAL_MALLOC_CHUNK_SIZE - 1)) == 0,
+               "INTERNAL_MALLOC_CHUNK_SIZE must be a power of 2");
+_Static_assert(sizeof(struct im_chunk) <= IM_CHUNK_HEADER,
+               "chunk header does not fit in the smallest block");
+_Static_assert(sizeof(struct im_batch) <= IM_CHUNK_HEADER,
+               "batch header does not fit in the smallest block");
+
 struct free_block {
     void *next;
 };
@@ -45,18 +56,35 @@ static inline int is_page_aligned(size_t size) {
 }
 
 static inline unsigned int size_to_bucket(size_t size) {
-    /* TODO: If sizes are powers of 2 use ffs() */
-    for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
-        if (size <= bucket_sizes[i]) {
-            return i;
-        }
-    }
-    return -1; /* = infinity */
+    if (size <= (1U << MIN_BUCKET_SHIFT))
+        return 0;
+    // Round up to a power of 2: the bucket is ceil(log2(size)) - 5.
+    unsigned int lg = 8 * sizeof(unsigned long) - __builtin_clzl(size - 1);
+    unsigned int which_bucket = lg - MIN_BUCKET_SHIFT;
+    return which_bucket < NUM_BUCKETS ? which_bucket : -1; /* = infinity */
 }
 
 static inline unsigned int bucket_to_size(int which_bucket) {
-    /* TODO: 1U << (which_bucket + 5) */
-    return bucket_sizes[which_bucket];
+    return 1U << (which_bucket + MIN_BUCKET_SHIFT);
+}
+
+// Offset of the first block in a chunk of bucket which_bucket.  It aligns the
+// blocks to their size, up to IM_BLOCK_ALIGN, so that they suit any type of
+// their size and blocks of IM_BLOCK_ALIGN bytes or more share no cache lines.
+static inline unsigned int bucket_to_chunk_offset(int which_bucket) {
+    unsigned int size = bucket_to_size(which_bucket);
+    unsigned int align = size < IM_BLOCK_ALIGN ? size : IM_BLOCK_ALIGN;
+    return align > IM_CHUNK_HEADER ? align : IM_CHUNK_HEADER;
+}
+
+static inline unsigned int bucket_to_chunk_capacity(int which_bucket) {
+    return (INTERNAL_MALLOC_CHUNK_SIZE - bucket_to_chunk_offset(which_bucket)) >>
+           (which_bucket + MIN_BUCKET_SHIFT);
+}
+
+static inline struct im_chunk *chunk_of(void *p) {
+    return (struct im_chunk *)((uintptr_t)p &
+                               ~(uintptr_t)(INTERNAL_MALLOC_CHUNK_SIZE - 1));
 }
 
 static void add_to_free_list(struct im_bucket *bucket, void *p) {
@@ -84,10 +112,30 @@ static void init_im_buckets(struct cilk_im_desc *im_desc) {
         bucket->allocated = 0;
         bucket->max_allocated = 0;
         bucket->wasted = 0;
+        bucket->mem_begin = bucket->mem_end = NULL;
     }
     im_desc->used = 0;
-    for (int j = 0; j < IM_NUM_TAGS; ++j)
+    for (int j = 0; j < IM_NUM_TAGS; ++j) {
         im_desc->num_malloc[j] = 0;
+        im_desc->tag_allocs[j] = 0;
+        im_desc->tag_bytes[j] = 0;
+    }
+}
+
+static inline void count_tag(struct cilk_im_desc *im_desc, size_t size,
+                             enum im_tag tag) {
+    im_desc->tag_allocs[tag]++;
+    im_desc->tag_bytes[tag] += size;
+}
+
+static void init_im_depot(struct im_depot *depot) {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        atomic_store_explicit(&depot->batches[i], NULL, memory_order_relaxed);
+        atomic_store_explicit(&depot->nfree[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&depot->low_water[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&depot->interval_start[i], 0,
+                              memory_order_relaxed);
+    }
 }
 
 //=========================================================
@@ -100,16 +148,27 @@ static void dump_buckets(FILE *out, struct cilk_im_desc *d) {
         struct im_bucket *b = &d->buckets[i];
         if (!b->free_list && !b->free_list_size && !b->allocated)
             continue;
-        fprintf(out, "  [%u] %d allocated (%d max, %zd wasted), %u free\n",
+        fprintf(out,
+                "  [%u] %d allocated (%d max, %zd wasted), %u free, "
+                "%td to carve\n",
                 bucket_to_size(i), b->allocated, b->max_allocated, b->wasted,
-                b->free_list_size);
+                b->free_list_size, b->mem_end - b->mem_begin);
+    }
+}
+
+static void dump_depot(FILE *out, struct im_depot *depot) {
+    for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
+        unsigned int nfree =
+            atomic_load_explicit(&depot->nfree[i], memory_order_relaxed);
+        if (nfree)
+            fprintf(out, "  [%u] %u free\n", bucket_to_size(i), nfree);
     }
 }
 
 static size_t free_bytes(struct cilk_im_desc *desc) {
     size_t free = 0;
     for (unsigned i = 0; i < NUM_BUCKETS; ++i)
-        free += (size_t)desc->buckets[i].free_list_size * bucket_sizes[i];
+        free += (size_t)desc->buckets[i].free_list_size * bucket_to_size(i);
     return free;
 }
 
@@ -120,6 +179,43 @@ static long wasted_bytes(struct cilk_im_desc *desc) {
     return wasted;
 }
 
+static size_t uncarved_bytes(struct cilk_im_desc *desc) {
+    size_t uncarved = 0;
+    for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+        uncarved += desc->buckets[i].mem_end - desc->buckets[i].mem_begin;
+    return uncarved;
+}
+
+/* Bytes in the shared free lists of depot, counted by walking them.  Only
+   accurate while no worker is running. */
+static size_t depot_bytes(struct im_depot *depot) {
+    size_t free = 0;
+    for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
+        struct im_batch *batch =
+            atomic_load_explicit(&depot->batches[i], memory_order_acquire);
+        for (; batch; batch = batch->next_batch)
+            free += (size_t)batch->count * bucket_to_size(i);
+    }
+    return free;
+}
+
+/* Totals over the chunks of internal malloc. */
+struct im_chunk_totals {
+    size_t usable; // bytes in blocks
+    size_t wasted; // bytes in chunk headers and ends that cannot hold a block
+};
+
+static struct im_chunk_totals chunk_totals(global_state *g) {
+    struct im_chunk_totals totals = {0, 0};
+    for (unsigned int i = 0; i < g->im_pool.mem_list_count; ++i) {
+        struct im_chunk *chunk = g->im_pool.mem_list[i];
+        size_t usable = (size_t)chunk->capacity * bucket_to_size(chunk->bucket);
+        totals.usable += usable;
+        totals.wasted += INTERNAL_MALLOC_CHUNK_SIZE - usable;
+    }
+    return totals;
+}
+
 static size_t workers_used_and_free(global_state *g) {
     size_t worker_free = 0;
     long worker_used = 0, worker_wasted = 0;
@@ -128,7 +224,7 @@ static size_t workers_used_and_free(global_state *g) {
         if (!w)
             continue; /* starting up or shutting down */
         local_state *l = w->l;
-        worker_free += free_bytes(&l->im_desc);
+        worker_free += free_bytes(&l->im_desc) + uncarved_bytes(&l->im_desc);
         worker_used += l->im_desc.used;
         worker_wasted += wasted_bytes(&l->im_desc);
     }
@@ -140,16 +236,16 @@ CHEETAH_INTERNAL
 void dump_memory_state(FILE *out, global_state *g) {
     if (out == NULL)
         out = stderr;
-    size_t global_free = free_bytes(&g->im_desc);
-    ptrdiff_t available =
-        (char *)g->im_pool.mem_end - (char *)g->im_pool.mem_begin;
     fprintf(out,
-            "Global memory:\n  %zu allocated in %u blocks (%zu wasted)\n"
-            "  %zd used + %tu available + %zu free = %zu\n",
-            g->im_pool.allocated, g->im_pool.mem_list_index + 1,
-            g->im_pool.wasted, g->im_desc.used, available, global_free,
-            g->im_desc.used + available + global_free);
-    dump_buckets(out, &g->im_desc);
+            "Global memory:\n  %zu allocated in %u chunks, %zu released\n"
+            "  %zd used after workers terminated\n",
+            g->im_pool.allocated, g->im_pool.mem_list_count,
+            g->im_pool.released, g->im_desc.used);
+    dump_depot(out, &g->im_depot);
+    for (unsigned int i = 0; i < g->nnodes; i++) {
+        fprintf(out, "Node %u:\n", i);
+        dump_depot(out, &g->im_nodes[i].depot);
+    }
     for (unsigned int i = 0; i < g->nworkers; i++) {
         __cilkrts_worker *w = g->workers[i];
         if (!w || !w->l)
@@ -163,10 +259,6 @@ void dump_memory_state_stderr(global_state *g) { dump_memory_state(stderr, g); }
 
 CHEETAH_INTERNAL
 void internal_malloc_global_check(global_state *g) {
-    /* TODO: Test should be
-       global used = worker used + free
-       global used + global free = allocated. */
-
     struct cilk_im_desc *d = &(g->im_desc);
 
     size_t total_malloc[IM_NUM_TAGS];
@@ -182,31 +274,29 @@ void internal_malloc_global_check(global_state *g) {
             total_malloc[i] += l->im_desc.num_malloc[i];
     }
 
-    size_t allocated = g->im_pool.allocated;
-    CILK_ASSERT(g->im_desc.used >= 0);
-    size_t global_used = g->im_desc.used;
-    size_t global_free = free_bytes(&g->im_desc);
+    // Every byte of every block is either in a shared free list, used after
+    // the workers terminated, or accounted for by some worker.
+    size_t allocated = chunk_totals(g).usable;
+    size_t shared_free = depot_bytes(&g->im_depot);
+    for (unsigned int i = 0; i < g->nnodes; ++i)
+        shared_free += depot_bytes(&g->im_nodes[i].depot);
+    long global_used = g->im_desc.used;
     size_t worker_total = workers_used_and_free(g);
-    size_t global_available =
-        (char *)g->im_pool.mem_end - (char *)g->im_pool.mem_begin;
 
-    if (global_used != worker_total ||
-        global_used + global_free + global_available != allocated)
+    if (shared_free + global_used + worker_total != allocated)
         dump_memory_state(stderr, g);
 
-    CILK_CHECK(g,
-               global_used + global_free + global_available == allocated &&
-                   global_used == worker_total,
-               "Possible memory leak: %zu+%zu+%zu global used+free+available, "
-               "%zu allocated, %zu in workers",
-               global_used, global_free, global_available, allocated,
-               worker_total);
+    CILK_CHECK(g, shared_free + global_used + worker_total == allocated,
+               "Possible memory leak: %zu+%ld+%zu shared free+global "
+               "used+in workers, %zu allocated",
+               shared_free, global_used, worker_total, allocated);
 }
 
 static void assert_global_pool(struct global_im_pool *pool) {
-    CILK_ASSERT(pool->mem_list_index < pool->mem_list_size);
-    if (pool->wasted > 0)
-        CILK_ASSERT(pool->wasted < pool->allocated);
+    CILK_ASSERT(pool->mem_list_count <= pool->mem_list_size);
+    CILK_ASSERT(pool->allocated ==
+                (size_t)pool->mem_list_count * INTERNAL_MALLOC_CHUNK_SIZE +
+                    pool->released);
 }
 
 static void assert_bucket(struct im_bucket *bucket) {
@@ -229,7 +319,8 @@ static void print_worker_buckets_free(__cilkrts_worker *w, void *data) {
     fprintf(fp, WORKER_HDR_DESC, "Worker", w->self);
     for (unsigned int j = 0; j < NUM_BUCKETS; j++) {
         fprintf(fp, FIELD_DESC,
-                (size_t)l->im_desc.buckets[j].free_list_size * bucket_sizes[j]);
+                (size_t)l->im_desc.buckets[j].free_list_size *
+                    bucket_to_size(j));
     }
     fprintf(fp, "\n");
 }
@@ -240,32 +331,43 @@ static void print_worker_buckets_hwm(__cilkrts_worker *w, void *data) {
     fprintf(fp, WORKER_HDR_DESC, "Worker", w->self);
     for (unsigned int j = 0; j < NUM_BUCKETS; j++) {
         fprintf(fp, FIELD_DESC,
-                (size_t)l->im_desc.buckets[j].max_allocated * bucket_sizes[j]);
+                (size_t)l->im_desc.buckets[j].max_allocated *
+                    bucket_to_size(j));
     }
     fprintf(fp, "\n");
 }
 
+static void print_depot_free(struct im_depot *depot) {
+    for (unsigned int j = 0; j < NUM_BUCKETS; j++) {
+        fprintf(stderr, FIELD_DESC,
+                (size_t)atomic_load_explicit(&depot->nfree[j],
+                                             memory_order_relaxed) *
+                    bucket_to_size(j));
+    }
+    fprintf(stderr, "\n");
+}
+
 static void print_im_buckets_stats(struct global_state *g) {
     fprintf(stderr, "\nBYTES IN FREE LISTS:\n");
     fprintf(stderr, HDR_DESC, "Bucket size:");
     for (int j = 0; j < NUM_BUCKETS; j++) {
-        fprintf(stderr, FIELD_DESC, (size_t)bucket_sizes[j]);
+        fprintf(stderr, FIELD_DESC, (size_t)bucket_to_size(j));
     }
     fprintf(stderr, "\n-------------------------------------------"
                     "---------------------------------------------\n");
 
     fprintf(stderr, HDR_DESC, "Global:");
-    for (unsigned int j = 0; j < NUM_BUCKETS; j++) {
-        fprintf(stderr, FIELD_DESC,
-                (size_t)g->im_desc.buckets[j].free_list_size * bucket_sizes[j]);
+    print_depot_free(&g->im_depot);
+    for (unsigned int i = 0; i < g->nnodes; i++) {
+        fprintf(stderr, WORKER_HDR_DESC, "Node", i);
+        print_depot_free(&g->im_nodes[i].depot);
     }
-    fprintf(stderr, "\n");
     for_each_worker(g, &print_worker_buckets_free, stderr);
 
     fprintf(stderr, "\nHIGH WATERMARK FOR BYTES ALLOCATED:\n");
     fprintf(stderr, HDR_DESC, "Bucket size:");
     for (int j = 0; j < NUM_BUCKETS; j++) {
-        fprintf(stderr, FIELD_DESC, (size_t)bucket_sizes[j]);
+        fprintf(stderr, FIELD_DESC, (size_t)bucket_to_size(j));
     }
     fprintf(stderr, "\n-------------------------------------------"
                     "---------------------------------------------\n");
@@ -274,16 +376,38 @@ static void print_im_buckets_stats(struct global_state *g) {
     fprintf(stderr, "\n");
 }
 
+static void print_im_tag_stats(struct global_state *g) {
+    fprintf(stderr, "\nALLOCATIONS BY TAG:\n");
+    fprintf(stderr, HDR_DESC "%10s %10s\n", "Tag:", "count", "KBytes");
+    for (int i = 0; i < IM_NUM_TAGS; ++i) {
+        size_t allocs = g->im_desc.tag_allocs[i];
+        size_t bytes = g->im_desc.tag_bytes[i];
+        for (unsigned int j = 0; j < g->nworkers; j++) {
+            __cilkrts_worker *w = g->workers[j];
+            if (!w || !w->l)
+                continue;
+            allocs += w->l->im_desc.tag_allocs[i];
+            bytes += w->l->im_desc.tag_bytes[i];
+        }
+        fprintf(stderr, HDR_DESC FIELD_DESC " " FIELD_DESC "\n",
+                name_for_im_tag(i), allocs, bytes / 1024);
+    }
+}
+
 static void print_internal_malloc_stats(struct global_state *g) {
     unsigned page_size = 1U << cheetah_page_shift;
+    struct im_chunk_totals totals = chunk_totals(g);
     fprintf(stderr, "\nINTERNAL MALLOC STATS\n");
     fprintf(stderr,
             "Total bytes allocated from system: %7zu KBytes (%zu pages)\n",
             g->im_pool.allocated / 1024,
             (g->im_pool.allocated + page_size - 1) / page_size);
+    fprintf(stderr, "Total bytes returned to system:    %7zu KBytes\n",
+            g->im_pool.released / 1024);
     fprintf(stderr, "Total bytes allocated but wasted:  %7zu KBytes\n",
-            g->im_pool.wasted / 1024);
+            totals.wasted / 1024);
     print_im_buckets_stats(g);
+    print_im_tag_stats(g);
     fprintf(stderr, "\n");
 }
 
@@ -297,7 +421,9 @@ static char *malloc_from_system(__cilkrts_worker *w, size_t size) {
         mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
                    -1, 0);
     } else {
-        mem = malloc(size);
+        // Align like the blocks of the buckets.
+        mem = cilk_aligned_alloc(IM_BLOCK_ALIGN,
+                                 round_size_to_alignment(IM_BLOCK_ALIGN, size));
     }
     CILK_CHECK(w->g, mem, "Internal malloc failed to allocate %zu bytes", size);
     return mem;
@@ -312,82 +438,459 @@ static void free_to_system(void *p, size_t size) {
 }
 
 /**
- * Extend the global im pool.  This function is only called when the
- * current chunk in use is not big enough to satisfy an allocation.
- * The size is already canonicalized at this point.
+ * Allocate a chunk for blocks of bucket 'which_bucket' from the system and add
+ * it to the global list of chunks.
  */
-static void extend_global_pool(__cilkrts_worker *w) {
-
-    struct global_im_pool *im_pool = &(w->g->im_pool);
-    im_pool->mem_begin = malloc_from_system(w, INTERNAL_MALLOC_CHUNK_SIZE);
-    im_pool->mem_end = im_pool->mem_begin + INTERNAL_MALLOC_CHUNK_SIZE;
-    im_pool->allocated += INTERNAL_MALLOC_CHUNK_SIZE;
-    im_pool->mem_list_index++;
-
-    if (im_pool->mem_list_index >= im_pool->mem_list_size) {
+static struct im_chunk *im_chunk_alloc(__cilkrts_worker *w,
+                                       unsigned int which_bucket) {
+    global_state *g = w->g;
+    struct global_im_pool *im_pool = &g->im_pool;
+
+    // Map twice the size and unmap the ends to align the chunk to its size.
+    size_t len = 2 * INTERNAL_MALLOC_CHUNK_SIZE;
+    char *mem = mmap(0, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CILK_CHECK(g, mem != MAP_FAILED,
+               "Internal malloc failed to allocate %zu bytes", len);
+    char *begin = (char *)(((uintptr_t)mem + INTERNAL_MALLOC_CHUNK_SIZE - 1) &
+                           ~(uintptr_t)(INTERNAL_MALLOC_CHUNK_SIZE - 1));
+    char *end = begin + INTERNAL_MALLOC_CHUNK_SIZE;
+    if (begin > mem)
+        munmap(mem, begin - mem);
+    if (end < mem + len)
+        munmap(end, mem + len - end);
+
+    struct im_chunk *chunk = (struct im_chunk *)begin;
+    chunk->bucket = which_bucket;
+    chunk->capacity = bucket_to_chunk_capacity(which_bucket);
+    chunk->found = 0;
+    chunk->releasing = false;
+    atomic_store_explicit(&chunk->shared, 0, memory_order_relaxed);
+
+    cilk_mutex_lock(&g->im_lock);
+    if (im_pool->mem_list_count >= im_pool->mem_list_size) {
         CILK_ASSERT(im_pool->mem_list_size > 0);
         size_t new_list_size = 2 * im_pool->mem_list_size;
         im_pool->mem_list = realloc(im_pool->mem_list,
                                     new_list_size * sizeof(*im_pool->mem_list));
-        for (size_t i = im_pool->mem_list_size; i < new_list_size; ++i) {
-            im_pool->mem_list[i] = 0;
-        }
+        CILK_CHECK(g, im_pool->mem_list,
+                   "Failed to extend global memory list to %zu bytes",
+                   new_list_size * sizeof(*im_pool->mem_list));
         im_pool->mem_list_size = new_list_size;
-        CILK_CHECK(w->g, im_pool->mem_list,
-                   "Failed to extend global memory list by %zu bytes",
-                   MEM_LIST_SIZE * sizeof(*im_pool->mem_list));
     }
-    im_pool->mem_list[im_pool->mem_list_index] = im_pool->mem_begin;
+    chunk->index = im_pool->mem_list_count++;
+    im_pool->mem_list[chunk->index] = chunk;
+    im_pool->allocated += INTERNAL_MALLOC_CHUNK_SIZE;
+    cilk_mutex_unlock(&g->im_lock);
+    return chunk;
+}
+
+/* Remove an idle chunk from the global list and return it to the system. */
+static void im_chunk_free(global_state *g, struct im_chunk *chunk) {
+    struct global_im_pool *im_pool = &g->im_pool;
+    cilk_mutex_lock(&g->im_lock);
+    CILK_ASSERT(im_pool->mem_list[chunk->index] == chunk);
+    struct im_chunk *last = im_pool->mem_list[--im_pool->mem_list_count];
+    im_pool->mem_list[chunk->index] = last;
+    last->index = chunk->index;
+    im_pool->released += INTERNAL_MALLOC_CHUNK_SIZE;
+    cilk_mutex_unlock(&g->im_lock);
+    munmap(chunk, INTERNAL_MALLOC_CHUNK_SIZE);
 }
 
 /**
- * Allocate a piece of memory of 'size' from global im bucket 'bucket'.
- * The free_list is last-in-first-out.
- * The size is already canonicalized at this point.
+ * Carve n blocks of bucket 'which_bucket' out of the chunk that the worker is
+ * carving onto its free list, starting new chunks as needed.  This needs no
+ * locking, except to register a new chunk.
  */
-static void *global_im_alloc(__cilkrts_worker *w, size_t size,
-                             unsigned int which_bucket) {
-    global_state *g = w->g;
-    CILK_ASSERT(g);
-    CILK_ASSERT(size <= SIZE_THRESH);
-    CILK_ASSERT(which_bucket < NUM_BUCKETS);
+static void im_carve_batch(__cilkrts_worker *w, struct im_bucket *bucket,
+                           unsigned int which_bucket, unsigned int n) {
+    size_t size = bucket_to_size(which_bucket);
+    for (unsigned int i = 0; i < n; i++) {
+        if (bucket->mem_begin == bucket->mem_end) {
+            struct im_chunk *chunk = im_chunk_alloc(w, which_bucket);
+            bucket->mem_begin =
+                (char *)chunk + bucket_to_chunk_offset(which_bucket);
+            bucket->mem_end = bucket->mem_begin + chunk->capacity * size;
+        }
+        add_to_free_list(bucket, bucket->mem_begin);
+        bucket->mem_begin += size;
+    }
+}
 
-    struct im_bucket *bucket = &(g->im_desc.buckets[which_bucket]);
-    struct cilk_im_desc *im_desc = &(g->im_desc);
-    im_desc->used += size;
-    /* ??? count calls to this function? */
+/* Push the batches from first to last onto the shared free list of bucket
+   'which_bucket' in depot. */
+static void im_depot_push(struct im_depot *depot, unsigned int which_bucket,
+                          struct im_batch *first, struct im_batch *last) {
+    _Atomic(struct im_batch *) *list = &depot->batches[which_bucket];
+    struct im_batch *head = atomic_load_explicit(list, memory_order_relaxed);
+    do {
+        last->next_batch = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        list, &head, first, memory_order_release, memory_order_relaxed));
+}
 
-    void *mem = remove_from_free_list(bucket);
-    if (!mem) {
-        struct global_im_pool *im_pool = &(g->im_pool);
-        // allocate from the global pool
-        if ((im_pool->mem_begin + size) > im_pool->mem_end) {
-            // consider the left over as waste for now
-            // TODO: Adding it to a random free list would be better.
-            im_pool->wasted += im_pool->mem_end - im_pool->mem_begin;
-            extend_global_pool(w);
-        }
-        mem = im_pool->mem_begin;
-        im_pool->mem_begin += size;
+/* Lower the low-water mark of bucket 'which_bucket' in depot to nfree.  Races
+   between workers only make the mark approximate. */
+static inline void im_note_low_water(struct im_depot *depot,
+                                     unsigned int which_bucket,
+                                     unsigned int nfree) {
+    if (nfree <
+        atomic_load_explicit(&depot->low_water[which_bucket], memory_order_relaxed))
+        atomic_store_explicit(&depot->low_water[which_bucket], nfree,
+                              memory_order_relaxed);
+}
+
+static inline uint64_t im_time_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static inline struct im_batch *im_depot_grab(struct im_depot *depot,
+                                             unsigned int which_bucket) {
+    _Atomic(struct im_batch *) *list = &depot->batches[which_bucket];
+    if (!atomic_load_explicit(list, memory_order_relaxed))
+        return NULL;
+    return atomic_exchange_explicit(list, NULL, memory_order_acquire);
+}
+
+/**
+ * Take one batch of bucket 'which_bucket' from depot, or return NULL if there
+ * are no free blocks.  Another worker may have briefly taken the whole list to
+ * remove one batch, so retry a few times while the depot has free blocks.
+ */
+static struct im_batch *im_depot_take(struct im_depot *depot,
+                                      unsigned int which_bucket) {
+    struct im_batch *batch = im_depot_grab(depot, which_bucket);
+    for (int i = 0;
+         !batch && i < IM_DEPOT_RETRIES &&
+         atomic_load_explicit(&depot->nfree[which_bucket],
+                              memory_order_relaxed) > 0;
+         ++i) {
+        busy_loop_pause();
+        batch = im_depot_grab(depot, which_bucket);
+    }
+    if (!batch)
+        return NULL;
+    struct im_batch *rest = batch->next_batch;
+    if (rest) {
+        struct im_batch *last = rest;
+        while (last->next_batch)
+            last = last->next_batch;
+        im_depot_push(depot, which_bucket, rest, last);
     }
+    unsigned int nfree = atomic_fetch_sub_explicit(&depot->nfree[which_bucket],
+                                                   batch->count,
+                                                   memory_order_relaxed) -
+                         batch->count;
+    im_note_low_water(depot, which_bucket, nfree);
+    return batch;
+}
 
-    return mem;
+/**
+ * Return to the system the chunks of bucket 'which_bucket' whose blocks are
+ * all in the shared free lists of depot, once per INTERNAL_MALLOC_RELEASE_NSEC
+ * interval.  Only as many blocks are released as stayed in the free lists for
+ * the whole interval, beyond INTERNAL_MALLOC_RETAIN_CHUNKS chunks' worth, so
+ * that a load that rises and falls within an interval keeps its chunks rather
+ * than unmapping and mapping them again.  A chunk whose blocks are spread over
+ * the free lists of several depots is not released.  Only one worker releases
+ * chunks at a time; the others skip it.
+ */
+static void im_release_idle_chunks(global_state *g, struct im_depot *depot,
+                                   unsigned int which_bucket) {
+    unsigned int capacity = bucket_to_chunk_capacity(which_bucket);
+    unsigned int retain = INTERNAL_MALLOC_RETAIN_CHUNKS * capacity;
+    unsigned int nfree =
+        atomic_load_explicit(&depot->nfree[which_bucket], memory_order_relaxed);
+    if (nfree < retain + capacity)
+        return;
+
+    // End the current interval and start the next one.
+    uint64_t now = im_time_nsec();
+    uint64_t start = atomic_load_explicit(&depot->interval_start[which_bucket],
+                                          memory_order_relaxed);
+    if (now - start < INTERNAL_MALLOC_RELEASE_NSEC ||
+        !atomic_compare_exchange_strong_explicit(
+            &depot->interval_start[which_bucket], &start, now,
+            memory_order_relaxed, memory_order_relaxed))
+        return;
+    unsigned int low_water = atomic_exchange_explicit(
+        &depot->low_water[which_bucket], nfree, memory_order_relaxed);
+    if (low_water < retain + capacity)
+        return;
+    if (atomic_exchange_explicit(&g->im_releasing, true, memory_order_acquire))
+        return;
+
+    struct im_batch *list = im_depot_grab(depot, which_bucket);
+    // This worker now owns all blocks in list.  Count the blocks of each of
+    // their chunks, to find the chunks whose blocks are all in the list.
+    unsigned int total = 0;
+    for (struct im_batch *batch = list; batch; batch = batch->next_batch)
+        for (struct free_block *p = (struct free_block *)batch; p; p = p->next)
+            chunk_of(p)->found = 0;
+    for (struct im_batch *batch = list; batch; batch = batch->next_batch)
+        for (struct free_block *p = (struct free_block *)batch; p; p = p->next) {
+            struct im_chunk *chunk = chunk_of(p);
+            chunk->found++;
+            chunk->releasing = false;
+            total++;
+        }
+
+    // Release idle chunks and collect the other blocks into new batches.
+    unsigned int batch_size = bucket_capacity[which_bucket] / 2;
+    long budget = (long)(total < low_water ? total : low_water) - (long)retain;
+    unsigned int released = 0;
+    struct im_batch *first = NULL, *last = NULL, *batch = list;
+    while (batch) {
+        struct im_batch *next_batch = batch->next_batch;
+        struct free_block *p = (struct free_block *)batch;
+        while (p) {
+            struct free_block *next = p->next;
+            struct im_chunk *chunk = chunk_of(p);
+            if (!chunk->releasing && chunk->found == capacity &&
+                budget >= capacity) {
+                chunk->releasing = true;
+                budget -= capacity;
+            }
+            if (chunk->releasing) {
+                released++;
+                if (--chunk->found == 0)
+                    im_chunk_free(g, chunk);
+            } else {
+                struct im_batch *b = (struct im_batch *)p;
+                if (first && first->count < batch_size) {
+                    b->next = first->next;
+                    first->next = b;
+                    first->count++;
+                } else {
+                    b->next = NULL;
+                    b->next_batch = first;
+                    b->count = 1;
+                    if (!first)
+                        last = b;
+                    first = b;
+                }
+            }
+            p = next;
+        }
+        batch = next_batch;
+    }
+    if (first)
+        im_depot_push(depot, which_bucket, first, last);
+    nfree = atomic_fetch_sub_explicit(&depot->nfree[which_bucket], released,
+                                      memory_order_relaxed) -
+            released;
+    im_note_low_water(depot, which_bucket, nfree);
+    atomic_store_explicit(&g->im_releasing, false, memory_order_release);
+    if (released)
+        cilkrts_alert(MEMORY, "(im_release_idle_chunks) %u chunks of %u bytes",
+                      released / capacity, bucket_to_size(which_bucket));
 }
 
 static void global_im_pool_destroy(struct global_im_pool *im_pool) {
-
-    for (unsigned i = 0; i < im_pool->mem_list_size; i++) {
-        void *mem = im_pool->mem_list[i];
-        free_to_system(mem, INTERNAL_MALLOC_CHUNK_SIZE);
+    for (unsigned i = 0; i < im_pool->mem_list_count; i++) {
+        munmap(im_pool->mem_list[i], INTERNAL_MALLOC_CHUNK_SIZE);
         im_pool->mem_list[i] = NULL;
     }
     free(im_pool->mem_list);
     im_pool->mem_list = NULL;
-    im_pool->mem_begin = im_pool->mem_end = NULL;
-    im_pool->mem_list_index = -1;
+    im_pool->mem_list_count = 0;
     im_pool->mem_list_size = 0;
 }
 
+static void global_im_pool_init(global_state *g,
+                                struct global_im_pool *im_pool) {
+    im_pool->mem_list_count = 0;
+    im_pool->mem_list_size = MEM_LIST_SIZE;
+    im_pool->mem_list = calloc(MEM_LIST_SIZE, sizeof(*im_pool->mem_list));
+    CILK_CHECK(g, im_pool->mem_list,
+               "Cannot allocate %u * %zu bytes for mem_list", MEM_LIST_SIZE,
+               sizeof(*im_pool->mem_list));
+    im_pool->allocated = 0;
+    im_pool->released = 0;
+}
+
+//=========================================================
+// Slab allocators for closures and small reducer views
+//=========================================================
+
+/* Closures and small reducer views have a size and alignment of their own and
+   are often freed by a different worker than the one that allocated them, so
+   they do not go through the buckets above.  Each worker carves them out of
+   its own slabs of fixed-size slots, one kind of slab for each, and every slot
+   returns to the worker that owns its slab, which needs neither locks nor
+   shared counters. */
+
+_Static_assert(CLOSURE_SLAB_SIZE >= 8 * sizeof(Closure),
+               "CLOSURE_SLAB_SIZE is too small");
+_Static_assert(sizeof(struct slab) <= sizeof(Closure),
+               "slab header does not fit in a closure slot");
+_Static_assert(VIEW_SLAB_SIZE >= 8 * VIEW_SLOT_SIZE,
+               "VIEW_SLAB_SIZE is too small");
+_Static_assert(sizeof(struct slab) <= VIEW_SLOT_SIZE,
+               "slab header does not fit in a view slot");
+
+struct slot_free {
+    struct slot_free *next;
+};
+
+static inline struct slab *slab_of(void *p, size_t slab_size) {
+    return (struct slab *)((uintptr_t)p & ~(uintptr_t)(slab_size - 1));
+}
+
+static void slab_cache_init(struct slab_cache *c) {
+    c->free_list = NULL;
+    c->slab_begin = c->slab_end = NULL;
+    c->nslabs = 0;
+    atomic_store_explicit(&c->remote_free, NULL, memory_order_relaxed);
+}
+
+static void slab_cache_new_slab(__cilkrts_worker *w, struct slab_cache *c,
+                                _Atomic(struct slab *) *slabs,
+                                size_t slab_size, size_t slot_size) {
+    struct slab *slab = (struct slab *)cilk_aligned_alloc(slab_size, slab_size);
+    CILK_CHECK(w->g, slab, "Cannot allocate a slab of %zu bytes", slab_size);
+    slab->owner = c;
+    slab->next = atomic_load_explicit(slabs, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+        slabs, &slab->next, slab, memory_order_release, memory_order_relaxed))
+        ;
+    c->slab_begin = (char *)slab + slot_size;
+    c->slab_end = (char *)slab + slab_size;
+    c->nslabs++;
+}
+
+static void slab_remote_free(struct slab_cache *owner, struct slot_free *f) {
+    f->next = atomic_load_explicit(&owner->remote_free, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+        &owner->remote_free, (void **)&f->next, f, memory_order_release,
+        memory_order_relaxed))
+        ;
+}
+
+static inline __attribute__((always_inline)) void *
+slab_cache_alloc(__cilkrts_worker *w, struct slab_cache *c,
+                 _Atomic(struct slab *) *slabs, size_t slab_size,
+                 size_t slot_size) {
+    struct slot_free *p = c->free_list;
+    if (!p) {
+        // Take back the slots that other workers have freed.
+        p = atomic_exchange_explicit(&c->remote_free, NULL,
+                                     memory_order_acquire);
+        if (!p) {
+            if (c->slab_end - c->slab_begin < (ptrdiff_t)slot_size)
+                slab_cache_new_slab(w, c, slabs, slab_size, slot_size);
+            void *mem = c->slab_begin;
+            c->slab_begin += slot_size;
+            return mem;
+        }
+    }
+    c->free_list = p->next;
+    return p;
+}
+
+// Free slot p to the cache of the worker that owns its slab.  Mine is the
+// cache of the calling worker, or NULL if the caller is not a worker.
+static inline __attribute__((always_inline)) void
+slab_cache_free(struct slab_cache *mine, void *p, size_t slab_size) {
+    struct slab_cache *owner = slab_of(p, slab_size)->owner;
+    struct slot_free *f = (struct slot_free *)p;
+    if (owner == mine) {
+        f->next = owner->free_list;
+        owner->free_list = f;
+    } else {
+        slab_remote_free(owner, f);
+    }
+}
+
+static size_t slot_list_length(struct slot_free *f) {
+    size_t n = 0;
+    for (; f; f = f->next)
+        ++n;
+    return n;
+}
+
+static void slabs_destroy(_Atomic(struct slab *) *slabs) {
+    struct slab *slab = atomic_load_explicit(slabs, memory_order_relaxed);
+    while (slab) {
+        struct slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    atomic_store_explicit(slabs, NULL, memory_order_relaxed);
+}
+
+void *cilk_closure_alloc(__cilkrts_worker *w) {
+    count_tag(&w->l->im_desc, sizeof(Closure), IM_CLOSURE);
+    return slab_cache_alloc(w, &w->l->closure_cache, &w->g->closure_slabs,
+                            CLOSURE_SLAB_SIZE, sizeof(Closure));
+}
+
+void cilk_closure_free(__cilkrts_worker *w, void *p) {
+    slab_cache_free(&w->l->closure_cache, p, CLOSURE_SLAB_SIZE);
+}
+
+void cilk_closure_free_global(void *p) {
+    slab_remote_free(slab_of(p, CLOSURE_SLAB_SIZE)->owner,
+                     (struct slot_free *)p);
+}
+
+/* Give the worker free closures worth at least bytes, carving whole new slabs
+   into its free list, which writes to every closure slot.  Called by the
+   thread of the worker, so the pages come from its NUMA node. */
+void cilk_closure_warmup(__cilkrts_worker *w, size_t bytes) {
+    struct slab_cache *c = &w->l->closure_cache;
+    size_t wanted = bytes / sizeof(Closure);
+    size_t have = (c->slab_end - c->slab_begin) / sizeof(Closure);
+    for (struct slot_free *f = c->free_list; f && have < wanted; f = f->next)
+        ++have;
+    while (true) {
+        while (c->slab_end - c->slab_begin >= (ptrdiff_t)sizeof(Closure)) {
+            struct slot_free *f = (struct slot_free *)c->slab_begin;
+            c->slab_begin += sizeof(Closure);
+            f->next = c->free_list;
+            c->free_list = f;
+        }
+        if (have >= wanted)
+            break;
+        slab_cache_new_slab(w, c, &w->g->closure_slabs, CLOSURE_SLAB_SIZE,
+                            sizeof(Closure));
+        have += (c->slab_end - c->slab_begin) / sizeof(Closure);
+    }
+}
+
+void *cilk_view_alloc(__cilkrts_worker *w) {
+    count_tag(&w->l->im_desc, VIEW_SLOT_SIZE, IM_REDUCER_MAP);
+    return slab_cache_alloc(w, &w->l->view_cache, &w->g->view_slabs,
+                            VIEW_SLAB_SIZE, VIEW_SLOT_SIZE);
+}
+
+void cilk_view_free(__cilkrts_worker *w, void *p) {
+    slab_cache_free(w ? &w->l->view_cache : NULL, p, VIEW_SLAB_SIZE);
+}
+
+/* Check that every closure has been freed, after workers have stopped. */
+static void closure_slab_check(global_state *g) {
+    const size_t per_slab = (CLOSURE_SLAB_SIZE - sizeof(Closure)) /
+                            sizeof(Closure);
+    size_t slots = 0, free = 0;
+    for (unsigned int i = 0; i < g->nworkers; i++) {
+        __cilkrts_worker *w = g->workers[i];
+        if (!w || !w->l)
+            continue;
+        struct slab_cache *c = &w->l->closure_cache;
+        slots += c->nslabs * per_slab;
+        free += slot_list_length(c->free_list) +
+                slot_list_length(atomic_load_explicit(&c->remote_free,
+                                                      memory_order_relaxed)) +
+                (c->slab_end - c->slab_begin) / sizeof(Closure);
+    }
+    CILK_CHECK(g, slots == free, "Closure leak: %zu of %zu closures in use",
+               slots - free, slots);
+}
+
 void cilk_internal_malloc_global_init(global_state *g) {
     if (cheetah_page_shift == 0) {
         long cheetah_page_size = sysconf(_SC_PAGESIZE);
@@ -396,31 +899,42 @@ void cilk_internal_malloc_global_init(global_state *g) {
         CILK_ASSERT((1 << cheetah_page_shift) == cheetah_page_size);
     }
     cilk_mutex_init(&(g->im_lock));
-    g->im_pool.mem_begin = g->im_pool.mem_end = NULL;
-    g->im_pool.mem_list_index = -1;
-    g->im_pool.mem_list_size = MEM_LIST_SIZE;
-    g->im_pool.mem_list = calloc(MEM_LIST_SIZE, sizeof(*g->im_pool.mem_list));
-    CILK_CHECK(g, g->im_pool.mem_list,
-               "Cannot allocate %u * %zu bytes for mem_list", MEM_LIST_SIZE,
-               sizeof(*g->im_pool.mem_list));
-    g->im_pool.allocated = 0;
-    g->im_pool.wasted = 0;
+    global_im_pool_init(g, &g->im_pool);
     init_im_buckets(&g->im_desc);
+    init_im_depot(&g->im_depot);
+    atomic_store_explicit(&g->im_releasing, false, memory_order_relaxed);
 
     g->im_desc.used = 0;
     for (int i = 0; i < IM_NUM_TAGS; ++i)
         g->im_desc.num_malloc[i] = 0;
+
+    if (g->nnodes > 0) {
+        g->im_nodes = (struct cilk_im_node *)cilk_aligned_alloc(
+            __alignof__(struct cilk_im_node),
+            g->nnodes * sizeof(struct cilk_im_node));
+        for (unsigned int i = 0; i < g->nnodes; ++i)
+            init_im_depot(&g->im_nodes[i].depot);
+    }
 }
 
 void cilk_internal_malloc_global_terminate(global_state *g) {
-    if (DEBUG_ENABLED(MEMORY))
+    if (DEBUG_ENABLED(MEMORY)) {
         internal_malloc_global_check(g);
+        closure_slab_check(g);
+    }
     if (ALERT_ENABLED(MEMORY))
         print_internal_malloc_stats(g);
 }
 
 void cilk_internal_malloc_global_destroy(global_state *g) {
-    global_im_pool_destroy(&(g->im_pool)); // free global mem blocks
+    if (g->im_nodes) {
+        free(g->im_nodes);
+        g->im_nodes = NULL;
+    }
+    init_im_depot(&g->im_depot);
+    global_im_pool_destroy(&(g->im_pool)); // free all chunks
+    slabs_destroy(&g->closure_slabs);
+    slabs_destroy(&g->view_slabs);
     cilk_mutex_destroy(&(g->im_lock));
     for (int i = 0; i < IM_NUM_TAGS; ++i) {
         CILK_ASSERT(g->im_desc.num_malloc[i] == 0);
@@ -432,21 +946,40 @@ void cilk_internal_malloc_global_destroy(global_state *g) {
 //=========================================================
 
 /**
- * Allocate a batch of memory of size 'size' from global im bucket 'bucket'
- * into per-worker im bucket 'bucket'.
+ * Get the shared free lists for worker w, those of its NUMA node, or the
+ * global ones.
  */
-static void im_allocate_batch(__cilkrts_worker *w, size_t size,
-                              unsigned int bucket_index) {
-    global_state *g = w->g;
-    local_state *l = w->l;
-    struct im_bucket *bucket = &l->im_desc.buckets[bucket_index];
-    unsigned int batch_size = bucket_capacity[bucket_index] / 2;
-    cilk_mutex_lock(&(g->im_lock));
-    for (unsigned int i = 0; i < batch_size; i++) {
-        void *p = global_im_alloc(w, size, bucket_index);
-        add_to_free_list(bucket, p);
-    }
-    cilk_mutex_unlock(&(g->im_lock));
+static inline struct im_depot *worker_im_depot(__cilkrts_worker *w) {
+    int node = w->l->node_domain;
+    return (w->g->nnodes > 0 && node >= 0) ? &w->g->im_nodes[node].depot
+                                           : &w->g->im_depot;
+}
+
+/**
+ * Refill per-worker im bucket 'which_bucket' with a batch from the shared free
+ * lists, or else carve a batch out of the worker's own chunk.  Neither needs a
+ * lock.
+ */
+static void im_allocate_batch(__cilkrts_worker *w, unsigned int which_bucket) {
+    struct im_bucket *bucket = &w->l->im_desc.buckets[which_bucket];
+    unsigned int batch_size = bucket_capacity[which_bucket] / 2;
+    struct im_batch *batch = im_depot_take(worker_im_depot(w), which_bucket);
+    if (batch) {
+        batch_size = batch->count;
+        struct free_block *last = (struct free_block *)batch;
+        while (true) {
+            atomic_fetch_sub_explicit(&chunk_of(last)->shared, 1,
+                                      memory_order_relaxed);
+            if (!last->next)
+                break;
+            last = last->next;
+        }
+        last->next = bucket->free_list;
+        bucket->free_list = batch;
+        bucket->free_list_size += batch_size;
+    } else {
+        im_carve_batch(w, bucket, which_bucket, batch_size);
+    }
     bucket->allocated += batch_size;
     if (bucket->allocated > bucket->max_allocated) {
         bucket->max_allocated = bucket->allocated;
@@ -454,26 +987,43 @@ static void im_allocate_batch(__cilkrts_worker *w, size_t size,
 }
 
 /**
- * Free a batch of memory of size 'size' from per-worker im bucket 'bucket'
- * back to global im bucket 'bucket'.
+ * Move a batch from per-worker im bucket 'which_bucket' to the shared free
+ * lists, and release idle chunks if that leaves enough free blocks.
  */
-static void im_free_batch(__cilkrts_worker *w, size_t size,
-                          unsigned int which_bucket) {
-    global_state *g = w->g;
-    local_state *l = w->l;
+static void im_free_batch(__cilkrts_worker *w, unsigned int which_bucket) {
+    struct im_bucket *bucket = &w->l->im_desc.buckets[which_bucket];
+    struct im_batch *batch = bucket->free_list;
+    if (!batch)
+        return;
     unsigned int batch_size = bucket_capacity[which_bucket] / 2;
-    struct im_bucket *bucket = &(l->im_desc.buckets[which_bucket]);
-    cilk_mutex_lock(&(g->im_lock));
-    for (unsigned int i = 0; i < batch_size; ++i) {
-        void *mem = remove_from_free_list(bucket);
-        if (!mem)
-            break;
-        add_to_free_list(&g->im_desc.buckets[which_bucket], mem);
-        g->im_desc.used -= size;
-        --bucket->allocated;
+    unsigned int count = 0;
+    bool idle = false;
+    struct free_block *last = NULL, *p = bucket->free_list;
+    // Count the blocks in shared free lists before pushing them, after which
+    // their chunks may be released.
+    while (p && count < batch_size) {
+        struct im_chunk *chunk = chunk_of(p);
+        if (atomic_fetch_add_explicit(&chunk->shared, 1,
+                                      memory_order_relaxed) +
+                1 ==
+            chunk->capacity)
+            idle = true;
+        last = p;
+        p = p->next;
+        ++count;
     }
-    cilk_mutex_unlock(&(w->g->im_lock));
-    /* Account for bytes allocated change? */
+    last->next = NULL;
+    bucket->free_list = p;
+    bucket->free_list_size -= count;
+    bucket->allocated -= count;
+    batch->count = count;
+
+    struct im_depot *depot = worker_im_depot(w);
+    atomic_fetch_add_explicit(&depot->nfree[which_bucket], count,
+                              memory_order_relaxed);
+    im_depot_push(depot, which_bucket, batch, batch);
+    if (idle)
+        im_release_idle_chunks(w->g, depot, which_bucket);
 }
 
 /*
@@ -483,6 +1033,7 @@ static void im_free_batch(__cilkrts_worker *w, size_t size,
 CHEETAH_INTERNAL
 void *cilk_internal_malloc(__cilkrts_worker *w, size_t size, enum im_tag tag) {
     local_state *l = w->l;
+    count_tag(&l->im_desc, size, tag);
     unsigned int which_bucket = size_to_bucket(size);
     if (which_bucket >= NUM_BUCKETS) {
         return malloc_from_system(w, size);
@@ -498,8 +1049,8 @@ void *cilk_internal_malloc(__cilkrts_worker *w, size_t size, enum im_tag tag) {
     bucket->wasted += csize - size;
     void *mem = remove_from_free_list(bucket);
 
-    if (!mem) { // when out of memory, allocate a batch from global pool
-        im_allocate_batch(w, csize, which_bucket);
+    if (!mem) { // when out of memory, refill from the shared free lists
+        im_allocate_batch(w, which_bucket);
         mem = remove_from_free_list(bucket);
         CILK_ASSERT(mem);
     }
@@ -537,7 +1088,7 @@ void cilk_internal_free(__cilkrts_worker *w, void *p, size_t size,
     add_to_free_list(bucket, p);
 
     while (bucket->free_list_size > bucket->free_list_limit) {
-        im_free_batch(w, csize, which_bucket);
+        im_free_batch(w, which_bucket);
     }
     if (ALERT_ENABLED(MEMORY))
         dump_memory_state(NULL, w->g);
@@ -552,13 +1103,27 @@ void cilk_internal_free(__cilkrts_worker *w, void *p, size_t size,
 void cilk_internal_free_global(global_state *g, void *p, size_t size,
                                enum im_tag tag) {
     unsigned int which_bucket = size_to_bucket(size);
-    add_to_free_list(&g->im_desc.buckets[which_bucket], p);
+    struct im_chunk *chunk = chunk_of(p);
+    bool idle = atomic_fetch_add_explicit(&chunk->shared, 1,
+                                          memory_order_relaxed) +
+                    1 ==
+                chunk->capacity;
+    struct im_batch *batch = (struct im_batch *)p;
+    batch->next = NULL;
+    batch->count = 1;
+    atomic_fetch_add_explicit(&g->im_depot.nfree[which_bucket], 1,
+                              memory_order_relaxed);
+    im_depot_push(&g->im_depot, which_bucket, batch, batch);
     g->im_desc.num_malloc[tag]--;
     g->im_desc.used -= bucket_to_size(which_bucket);
+    if (idle)
+        im_release_idle_chunks(g, &g->im_depot, which_bucket);
 }
 
 void cilk_internal_malloc_per_worker_init(__cilkrts_worker *w) {
     init_im_buckets(&(w->l->im_desc));
+    slab_cache_init(&w->l->closure_cache);
+    slab_cache_init(&w->l->view_cache);
 }
 
 void cilk_internal_malloc_per_worker_terminate(__cilkrts_worker *w) {
@@ -570,11 +1135,15 @@ void cilk_internal_malloc_per_worker_terminate(__cilkrts_worker *w) {
     for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
         assert_bucket(&l->im_desc.buckets[i]);
         while (l->im_desc.buckets[i].free_list)
-            im_free_batch(w, bucket_to_size(i), i);
+            im_free_batch(w, i);
     }
     for (int i = 0; i < IM_NUM_TAGS; ++i) {
         g->im_desc.num_malloc[i] += l->im_desc.num_malloc[i];
         l->im_desc.num_malloc[i] = 0;
+        g->im_desc.tag_allocs[i] += l->im_desc.tag_allocs[i];
+        l->im_desc.tag_allocs[i] = 0;
+        g->im_desc.tag_bytes[i] += l->im_desc.tag_bytes[i];
+        l->im_desc.tag_bytes[i] = 0;
     }
     if (ALERT_ENABLED(MEMORY))
         dump_memory_state(NULL, w->g);
@@ -60,4 +60,19 @@ CHEETAH_INTERNAL void cilk_internal_free(__cilkrts_worker *w, void *p,
 CHEETAH_INTERNAL void cilk_internal_free_global(struct global_state *, void *p,
                                                 size_t size, enum im_tag tag);
 
+/* Allocate and free closures, from per-worker slabs. */
+__attribute__((assume_aligned(CILK_CACHE_LINE), malloc))
+CHEETAH_INTERNAL void *cilk_closure_alloc(__cilkrts_worker *w);
+CHEETAH_INTERNAL void cilk_closure_free(__cilkrts_worker *w, void *p);
+/* Free a closure after workers have stopped. */
+CHEETAH_INTERNAL void cilk_closure_free_global(void *p);
+/* Preallocate free closures worth at least bytes for the calling worker. */
+CHEETAH_INTERNAL void cilk_closure_warmup(__cilkrts_worker *w, size_t bytes);
+
+/* Allocate and free reducer views of at most VIEW_SLOT_SIZE bytes, from
+   per-worker slabs.  w may be NULL when freeing from outside the workers. */
+__attribute__((assume_aligned(VIEW_SLOT_SIZE), malloc))
+CHEETAH_INTERNAL void *cilk_view_alloc(__cilkrts_worker *w);
+CHEETAH_INTERNAL void cilk_view_free(__cilkrts_worker *w, void *p);
+
 #endif // _INTERAL_MALLOC_H
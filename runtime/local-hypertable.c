@@ -8,16 +8,63 @@
 #include "internal-malloc.h" /* only needed for new view allocation */
 #include "local-hypertable.h"
 
-static void reducer_base_init(reducer_base *rb) {
-    rb->view = NULL;
-    rb->reduce_fn = NULL;
+static void make_tombstone(uintptr_t *key) { *key = KEY_DELETED; }
+
+// Read and write the entry at index i of the table's arrays.
+static inline struct bucket get_bucket(const hyper_table *table, index_t i) {
+    return (struct bucket){.key = table->keys[i],
+                           .hash = table->hashes[i],
+                           .view_size = table->view_sizes[i],
+                           .value = table->values[i]};
 }
 
-static void make_tombstone(uintptr_t *key) { *key = KEY_DELETED; }
+static inline void set_bucket(hyper_table *table, index_t i, struct bucket b) {
+    table->keys[i] = b.key;
+    table->hashes[i] = b.hash;
+    table->view_sizes[i] = b.view_size;
+    table->values[i] = b.value;
+}
+
+// Views too large for a slot take whole blocks of VIEW_ALIGN bytes, which
+// internal malloc aligns to VIEW_ALIGN bytes.  Views of any alignment are thus
+// aligned, and they do not share cache lines.
+#define VIEW_ALIGN 64
+
+static inline size_t view_alloc_size(size_t size) {
+    return round_size_to_alignment(VIEW_ALIGN, size);
+}
+
+// Free a view of size bytes created by __cilkrts_insert_new_view.  The view
+// goes back to the pools of w, which need not be the worker that created it.
+void reducer_view_free(__cilkrts_worker *w, void *view, size_t size) {
+    if (size <= VIEW_SLOT_SIZE)
+        cilk_view_free(w, view);
+    else
+        cilk_internal_free(w, view, view_alloc_size(size), IM_REDUCER_MAP);
+}
 
-static void bucket_init(struct bucket *b) {
-    b->key = KEY_EMPTY;
-    reducer_base_init(&b->value);
+// Reductions that a merge leaves for its caller to run.
+struct pending_reductions {
+    struct view_pair *pairs;
+    int32_t count;
+};
+
+// Reduce the view right of size right_size into left, or, if pending is not
+// NULL, record the pair of views in pending instead.
+static inline void reduce_or_defer(__cilkrts_worker *w,
+                                   struct pending_reductions *pending,
+                                   reducer_base left, void *right,
+                                   uint32_t right_size) {
+    if (pending) {
+        pending->pairs[pending->count++] =
+            (struct view_pair){.left = left.view,
+                               .right = right,
+                               .reduce_fn = left.reduce_fn,
+                               .right_size = right_size};
+        return;
+    }
+    left.reduce_fn(left.view, right);
+    reducer_view_free(w, right, right_size);
 }
 
 // Constant used to determine the target maximum load factor.  The
@@ -49,98 +96,104 @@ static bool time_to_rebuild(int32_t ins_rm_count, int32_t capacity) {
            (ins_rm_count > capacity / (4 * LOAD_FACTOR_CONSTANT));
 }
 
-static struct bucket *bucket_array_create(int32_t array_size) {
-    struct bucket *buckets =
-        (struct bucket *)calloc(array_size, sizeof(struct bucket));
-    if (array_size < MIN_HT_CAPACITY) {
-        for (int32_t i = 0; i < array_size; ++i) {
-            bucket_init(&buckets[i]);
-        }
-        return buckets;
-    }
+// Give table new, empty arrays of array_size entries.  The arrays share one
+// allocation, which starts at table->keys.
+static void table_arrays_create(hyper_table *table, int32_t array_size) {
+    const size_t entry_size = sizeof(uintptr_t) + sizeof(reducer_base) +
+                              sizeof(index_t) + sizeof(uint32_t);
+    // Zeroed memory makes every key KEY_EMPTY and every view NULL.
+    char *mem = (char *)calloc(array_size, entry_size);
+    table->capacity = array_size;
+    table->keys = (uintptr_t *)mem;
+    table->values = (reducer_base *)(table->keys + array_size);
+    table->hashes = (index_t *)(table->values + array_size);
+    table->view_sizes = (uint32_t *)(table->hashes + array_size);
+    if (array_size < MIN_HT_CAPACITY)
+        return;
     int32_t tombstone_idx = 0;
     for (int32_t i = 0; i < array_size; ++i) {
-        bucket_init(&buckets[i]);
         // Graveyard hashing: Insert tombstones at regular intervals.
         // TODO: Check if it's bad for the insertions to rebuild a
         // table to use these tombstones.
         if (tombstone_idx == 2 * LOAD_FACTOR_CONSTANT) {
-            make_tombstone(&buckets[i].key);
+            make_tombstone(&table->keys[i]);
             tombstone_idx -= 2 * LOAD_FACTOR_CONSTANT;
         } else
             ++tombstone_idx;
     }
-    return buckets;
 }
 
 hyper_table *__cilkrts_local_hyper_table_alloc(void) {
     hyper_table *table = malloc(sizeof(hyper_table));
-    int32_t capacity = MIN_CAPACITY;
-    table->capacity = capacity;
     table->occupancy = 0;
     table->ins_rm_count = 0;
-    table->buckets = bucket_array_create(capacity);
+    table->chain_length = 0;
+    table->deferred = NULL;
+    table_arrays_create(table, MIN_CAPACITY);
     return table;
 }
 
 void local_hyper_table_free(hyper_table *table) {
-    free(table->buckets);
-    free(table);
+    while (table) {
+        hyper_table *next = table->deferred;
+        free(table->keys);
+        free(table);
+        table = next;
+    }
 }
 
-static struct bucket *rebuild_table(hyper_table *table, int32_t new_capacity) {
-    struct bucket *old_buckets = table->buckets;
-    int32_t old_capacity = table->capacity;
-    int32_t old_occupancy = table->occupancy;
+static void rebuild_table(hyper_table *table, int32_t new_capacity) {
+    hyper_table old = *table;
 
     assert(new_capacity <= MAX_CAPACITY);
 
-    table->buckets = bucket_array_create(new_capacity);
-    table->capacity = new_capacity;
+    table_arrays_create(table, new_capacity);
     table->occupancy = 0;
     // Set count of insertions and removals to prevent insertions into
     // new table from triggering another rebuild.
-    table->ins_rm_count = -old_occupancy;
+    table->ins_rm_count = -old.occupancy;
 
     // Iterate through old table and insert each element into the new
     // table.
-    for (int32_t i = 0; i < old_capacity; ++i) {
-        if (is_valid(old_buckets[i].key)) {
-            bool success = insert_hyperobject(table, old_buckets[i]);
+    for (index_t i = 0; i < old.capacity; ++i) {
+        if (is_valid(old.keys[i])) {
+            bool success = insert_hyperobject(table, get_bucket(&old, i));
             assert(success && "Failed to insert when resizing table.");
             (void)success;
         }
     }
 
-    assert(table->occupancy == old_occupancy &&
+    assert(table->occupancy == old.occupancy &&
            "Mismatched occupancy after resizing table.");
 
-    free(old_buckets);
-    return table->buckets;
+    free(old.keys);
 }
 
 ///////////////////////////////////////////////////////////////////////////
 // Query, insert, and delete methods for the hash table.
 
-struct bucket *__cilkrts_find_hyperobject_hash(hyper_table *table,
-                                               uintptr_t key) {
-    int32_t capacity = table->capacity;
+// Return the index of key in a table of at least MIN_HT_CAPACITY entries, or
+// -1 if key is not in the table.
+static inline int32_t find_index_hash(const hyper_table *table,
+                                      uintptr_t key) {
+    index_t capacity = table->capacity;
+    const uintptr_t *keys = table->keys;
+    const index_t *hashes = table->hashes;
 
     // Target hash
     const index_t tgt = get_table_entry(capacity, key);
-    struct bucket *buckets = table->buckets;
     // Start the probe at the target hash
     index_t i = tgt;
     do {
-        uintptr_t curr_key = buckets[i].key;
+        uintptr_t curr_key = keys[i];
         // Found the key?  Return that bucket.
         // TODO: Consider moving this bucket to the front of the run.
         if (key == curr_key)
-            return &buckets[i];
+            return i;
 
         // Found an empty entry?  The probe failed.
         if (is_empty(curr_key))
-            return NULL;
+            return -1;
 
         // Found a tombstone?  Continue the probe.
         if (is_tombstone(curr_key)) {
@@ -148,8 +201,8 @@ struct bucket *__cilkrts_find_hyperobject_hash(hyper_table *table,
             continue;
         }
 
-        // Otherwise, buckets[i] is another valid key that does not match.
-        index_t curr_hash = buckets[i].hash;
+        // Otherwise, keys[i] is another valid key that does not match.
+        index_t curr_hash = hashes[i];
 
         if (continue_probe(tgt, curr_hash, i)) {
             i = inc_index(i, capacity);
@@ -158,28 +211,46 @@ struct bucket *__cilkrts_find_hyperobject_hash(hyper_table *table,
 
         // If none of the above cases match, then the probe failed to
         // find the key.
-        return NULL;
+        return -1;
     } while (i != tgt);
 
     // The probe failed to find the key.
-    return NULL;
+    return -1;
+}
+
+// Return the index of key in table, or -1 if key is not in the table.
+static int32_t find_index(const hyper_table *table, uintptr_t key) {
+    if (table->capacity < MIN_HT_CAPACITY) {
+        // If the table is small enough, just scan the array.
+        for (int32_t i = table->occupancy - 1; i >= 0; --i)
+            if (table->keys[i] == key)
+                return i;
+        return -1;
+    }
+    return find_index_hash(table, key);
+}
+
+reducer_base *__cilkrts_find_hyperobject_hash(hyper_table *table,
+                                              uintptr_t key) {
+    int32_t i = find_index_hash(table, key);
+    if (i < 0)
+        return NULL;
+    return &table->values[i];
 }
 
 bool remove_hyperobject(hyper_table *table, uintptr_t key) {
     if (table->capacity < MIN_HT_CAPACITY) {
         // If the table is small enough, just scan the array.
-        struct bucket *buckets = table->buckets;
         int32_t occupancy = table->occupancy;
 
         for (int32_t i = 0; i < occupancy; ++i) {
-            if (buckets[i].key == key) {
-                if (i == occupancy - 1)
-                    // Set this entry's key to empty.  This code is here
-                    // primarily to handle the case where occupancy == 1.
-                    buckets[i].key = KEY_EMPTY;
-                else
-                    // Remove this entry by swapping it with the last entry.
-                    buckets[i] = buckets[occupancy - 1];
+            if (table->keys[i] == key) {
+                // Remove this entry by moving the last entry into its place,
+                // and set the last entry's key to empty.
+                int32_t last = occupancy - 1;
+                if (i != last)
+                    set_bucket(table, i, get_bucket(table, last));
+                table->keys[last] = KEY_EMPTY;
                 // Decrement the occupancy.
                 --table->occupancy;
                 return true;
@@ -189,15 +260,15 @@ bool remove_hyperobject(hyper_table *table, uintptr_t key) {
     }
 
     // Find the key in the table.
-    struct bucket *entry = find_hyperobject(table, key);
+    int32_t entry = find_index_hash(table, key);
 
-    // If entry is NULL, the probe did not find the key.
-    if (NULL == entry)
+    // If entry is negative, the probe did not find the key.
+    if (entry < 0)
         return false;
 
-    // The probe found the key and returned a pointer to the entry.
-    // Replace the entry with a tombstone and decrement the occupancy.
-    make_tombstone(&entry->key);
+    // The probe found the key.  Replace the entry with a tombstone and
+    // decrement the occupancy.
+    make_tombstone(&table->keys[entry]);
     --table->occupancy;
     ++table->ins_rm_count;
 
@@ -213,22 +284,21 @@ bool remove_hyperobject(hyper_table *table, uintptr_t key) {
 bool insert_hyperobject(hyper_table *table, struct bucket b) {
     assert(b.key != KEY_EMPTY && b.key != KEY_DELETED);
     int32_t capacity = table->capacity;
-    struct bucket *buckets = table->buckets;
     if (capacity < MIN_HT_CAPACITY) {
         // If the table is small enough, just scan the array.
         int32_t occupancy = table->occupancy;
 
         if (occupancy < capacity) {
             for (int32_t i = 0; i < occupancy; ++i) {
-                if (buckets[i].key == b.key) {
+                if (table->keys[i] == b.key) {
                     // The key is already in the table.  Overwrite.
-                    buckets[i] = b;
+                    set_bucket(table, i, b);
                     return true;
                 }
             }
 
             // The key is not aleady in the table.  Append the bucket.
-            buckets[occupancy] = b;
+            set_bucket(table, occupancy, b);
             ++table->occupancy;
             return true;
         }
@@ -237,24 +307,26 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
         // to a hash table, and fall through to insert the new bucket
         // into that hash table.
         capacity *= 2;
-        buckets = rebuild_table(table, capacity);
+        rebuild_table(table, capacity);
     }
 
     // If the occupancy is already too high, rebuild the table.
     if (is_overloaded(table->occupancy, capacity)) {
         capacity *= 2;
-        buckets = rebuild_table(table, capacity);
+        rebuild_table(table, capacity);
     } else if (time_to_rebuild(table->ins_rm_count, capacity)) {
-        buckets = rebuild_table(table, capacity);
+        rebuild_table(table, capacity);
     }
+    const uintptr_t *keys = table->keys;
+    const index_t *hashes = table->hashes;
 
     // Target hash
     const index_t tgt = get_table_entry(capacity, b.key);
     b.hash = tgt;
 
     // If we find an empty entry, insert the bucket there.
-    if (is_empty(buckets[tgt].key)) {
-        buckets[tgt] = b;
+    if (is_empty(keys[tgt])) {
+        set_bucket(table, tgt, b);
         ++table->occupancy;
         ++table->ins_rm_count;
         return true;
@@ -265,17 +337,18 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
 
     const index_t probe_end = tgt;
     do {
-        uintptr_t curr_key = buckets[i].key;
+        uintptr_t curr_key = keys[i];
         // Found the key?  Overwrite that bucket.
         // TODO: Reconsider what to do in this case.
         if (b.key == curr_key) {
-            buckets[i].value = b.value;
+            table->view_sizes[i] = b.view_size;
+            table->values[i] = b.value;
             return true;
         }
 
         // Found an empty entry?  Insert b there.
         if (is_empty(curr_key)) {
-            buckets[i] = b;
+            set_bucket(table, i, b);
             ++table->occupancy;
             ++table->ins_rm_count;
             return true;
@@ -286,16 +359,16 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
             index_t current_tomb = i;
             // Scan consecutive tombstones from i.
             index_t next_i = inc_index(i, capacity);
-            uintptr_t tomb_end = buckets[next_i].key;
+            uintptr_t tomb_end = keys[next_i];
             while (next_i != probe_end && is_tombstone(tomb_end)) {
                 next_i = inc_index(next_i, capacity);
-                tomb_end = buckets[next_i].key;
+                tomb_end = keys[next_i];
             }
 
             // If the next entry is empty, then the probe would stop.  It's
             // safe to insert the bucket at the tombstone at i.
             if (is_empty(tomb_end)) {
-                buckets[current_tomb] = b;
+                set_bucket(table, current_tomb, b);
                 ++table->occupancy;
                 ++table->ins_rm_count;
                 return true;
@@ -304,11 +377,11 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
             // Check if the hash at the end of this run of tombstones would
             // terminate the probe or if the probe has traversed the whole
             // table.
-            index_t tomb_end_hash = buckets[next_i].hash;
+            index_t tomb_end_hash = hashes[next_i];
             if (next_i == probe_end ||
                 !continue_probe(tgt, tomb_end_hash, next_i)) {
                 // It's safe to insert b at the current tombstone.
-                buckets[current_tomb] = b;
+                set_bucket(table, current_tomb, b);
                 ++table->occupancy;
                 ++table->ins_rm_count;
                 return true;
@@ -323,7 +396,7 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
         // Otherwise this entry contains another valid key that does
         // not match.  Compare the hashes to decide whether or not to
         // continue the probe.
-        index_t curr_hash = buckets[i].hash;
+        index_t curr_hash = hashes[i];
         if (continue_probe(tgt, curr_hash, i)) {
             i = inc_index(i, capacity);
             continue;
@@ -340,16 +413,16 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
     do {
         // If this entry is empty or a tombstone, insert the current bucket at
         // this location and terminate.
-        if (!is_valid(buckets[i].key)) {
-            buckets[i] = b;
+        if (!is_valid(keys[i])) {
+            set_bucket(table, i, b);
             ++table->occupancy;
             ++table->ins_rm_count;
             return true;
         }
 
         // Swap b with the current bucket.
-        struct bucket tmp = buckets[i];
-        buckets[i] = b;
+        struct bucket tmp = get_bucket(table, i);
+        set_bucket(table, i, b);
         b = tmp;
 
         // Continue onto the next index.
@@ -363,12 +436,23 @@ bool insert_hyperobject(hyper_table *table, struct bucket b) {
 void *__cilkrts_insert_new_view(hyper_table *table, uintptr_t key, size_t size,
                                 __cilk_identity_fn identity,
                                 __cilk_reduce_fn reduce) {
-    // Create a new view and initialize it with the identity function.
-    void *new_view = cilk_aligned_alloc(64, round_size_to_alignment(64, size));
+    // Create a new view and initialize it with the identity function.  Small
+    // views come from the worker's view slabs, which avoids a malloc and free
+    // per view and packs the views of scalar reducers together.  Larger views
+    // come from the worker's internal-malloc buckets, or from the system if
+    // they are too large for any bucket, aligned to VIEW_ALIGN bytes.
+    __cilkrts_worker *w = __cilkrts_get_tls_worker();
+    CILK_ASSERT(size > 0 && size <= UINT32_MAX);
+    void *new_view;
+    if (size <= VIEW_SLOT_SIZE)
+        new_view = cilk_view_alloc(w);
+    else
+        new_view = cilk_internal_malloc(w, view_alloc_size(size), IM_REDUCER_MAP);
     identity(new_view);
     // Insert the new view into the local hypertable.
     struct bucket new_bucket = {
         .key = (uintptr_t)key,
+        .view_size = (uint32_t)size,
         .value = {.view = new_view, .reduce_fn = reduce}};
     bool success = insert_hyperobject(table, new_bucket);
     assert(success);
@@ -377,16 +461,105 @@ void *__cilkrts_insert_new_view(hyper_table *table, uintptr_t key, size_t size,
     return new_view;
 }
 
-// Merge two hypertables, left and right.  Returns the merged hypertable and
-// deletes the other.
-hyper_table *merge_two_hts(hyper_table *restrict left,
-                           hyper_table *restrict right) {
+// A table is merged into one with at most this many times as many entries run
+// by run, rather than by probing the larger table for each of its entries,
+// unless it has fewer than MIN_RUN_MERGE entries.  Inserting many entries into
+// the larger table would rebuild it anyway.
+static const int32_t RUN_MERGE_RATIO = 32;
+static const int32_t MIN_RUN_MERGE = 16;
+
+// Merge left and right into new arrays of capacity entries in left, and delete
+// right.  Sorting the entries of both tables by their target index, and laying
+// them out in that order, produces the sorted runs of ordered linear probing in
+// one pass over the new arrays.
+static hyper_table *merge_runs(__cilkrts_worker *w, hyper_table *left,
+                               hyper_table *right, int32_t capacity,
+                               struct pending_reductions *pending) {
+    int32_t n = left->occupancy + right->occupancy;
+    struct bucket *sorted = malloc(n * sizeof(struct bucket));
+    int32_t *start = calloc(capacity + 1, sizeof(int32_t));
+
+    // Counting sort the entries by target index.  Within each target index,
+    // the entries of left come before the entries of right.
+    const hyper_table *tables[2] = {left, right};
+    for (int t = 0; t < 2; ++t) {
+        const hyper_table *table = tables[t];
+        index_t size = (table->capacity < MIN_HT_CAPACITY) ? table->occupancy
+                                                           : table->capacity;
+        for (index_t i = 0; i < size; ++i)
+            if (is_valid(table->keys[i]))
+                ++start[get_table_entry(capacity, table->keys[i]) + 1];
+    }
+    for (int32_t i = 0; i < capacity; ++i)
+        start[i + 1] += start[i];
+    for (int t = 0; t < 2; ++t) {
+        const hyper_table *table = tables[t];
+        index_t size = (table->capacity < MIN_HT_CAPACITY) ? table->occupancy
+                                                           : table->capacity;
+        for (index_t i = 0; i < size; ++i) {
+            if (!is_valid(table->keys[i]))
+                continue;
+            struct bucket b = get_bucket(table, i);
+            b.hash = get_table_entry(capacity, b.key);
+            sorted[start[b.hash]++] = b;
+        }
+    }
+    free(start);
+
+    // The two entries of a key in both tables have the same target index, and
+    // the left entry comes first.  Reduce the right view into the left view,
+    // free the right view, and drop the right entry.
+    for (int32_t k = 1; k < n; ++k) {
+        for (int32_t j = k - 1; j >= 0 && sorted[j].hash == sorted[k].hash;
+             --j) {
+            if (sorted[j].key == sorted[k].key) {
+                reduce_or_defer(w, pending, sorted[j].value,
+                                sorted[k].value.view, sorted[k].view_size);
+                make_tombstone(&sorted[k].key);
+                break;
+            }
+        }
+    }
+
+    // Place each entry at its target index or just after the previous entry,
+    // overwriting only empty entries and graveyard tombstones.  Once the runs
+    // reach the end of the arrays, the remaining entries wrap around to the
+    // start, so insert those normally.
+    local_hyper_table_free(right);
+    free(left->keys);
+    table_arrays_create(left, capacity);
+    left->occupancy = 0;
+    left->ins_rm_count = 0;
+    int32_t k = 0;
+    for (index_t next = 0; k < n && next < (index_t)capacity; ++k) {
+        if (!is_valid(sorted[k].key))
+            continue;
+        index_t i = (sorted[k].hash > next) ? sorted[k].hash : next;
+        set_bucket(left, i, sorted[k]);
+        ++left->occupancy;
+        next = i + 1;
+    }
+    for (; k < n; ++k) {
+        if (is_valid(sorted[k].key)) {
+            bool success = insert_hyperobject(left, sorted[k]);
+            assert(success && "Failed to insert when merging tables.");
+            (void)success;
+        }
+    }
+    free(sorted);
+
+    return left;
+}
+
+// Merge two hypertables without deferred tables, left and right.  Returns the
+// merged hypertable and deletes the other.  If pending is not NULL, it must have
+// room for the smaller occupancy of the tables, and the reductions of views of
+// keys in both tables are recorded there instead of run.
+static hyper_table *merge_tables(__cilkrts_worker *w, hyper_table *left,
+                                 hyper_table *right,
+                                 struct pending_reductions *pending) {
     // In the trivial case of an empty hyper_table, return the other
     // hyper_table.
-    if (!left)
-        return right;
-    if (!right)
-        return left;
     if (left->occupancy == 0) {
         local_hyper_table_free(left);
         return right;
@@ -410,20 +583,30 @@ hyper_table *merge_two_hts(hyper_table *restrict left,
         left_dst = false;
     }
 
+    // If the tables have similar sizes, merge their runs into new arrays large
+    // enough for both.
+    if (src->occupancy >= MIN_RUN_MERGE &&
+        src->occupancy * RUN_MERGE_RATIO >= dst->occupancy) {
+        int32_t capacity = dst->capacity;
+        while (is_overloaded(left->occupancy + right->occupancy, capacity))
+            capacity *= 2;
+        if (capacity >= MIN_HT_CAPACITY)
+            return merge_runs(w, left, right, capacity, pending);
+    }
+
     int32_t src_capacity =
         (src->capacity < MIN_HT_CAPACITY) ? src->occupancy : src->capacity;
-    struct bucket *src_buckets = src->buckets;
     // Iterate over the contents of the source hyper_table.
     for (int32_t i = 0; i < src_capacity; ++i) {
-        struct bucket b = src_buckets[i];
-        if (!is_valid(b.key))
+        if (!is_valid(src->keys[i]))
             continue;
+        struct bucket b = get_bucket(src, i);
 
         // For each valid key in the source table, lookup that key in the
         // destination table.
-        struct bucket *dst_bucket = find_hyperobject(dst, b.key);
+        int32_t d = find_index(dst, b.key);
 
-        if (NULL == dst_bucket) {
+        if (d < 0) {
             // The destination table does not contain this key.  Insert the
             // key-value pair from the source table into the destination.
             insert_hyperobject(dst, b);
@@ -431,14 +614,14 @@ hyper_table *merge_two_hts(hyper_table *restrict left,
             // Merge the two views in the source and destination buckets, being
             // sure to preserve left-to-right ordering.  Free the right view
             // when done.
-            reducer_base dst_rb = dst_bucket->value;
+            reducer_base dst_rb = dst->values[d];
             if (left_dst) {
-                dst_rb.reduce_fn(dst_rb.view, b.value.view);
-                free(b.value.view);
+                reduce_or_defer(w, pending, dst_rb, b.value.view, b.view_size);
             } else {
-                dst_rb.reduce_fn(b.value.view, dst_rb.view);
-                free(dst_rb.view);
-                dst_bucket->value.view = b.value.view;
+                reduce_or_defer(w, pending, b.value, dst_rb.view,
+                                dst->view_sizes[d]);
+                dst->values[d].view = b.value.view;
+                dst->view_sizes[d] = b.view_size;
             }
         }
     }
@@ -448,3 +631,114 @@ hyper_table *merge_two_hts(hyper_table *restrict left,
 
     return dst;
 }
+
+// Merge two hypertables, left and right.  Returns the merged hypertable and
+// deletes the other.
+hyper_table *merge_two_hts(hyper_table *restrict left,
+                           hyper_table *restrict right) {
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    CILK_ASSERT(!left->deferred && !right->deferred);
+    return merge_tables(__cilkrts_get_tls_worker(), left, right, NULL);
+}
+
+// Lazy version of merge_two_hts: chain the tables of right after the tables of
+// left without reducing any views, and return the head of the chain.  Only if
+// the chain then holds more than max_chain deferred tables are they reduced,
+// which bounds the memory they keep and the work of the next lookup.
+hyper_table *defer_merge_two_hts(hyper_table *left, hyper_table *right,
+                                 int32_t max_chain) {
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    if (left->occupancy == 0 && !left->deferred) {
+        local_hyper_table_free(left);
+        return right;
+    }
+    if (right->occupancy == 0 && !right->deferred) {
+        local_hyper_table_free(right);
+        return left;
+    }
+
+    hyper_table *tail = left;
+    while (tail->deferred)
+        tail = tail->deferred;
+    tail->deferred = right;
+    left->chain_length += 1 + right->chain_length;
+    right->chain_length = 0;
+
+    if (left->chain_length > max_chain)
+        return __cilkrts_reduce_deferred_hts(left);
+    return left;
+}
+
+// Reduce the tables deferred by defer_merge_two_hts into the head of their
+// chain, table.  Returns the merged hypertable, which has no deferred tables.
+// Folding the whole chain from the left reduces every view directly into the
+// leftmost view of its reducer, so a view that is reduced by copying, as for a
+// vector append, is copied once rather than at every join it passes.
+hyper_table *__cilkrts_reduce_deferred_hts(hyper_table *table) {
+    __cilkrts_worker *w = __cilkrts_get_tls_worker();
+    hyper_table *next = table->deferred;
+    table->deferred = NULL;
+    table->chain_length = 0;
+    while (next) {
+        hyper_table *right = next;
+        next = right->deferred;
+        right->deferred = NULL;
+        table = merge_tables(w, table, right, NULL);
+    }
+    return table;
+}
+
+// Merge two hypertables without deferred tables, left and right, like
+// merge_two_hts, but leave the reductions of the views of keys in both tables
+// to the caller: set *pairs to a malloc'd array of the *npairs pairs of views
+// to reduce, which the caller can reduce in any order, and in parallel, with
+// __cilkrts_reduce_view_pairs.
+hyper_table *__cilkrts_merge_hts_deferring(hyper_table *left,
+                                           hyper_table *right,
+                                           struct view_pair **pairs,
+                                           int32_t *npairs) {
+    CILK_ASSERT(!left->deferred && !right->deferred);
+    int32_t max_pairs = (left->occupancy < right->occupancy) ? left->occupancy
+                                                             : right->occupancy;
+    struct pending_reductions pending = {
+        .pairs = malloc((max_pairs ? max_pairs : 1) * sizeof(struct view_pair)),
+        .count = 0};
+    hyper_table *table = merge_tables(NULL, left, right, &pending);
+    *pairs = pending.pairs;
+    *npairs = pending.count;
+    return table;
+}
+
+// Reduce n pairs of views left by __cilkrts_merge_hts_deferring, and free the
+// right views.
+void __cilkrts_reduce_view_pairs(struct view_pair *pairs, int32_t n) {
+    __cilkrts_worker *w = __cilkrts_get_tls_worker();
+    for (int32_t i = 0; i < n; ++i) {
+        pairs[i].reduce_fn(pairs[i].left, pairs[i].right);
+        reducer_view_free(w, pairs[i].right, pairs[i].right_size);
+    }
+}
+
+// Reduce every view in table into its leftmost view, which is the reducer
+// itself, and delete table.  Used at the end of a parallel region that did not
+// start with the leftmost views of its reducers in its hypertable.
+void reduce_views_into_keys(hyper_table *table) {
+    __cilkrts_worker *w = __cilkrts_get_tls_worker();
+    int32_t capacity = (table->capacity < MIN_HT_CAPACITY) ? table->occupancy
+                                                           : table->capacity;
+    for (int32_t i = 0; i < capacity; ++i) {
+        uintptr_t key = table->keys[i];
+        reducer_base rb = table->values[i];
+        if (!is_valid(key) || rb.view == (void *)key)
+            continue;
+        rb.reduce_fn((void *)key, rb.view);
+        reducer_view_free(w, rb.view, table->view_sizes[i]);
+    }
+    local_hyper_table_free(table);
+}
@@ -10,10 +10,12 @@
 
 typedef uint32_t index_t;
 
-// An entry in the hash table.
+// An entry in the hash table, as inserted into the table.  The table itself
+// stores each field of its entries in a separate array.
 struct bucket {
     uintptr_t key; /* EMPTY, DELETED, or a user-provided pointer. */
     index_t hash;  /* hash of the key when inserted into the table. */
+    uint32_t view_size; /* size of a view made by the runtime, else 0 */
     reducer_base value;
 };
 
@@ -33,7 +35,19 @@ typedef struct local_hyper_table {
     index_t capacity;
     int32_t occupancy;
     int32_t ins_rm_count;
-    struct bucket *buckets;
+    // Number of tables chained at deferred, whose views belong after the views
+    // of this table but have not been reduced into them yet.
+    int32_t chain_length;
+    // The fields of the entries, in arrays that share one allocation starting
+    // at keys.  Probes read only keys and hashes, and a cache line holds eight
+    // keys.
+    uintptr_t *keys;
+    reducer_base *values;
+    index_t *hashes;
+    uint32_t *view_sizes;
+    // Next table in the chain of tables not yet reduced into this one, in
+    // left-to-right order, or NULL.
+    struct local_hyper_table *deferred;
 } hyper_table;
 
 hyper_table *__cilkrts_local_hyper_table_alloc(void);
@@ -48,6 +62,28 @@ bool insert_hyperobject(hyper_table *table, struct bucket b);
 CHEETAH_INTERNAL
 hyper_table *merge_two_hts(hyper_table *restrict left,
                            hyper_table *restrict right);
+CHEETAH_INTERNAL
+hyper_table *defer_merge_two_hts(hyper_table *left, hyper_table *right,
+                                 int32_t max_chain);
+hyper_table *__cilkrts_reduce_deferred_hts(hyper_table *table);
+
+// Two views of a reducer whose reduction a merge left to its caller.
+struct view_pair {
+    void *left;
+    void *right;
+    __cilk_reduce_fn reduce_fn;
+    uint32_t right_size; /* view_size of the right view */
+};
+
+hyper_table *__cilkrts_merge_hts_deferring(hyper_table *left,
+                                           hyper_table *right,
+                                           struct view_pair **pairs,
+                                           int32_t *npairs);
+void __cilkrts_reduce_view_pairs(struct view_pair *pairs, int32_t n);
+CHEETAH_INTERNAL
+void reduce_views_into_keys(hyper_table *table);
+CHEETAH_INTERNAL
+void reducer_view_free(__cilkrts_worker *w, void *view, size_t size);
 
 #ifndef MOCK_HASH
 // Data type for indexing the hash table.  This type is used for
@@ -185,27 +221,28 @@ static inline bool continue_probe(index_t tgt, index_t hash, index_t idx) {
     return (idx - tgt) <= (idx - hash);
 }
 
-static inline struct bucket *find_hyperobject_linear(hyper_table *table,
-                                                     uintptr_t key) {
+static inline reducer_base *find_hyperobject_linear(hyper_table *table,
+                                                    uintptr_t key) {
     // If the table is small enough, just scan the array.
-    struct bucket *buckets = table->buckets;
+    uintptr_t *keys = table->keys;
     int32_t occupancy = table->occupancy;
 
     // Scan the array backwards, since inserts add new entries to
     // the end of the array, and we anticipate that the program
     // will exhibit locality of reference.
     for (int32_t i = occupancy - 1; i >= 0; --i)
-        if (buckets[i].key == key)
-            return &buckets[i];
+        if (keys[i] == key)
+            return &table->values[i];
 
     return NULL;
 }
 
-struct bucket *__cilkrts_find_hyperobject_hash(hyper_table *table,
-                                               uintptr_t key);
+reducer_base *__cilkrts_find_hyperobject_hash(hyper_table *table,
+                                              uintptr_t key);
 
-static inline struct bucket *find_hyperobject(hyper_table *table,
-                                              uintptr_t key) {
+// Return the entry for key in table, or NULL if there is none.
+static inline reducer_base *find_hyperobject(hyper_table *table,
+                                             uintptr_t key) {
     if (table->capacity < MIN_HT_CAPACITY) {
         return find_hyperobject_linear(table, key);
     } else {
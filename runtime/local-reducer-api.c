@@ -47,11 +47,11 @@ CHEETAH_INTERNAL
 void *internal_reducer_lookup(__cilkrts_worker *w, void *key, size_t size,
                               void *identity_ptr, void *reduce_ptr) {
     struct local_hyper_table *table = get_local_hyper_table(w);
-    struct bucket *b = find_hyperobject(table, (uintptr_t)key);
+    reducer_base *b = find_hyperobject(table, (uintptr_t)key);
     if (__builtin_expect(!!b, true)) {
-        CILK_ASSERT_POINTER_EQUAL(key, (void *)b->key);
+        CILK_ASSERT_POINTER_EQUAL(key, (void *)table->keys[b - table->values]);
         // Return the existing view.
-        return b->value.view;
+        return b->view;
     }
 
     return __cilkrts_insert_new_view(table, (uintptr_t)key, size,
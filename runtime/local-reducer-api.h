@@ -5,10 +5,14 @@
 #include "global.h"
 #include "local-hypertable.h"
 
+// Return the hypertable of w, after reducing any tables deferred by joins into
+// it, so that it holds the current views of the strand.
 static inline struct local_hyper_table *
 get_local_hyper_table(__cilkrts_worker *w) {
     if (NULL == w->hyper_table) {
         w->hyper_table = __cilkrts_local_hyper_table_alloc();
+    } else if (__builtin_expect(w->hyper_table->deferred != NULL, false)) {
+        w->hyper_table = __cilkrts_reduce_deferred_hts(w->hyper_table);
     }
     return w->hyper_table;
 }
@@ -19,7 +23,9 @@ get_hyper_table() {
 }
 
 static inline struct local_hyper_table *
-get_local_hyper_table_or_null(const __cilkrts_worker *w) {
+get_local_hyper_table_or_null(__cilkrts_worker *w) {
+    if (w->hyper_table && w->hyper_table->deferred)
+        w->hyper_table = __cilkrts_reduce_deferred_hts(w->hyper_table);
     return w->hyper_table;
 }
 
@@ -11,13 +11,23 @@ struct local_state {
     unsigned short state; /* __cilkrts_worker_state */
     bool provably_good_steal;
     bool exiting;
+    struct cilk_region *exiting_region; /* guest region being exited, if any */
     bool returning;
     unsigned int rand_next;
     uint32_t wake_val;
 
+    /* topology-aware victim selection; see topology.h */
+    int llc_domain;
+    int node_domain;
+    unsigned int steal_level;
+    unsigned int local_fails;
+    int pinned_cpu; /* CPU this worker is pinned to, or -1 */
+
     jmpbuf rts_ctx;
     struct cilk_fiber_pool fiber_pool;
     struct cilk_im_desc im_desc;
+    struct slab_cache closure_cache;
+    struct slab_cache view_cache;
     struct sched_stats stats;
 };
 
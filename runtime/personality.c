@@ -96,11 +96,11 @@ get_exception_reducer_or_null(__cilkrts_worker *w) {
     if (NULL == table)
         return NULL;
 
-    struct bucket *b = find_hyperobject(table, (uintptr_t)key);
+    reducer_base *b = find_hyperobject(table, (uintptr_t)key);
     if (b) {
-        CILK_ASSERT_POINTER_EQUAL(key, (void *)b->key);
+        CILK_ASSERT_POINTER_EQUAL(key, (void *)table->keys[b - table->values]);
         // Return the existing view.
-        return (struct closure_exception *)(b->value.view);
+        return (struct closure_exception *)(b->view);
     }
     // No view was found.  Don't create a new reducer view; just return NULL.
     return NULL;
@@ -110,7 +110,7 @@ get_exception_reducer_or_null(__cilkrts_worker *w) {
 void clear_exception_reducer(__cilkrts_worker *w,
                              struct closure_exception *exn_r) {
     CILK_ASSERT_NULL(exn_r->throwing_fiber);
-    free(exn_r);
+    reducer_view_free(w, exn_r, sizeof(exception_reducer));
     internal_reducer_remove(w, &exception_reducer);
 }
 
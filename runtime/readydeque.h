@@ -18,11 +18,41 @@ typedef struct ReadyDeque ReadyDeque;
 #include "local.h"
 
 // Actual declaration
+#if ENABLE_ARRAY_DEQUE
+// Circular-array representation of the ReadyDeque.  The top and bottom indices
+// are free-running counters, and the deque is empty when they are equal.  As
+// with the linked-list representation, a worker must hold the deque lock to
+// add or remove Closures at the bottom, or to extract a Closure from the top
+// while promoting it, because a steal must extract the top Closure and push the
+// new spawned child onto the victim's bottom as one step.  A ready Closure,
+// however, which a batched steal left on the deque, can be taken from the top
+// without the lock, with a CAS on top, as in a Chase-Lev deque; see
+// deque_steal_ready_top.  Each slot of the ring marks whether its Closure can
+// be taken that way.  Because the indices are atomic, a thief can also check
+// whether a deque is empty without acquiring its lock; see
+// deque_maybe_nonempty.
+struct ReadyDeque {
+    _Atomic(uint32_t) bottom;
+    _Atomic(uintptr_t) ring[ARRAY_DEQUE_CAPACITY];
+    _Atomic(uint32_t) top __attribute__((aligned(CILK_CACHE_LINE)));
+    _Atomic(worker_id) mutex_owner __attribute__((aligned(CILK_CACHE_LINE)));
+    // Number of ready Closures that batched steals have placed on this deque.
+    _Atomic(uint32_t) num_ready;
+} __attribute__((aligned(CILK_CACHE_LINE)));
+
+#define ARRAY_DEQUE_MASK (ARRAY_DEQUE_CAPACITY - 1)
+// Marks a slot of the ring whose Closure thieves can take without the lock.
+#define ARRAY_DEQUE_READY ((uintptr_t)1)
+#else
 struct ReadyDeque {
     Closure *bottom;
     Closure *top __attribute__((aligned(CILK_CACHE_LINE)));
     _Atomic(worker_id) mutex_owner __attribute__((aligned(CILK_CACHE_LINE)));
+    // Number of ready Closures that batched steals have placed on this deque.
+    // Only modified while holding the deque lock.
+    _Atomic(uint32_t) num_ready;
 } __attribute__((aligned(CILK_CACHE_LINE)));
+#endif
 
 /*********************************************************
  * Management of ReadyDeques
@@ -91,6 +121,269 @@ static inline void deque_unlock(ReadyDeque *deques, worker_id self,
                           memory_order_release);
 }
 
+// Get the number of ready Closures on worker pn's deque.  Without the deque
+// lock, the result is only a hint.
+static inline uint32_t deque_num_ready(ReadyDeque *deques, worker_id pn) {
+    return atomic_load_explicit(&deques[pn].num_ready, memory_order_relaxed);
+}
+
+static inline void deque_add_num_ready(ReadyDeque *deques, worker_id self,
+                                       worker_id pn, int32_t val) {
+#if ENABLE_ARRAY_DEQUE
+    // Thieves take ready Closures from an array deque without its lock.
+    (void)self;
+    atomic_fetch_add_explicit(&deques[pn].num_ready, (uint32_t)val,
+                              memory_order_relaxed);
+#else
+    deque_assert_ownership(deques, self, pn);
+    atomic_store_explicit(&deques[pn].num_ready,
+                          deque_num_ready(deques, pn) + val,
+                          memory_order_relaxed);
+#endif
+}
+
+#if ENABLE_ARRAY_DEQUE
+static inline void deque_init(ReadyDeque *deques, worker_id pn) {
+    atomic_store_explicit(&deques[pn].bottom, 0, memory_order_relaxed);
+    atomic_store_explicit(&deques[pn].top, 0, memory_order_relaxed);
+    atomic_store_explicit(&deques[pn].mutex_owner, NO_WORKER,
+                          memory_order_relaxed);
+    atomic_store_explicit(&deques[pn].num_ready, 0, memory_order_relaxed);
+}
+
+// Discard the contents of worker pn's deque.  The caller must hold the lock on
+// that deque.
+static inline void deque_reset(ReadyDeque *deques, worker_id self,
+                               worker_id pn) {
+    deque_assert_ownership(deques, self, pn);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed);
+    atomic_store_explicit(&deques[pn].top, bottom, memory_order_release);
+    atomic_store_explicit(&deques[pn].num_ready, 0, memory_order_relaxed);
+}
+
+// Check, without acquiring the deque lock, whether worker pn's deque might
+// contain a Closure.  The result is only a hint, since the deque may change
+// as soon as this function returns.
+static inline bool deque_maybe_nonempty(ReadyDeque *deques, worker_id pn) {
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_relaxed);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed);
+    return top != bottom;
+}
+
+static inline Closure *deque_slot_closure(uintptr_t slot) {
+    return (Closure *)(slot & ~ARRAY_DEQUE_READY);
+}
+
+static inline uintptr_t deque_slot(ReadyDeque *deques, worker_id pn,
+                                   uint32_t index) {
+    return atomic_load_explicit(&deques[pn].ring[index & ARRAY_DEQUE_MASK],
+                                memory_order_relaxed);
+}
+
+/*
+ * Take the top Closure of worker pn's deque without acquiring the deque lock,
+ * if it is a ready Closure that a batched steal left there.  Returns NULL if
+ * the top Closure is not ready, or if another worker extracted it first.  The
+ * caller then owns the Closure, but must still lock it before executing it.
+ */
+static inline Closure *deque_steal_ready_top(ReadyDeque *deques,
+                                             worker_id pn) {
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_acquire);
+    // The owner may have decremented bottom below top while it extracts the
+    // last Closure.
+    if ((int32_t)(bottom - top) <= 0)
+        return NULL;
+
+    uintptr_t slot = deque_slot(deques, pn, top);
+    if (!(slot & ARRAY_DEQUE_READY))
+        return NULL;
+    if (!atomic_compare_exchange_strong_explicit(&deques[pn].top, &top,
+                                                 top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+
+    Closure *cl = deque_slot_closure(slot);
+    CILK_ASSERT(cl->owner_ready_deque == pn);
+    WHEN_CILK_DEBUG(cl->owner_ready_deque = NO_WORKER);
+    return cl;
+}
+
+/*
+ * functions that add/remove elements from the top/bottom
+ * of deques
+ *
+ * The precondition of these functions is that the worker w -> self must have
+ * locked worker pn's deque before entering the function.  The indices are
+ * published with release stores so that deque_maybe_nonempty never observes a
+ * partially updated deque as empty.  Since a thief may take a ready Closure
+ * from the top without the lock, extracting a ready Closure can fail.
+ */
+static inline Closure *deque_xtract_top(ReadyDeque *deques, worker_id self,
+                                        worker_id pn) {
+    deque_assert_ownership(deques, self, pn);
+
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_relaxed);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed);
+    if (top == bottom)
+        return NULL;
+
+    uintptr_t slot = deque_slot(deques, pn, top);
+    if (!atomic_compare_exchange_strong_explicit(&deques[pn].top, &top,
+                                                 top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+
+    Closure *cl = deque_slot_closure(slot);
+    CILK_ASSERT(cl->owner_ready_deque == pn);
+    WHEN_CILK_DEBUG(cl->owner_ready_deque = NO_WORKER);
+
+    return cl;
+}
+
+// Returns NULL if the top Closure is a ready one, which thieves take with
+// deque_steal_ready_top instead.  Any other top Closure stays on the deque
+// until the caller releases the lock.
+static inline Closure *deque_peek_top(ReadyDeque *deques,
+                                      __cilkrts_worker *const w, worker_id self,
+                                      worker_id pn) {
+    (void)w;  // unused if assertions disabled
+
+    deque_assert_ownership(deques, self, pn);
+
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_relaxed);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed);
+    if (top == bottom)
+        return NULL;
+
+    uintptr_t slot = deque_slot(deques, pn, top);
+    if (slot & ARRAY_DEQUE_READY)
+        return NULL;
+    Closure *cl = deque_slot_closure(slot);
+    // See the comment in the linked-list version of deque_peek_top.
+    CILK_ASSERT(cl->owner_ready_deque == pn || (self != pn && cl->root));
+    return cl;
+}
+
+static inline Closure *deque_xtract_bottom(ReadyDeque *deques, worker_id self,
+                                           worker_id pn) {
+    deque_assert_ownership(deques, self, pn);
+
+    // Claim the bottom slot before reading top, so that a thief taking the
+    // last Closure without the lock either sees the claim or changes top.
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deques[pn].bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_relaxed);
+
+    Closure *cl = NULL;
+    if ((int32_t)(bottom - top) >= 0) {
+        uintptr_t slot = deque_slot(deques, pn, bottom);
+        if (bottom != top) {
+            atomic_store_explicit(&deques[pn].bottom, bottom,
+                                  memory_order_release);
+            cl = deque_slot_closure(slot);
+        } else {
+            // Race with thieves for the last Closure.
+            if (atomic_compare_exchange_strong_explicit(
+                    &deques[pn].top, &top, top + 1, memory_order_seq_cst,
+                    memory_order_relaxed))
+                cl = deque_slot_closure(slot);
+            atomic_store_explicit(&deques[pn].bottom, bottom + 1,
+                                  memory_order_release);
+        }
+    } else {
+        atomic_store_explicit(&deques[pn].bottom, bottom + 1,
+                              memory_order_release);
+    }
+    if (cl) {
+        CILK_ASSERT(cl->owner_ready_deque == pn);
+        WHEN_CILK_DEBUG(cl->owner_ready_deque = NO_WORKER);
+    }
+
+    return cl;
+}
+
+static inline Closure *
+deque_peek_bottom(ReadyDeque *deques, worker_id self, worker_id pn) {
+    deque_assert_ownership(deques, self, pn);
+
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_relaxed);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed);
+    if (top == bottom)
+        return NULL;
+
+    uintptr_t slot = deque_slot(deques, pn, bottom - 1);
+    Closure *cl = deque_slot_closure(slot);
+    CILK_ASSERT((slot & ARRAY_DEQUE_READY) || cl->owner_ready_deque == pn);
+    return cl;
+}
+
+static inline void deque_add_bottom(ReadyDeque *deques, Closure *cl,
+                                    worker_id self, worker_id pn) {
+    deque_assert_ownership(deques, self, pn);
+    CILK_ASSERT(cl->owner_ready_deque == NO_WORKER);
+
+    uint32_t top = atomic_load_explicit(&deques[pn].top, memory_order_relaxed);
+    uint32_t bottom =
+        atomic_load_explicit(&deques[pn].bottom, memory_order_relaxed);
+    if (__builtin_expect(bottom - top >= ARRAY_DEQUE_CAPACITY, false))
+        cilkrts_bug("ReadyDeque of worker %u overflowed (capacity %u)", pn,
+                    ARRAY_DEQUE_CAPACITY);
+
+    // A ready Closure stays ready until it is extracted from the deque.
+    uintptr_t slot = (uintptr_t)cl;
+    if (cl->status == CLOSURE_READY && !cl->root)
+        slot |= ARRAY_DEQUE_READY;
+    atomic_store_explicit(&deques[pn].ring[bottom & ARRAY_DEQUE_MASK], slot,
+                          memory_order_relaxed);
+    WHEN_CILK_DEBUG(cl->owner_ready_deque = pn);
+    atomic_store_explicit(&deques[pn].bottom, bottom + 1, memory_order_release);
+}
+
+#else // !ENABLE_ARRAY_DEQUE
+
+static inline void deque_init(ReadyDeque *deques, worker_id pn) {
+    deques[pn].top = NULL;
+    deques[pn].bottom = NULL;
+    deques[pn].mutex_owner = NO_WORKER;
+    deques[pn].num_ready = 0;
+}
+
+// Discard the contents of worker pn's deque.  The caller must hold the lock on
+// that deque.
+static inline void deque_reset(ReadyDeque *deques, worker_id self,
+                               worker_id pn) {
+    deque_assert_ownership(deques, self, pn);
+    deques[pn].bottom = (Closure *)NULL;
+    deques[pn].top = (Closure *)NULL;
+    deques[pn].num_ready = 0;
+}
+
+// The linked-list deque cannot be inspected safely without its lock, so
+// conservatively report that it might contain a Closure.
+static inline bool deque_maybe_nonempty(ReadyDeque *deques, worker_id pn) {
+    (void)deques;
+    (void)pn;
+    return true;
+}
+
+// Nor can a Closure be taken from it without its lock.
+static inline Closure *deque_steal_ready_top(ReadyDeque *deques,
+                                             worker_id pn) {
+    (void)deques;
+    (void)pn;
+    return NULL;
+}
+
 /*
  * functions that add/remove elements from the top/bottom
  * of deques
@@ -142,10 +435,9 @@ static inline Closure *deque_peek_top(ReadyDeque *deques,
     if (cl) {
         // If w is stealing, then it may peek the top of the deque of the worker
         // who is in the midst of exiting a Cilkified region.  In that case, cl
-        // will be the root closure, and cl->owner_ready_deque is not
+        // will be a root closure, and cl->owner_ready_deque is not
         // necessarily pn.  The steal will subsequently fail do_dekker_on.
-        CILK_ASSERT(cl->owner_ready_deque == pn ||
-                           (self != pn && cl == w->g->root_closure));
+        CILK_ASSERT(cl->owner_ready_deque == pn || (self != pn && cl->root));
     } else {
         CILK_ASSERT_NULL(deques[pn].bottom);
     }
@@ -222,4 +514,6 @@ static inline void deque_add_bottom(ReadyDeque *deques, Closure *cl,
     }
 }
 
+#endif // ENABLE_ARRAY_DEQUE
+
 #endif
@@ -54,12 +54,108 @@
 #define ENABLE_THIEF_SLEEP 1
 #endif
 
+// How long, in microseconds, idle thieves keep spinning after a cilkified
+// region ends before they go to sleep, so that a region started soon after
+// finds them awake.  Can be overridden via the CILK_HOT_SPIN_USEC environment
+// variable.  With 0, thieves spin for only BUSY_LOOP_SPIN pauses.
+#ifndef DEFAULT_HOT_SPIN_USEC
+#define DEFAULT_HOT_SPIN_USEC 0
+#endif
+
+// Number of thieves to wake at the start of a cilkified region, and that each
+// thief wakes after its first successful steal in the region, so the workers
+// are woken as a tree as parallelism appears.  Can be overridden via the
+// CILK_WAKE_FANOUT environment variable.  With 0, all thieves are woken at
+// once at the start of each region.
+#ifndef DEFAULT_WAKE_FANOUT
+#define DEFAULT_WAKE_FANOUT 0
+#endif
+
+// Interval, in milliseconds, at which a watcher thread rereads the CPU quota
+// of the process's cgroup and limits the number of active workers to it.  Can
+// be overridden via the CILK_CGROUP_WATCH_MSEC environment variable.  With 0,
+// there is no watcher thread.
+#ifndef DEFAULT_CGROUP_WATCH_MSEC
+#define DEFAULT_CGROUP_WATCH_MSEC 0
+#endif
+
+// How the initial number of active workers follows the CPU quota of the
+// process's cgroup; see enum cilk_quota_policy in cgroup.h.  Can be overridden
+// via the CILK_QUOTA_POLICY environment variable.
+#ifndef DEFAULT_QUOTA_POLICY
+#define DEFAULT_QUOTA_POLICY 1 // QUOTA_CEIL
+#endif
+
+// Polling interval of the cgroup watcher thread when a CPU quota limits the
+// active workers and CILK_CGROUP_WATCH_MSEC is not set.  The watcher also
+// samples whether the cgroup is being throttled.
+#ifndef DEFAULT_QUOTA_WATCH_MSEC
+#define DEFAULT_QUOTA_WATCH_MSEC 100
+#endif
+
+// While the cgroup is being throttled, the sleep heuristics count each sentinel
+// as this many, so that more thieves disengage and fewer are reengaged.
+#ifndef THROTTLED_SENTINEL_WEIGHT
+#define THROTTLED_SENTINEL_WEIGHT 2
+#endif
+_Static_assert(THROTTLED_SENTINEL_WEIGHT >= 1, "Invalid Cheetah RTS config: THROTTLED_SENTINEL_WEIGHT must be at least 1");
+
 #ifndef ENABLE_EXTENSION
 #define ENABLE_EXTENSION 1
 #endif
 
-#ifndef ENABLE_WORKER_PINNING
-#define ENABLE_WORKER_PINNING 0
+// Default policy for pinning workers to CPUs; see enum cilk_pin_policy in
+// topology.h.  Can be overridden via the CILK_PIN environment variable.
+#ifndef DEFAULT_PIN_POLICY
+#define DEFAULT_PIN_POLICY 0 // PIN_NONE
+#endif
+
+// Represent each worker's ReadyDeque as a circular array with atomic top and
+// bottom indices, rather than as a doubly-linked list of Closures.  Thieves can
+// then recognize an empty deque without writing to the deque lock, and take
+// the ready Closures that batched steals leave on deques without the lock.
+#ifndef ENABLE_ARRAY_DEQUE
+#define ENABLE_ARRAY_DEQUE 0
+#endif
+
+#ifndef ARRAY_DEQUE_CAPACITY
+#define ARRAY_DEQUE_CAPACITY 16 // must be a power of 2
+#endif
+
+_Static_assert((ARRAY_DEQUE_CAPACITY & (ARRAY_DEQUE_CAPACITY - 1)) == 0, "Invalid Cheetah RTS config: ARRAY_DEQUE_CAPACITY must be a power of 2");
+
+// Size and alignment of the slabs from which each worker allocates closures.
+#ifndef CLOSURE_SLAB_SIZE
+#define CLOSURE_SLAB_SIZE 65536 // must be a power of 2
+#endif
+
+_Static_assert((CLOSURE_SLAB_SIZE & (CLOSURE_SLAB_SIZE - 1)) == 0, "Invalid Cheetah RTS config: CLOSURE_SLAB_SIZE must be a power of 2");
+
+// Reducer views of at most VIEW_SLOT_SIZE bytes are allocated from per-worker
+// slabs of VIEW_SLAB_SIZE bytes instead of malloc.  Each slot is aligned to
+// its size.
+#ifndef VIEW_SLOT_SIZE
+#define VIEW_SLOT_SIZE 16 // must be a power of 2
+#endif
+
+#ifndef VIEW_SLAB_SIZE
+#define VIEW_SLAB_SIZE 16384 // must be a power of 2
+#endif
+
+_Static_assert((VIEW_SLOT_SIZE & (VIEW_SLOT_SIZE - 1)) == 0, "Invalid Cheetah RTS config: VIEW_SLOT_SIZE must be a power of 2");
+_Static_assert((VIEW_SLAB_SIZE & (VIEW_SLAB_SIZE - 1)) == 0, "Invalid Cheetah RTS config: VIEW_SLAB_SIZE must be a power of 2");
+
+// Chunks' worth of free internal-malloc blocks of each size to keep in the
+// shared free lists before returning idle chunks to the system.
+#ifndef INTERNAL_MALLOC_RETAIN_CHUNKS
+#define INTERNAL_MALLOC_RETAIN_CHUNKS 1
+#endif
+
+// Length of the intervals over which the shared free lists track their
+// low-water marks.  Only free blocks below the low-water mark of a whole
+// interval, which no worker needed in that time, are returned to the system.
+#ifndef INTERNAL_MALLOC_RELEASE_NSEC
+#define INTERNAL_MALLOC_RELEASE_NSEC 100000000 // 100 ms
 #endif
 
 #ifndef MIN_NUM_PAGES_PER_STACK
@@ -68,8 +164,11 @@
 
 _Static_assert(MIN_NUM_PAGES_PER_STACK >= 2, "Invalid Cheetah RTS config: MIN_NUM_PAGES_PER_STACK must be at least 2");
 
+// Stacks are mapped without reserving memory for them up front, so a large
+// stack costs only address space until its pages are touched.  The default
+// limit admits the 100 MB that CILK_STACKSIZE allows with 4 KB pages.
 #ifndef MAX_NUM_PAGES_PER_STACK
-#define MAX_NUM_PAGES_PER_STACK 2000
+#define MAX_NUM_PAGES_PER_STACK 25600
 #endif
 
 _Static_assert(MAX_NUM_PAGES_PER_STACK >= MIN_NUM_PAGES_PER_STACK, "Invalid Cheetah RTS config: MAX_NUM_PAGES_PER_STACK must be at least MIN_NUM_PAGES_PER_STACK");
@@ -90,10 +189,133 @@ _Static_assert(MAX_NUM_PAGES_PER_STACK >= MIN_NUM_PAGES_PER_STACK, "Invalid Chee
 #define DEFAULT_STACK_SIZE (1U << LG_STACK_SIZE) // 1 MBytes
 #endif
 
+// Whether to report a fault in the guard page of a fiber stack as a stack
+// overflow, from a SIGSEGV handler.  The handler is only installed if the
+// program has not installed its own.  Can be overridden via the
+// CILK_STACK_CHECK environment variable.
+#ifndef DEFAULT_STACK_CHECK
+#define DEFAULT_STACK_CHECK 1
+#endif
+
+// Number of fiber stacks to reserve in an arena up front, or 0 to map each
+// stack separately.  Can be overridden via the CILK_FIBER_ARENA environment
+// variable, and CILK_FIBER_ARENA_THP=1 asks for transparent huge pages.
+#ifndef DEFAULT_FIBER_ARENA
+#define DEFAULT_FIBER_ARENA 0
+#endif
+
+// Pages at the top of each arena stack to touch when the arena is created.
+// Can be overridden via the CILK_FIBER_PREFAULT environment variable.
+#ifndef DEFAULT_FIBER_PREFAULT
+#define DEFAULT_FIBER_PREFAULT 0
+#endif
+
+// Bytes at the top of the stack of each idle fiber to keep resident.  Pages
+// below are released to the system, or 0 disables this, when a fiber moves to
+// a shared pool, or stayed in a worker's pool, unused, from one time the worker
+// went to sleep to the next.  Can be overridden via the CILK_FIBER_TRIM
+// environment variable, and CILK_FIBER_TRIM_LAZY=1 releases pages with
+// MADV_FREE instead of MADV_DONTNEED.
+#ifndef DEFAULT_FIBER_TRIM
+#define DEFAULT_FIBER_TRIM (64 * 1024)
+#endif
+
+// Number of hypertables whose reduction a join may defer, or 0 to reduce the
+// views of joined strands eagerly.  Deferred tables are reduced when a strand
+// looks up a reducer, at the end of the region, or when a chain grows longer.
+// Can be overridden via the CILK_LAZY_REDUCE environment variable.
+#ifndef DEFAULT_LAZY_REDUCE
+#define DEFAULT_LAZY_REDUCE 0
+#endif
+// Joins walk the chain of deferred tables, so keep it short.
+#define MAX_LAZY_REDUCE 1024
+
+// Number of entries in both hypertables of a join above which the reductions
+// of their views run as parallel tasks, spawned when the frame resumes after
+// its sync, or 0 to run them serially during the join.  Worthwhile when
+// reductions are expensive.  Can be overridden via the CILK_PARALLEL_REDUCE
+// environment variable.
+#ifndef DEFAULT_PARALLEL_REDUCE
+#define DEFAULT_PARALLEL_REDUCE 0
+#endif
+
 #ifndef DEFAULT_FIBER_POOL_CAP
 #define DEFAULT_FIBER_POOL_CAP 8 // initial per-worker fiber pool capacity
 #endif
 
+#ifndef DEFAULT_STEAL_BATCH
+#define DEFAULT_STEAL_BATCH 1 // max frames a thief promotes per steal
+#endif
+
+#ifndef MAX_STEAL_BATCH
+#define MAX_STEAL_BATCH 8
+#endif
+
+_Static_assert(DEFAULT_STEAL_BATCH >= 1 && DEFAULT_STEAL_BATCH <= MAX_STEAL_BATCH, "Invalid Cheetah RTS config: DEFAULT_STEAL_BATCH must be between 1 and MAX_STEAL_BATCH");
+_Static_assert(MAX_STEAL_BATCH + 4 <= ARRAY_DEQUE_CAPACITY, "Invalid Cheetah RTS config: ARRAY_DEQUE_CAPACITY is too small for MAX_STEAL_BATCH");
+
+#ifndef DEFAULT_STEAL_LOCAL
+// Failed steal attempts at each level of the topology before a thief looks
+// farther away for a victim.  0 selects victims uniformly at random.
+#define DEFAULT_STEAL_LOCAL 0
+#endif
+
+// Defaults for the policy that thieves use to back off, sleep, and disengage
+// when they fail to steal.  Each can be overridden at run time via environment
+// variables or __cilkrts_set_sleep_policy().
+#ifndef DEFAULT_STEAL_ATTEMPTS
+#define DEFAULT_STEAL_ATTEMPTS 4 // steal attempts per round
+#endif
+
+#ifndef DEFAULT_SENTINEL_THRESHOLD
+#define DEFAULT_SENTINEL_THRESHOLD 128 // failed steals to become a sentinel
+#endif
+
+#ifndef DEFAULT_AS_RATIO
+#define DEFAULT_AS_RATIO 2 // target ratio of active workers to sentinels
+#endif
+
+#ifndef DEFAULT_SLEEP_HISTORY_LENGTH
+#define DEFAULT_SLEEP_HISTORY_LENGTH 32
+#endif
+
+#define MAX_SLEEP_HISTORY_LENGTH 32 // number of bits in history_t
+
+#ifndef DEFAULT_NAP_NSEC
+#define DEFAULT_NAP_NSEC 25000
+#endif
+
+#ifndef DEFAULT_SLEEP_NSEC
+#define DEFAULT_SLEEP_NSEC DEFAULT_NAP_NSEC
+#endif
+
+// Delay per steal attempt between rounds of steal attempts, and additional
+// delay for thieves that have failed many steal attempts.  Measured in cycles
+// on x86-64 and in pause instructions on arm64.
+#ifndef DEFAULT_BACKOFF
+#ifdef __aarch64__
+#define DEFAULT_BACKOFF 200
+#else
+#define DEFAULT_BACKOFF 450
+#endif
+#endif
+
+#ifndef DEFAULT_BACKOFF_FAIL
+#ifdef __aarch64__
+#define DEFAULT_BACKOFF_FAIL 50
+#else
+#define DEFAULT_BACKOFF_FAIL 650
+#endif
+#endif
+
+#ifndef DEFAULT_SLEEP_ADAPTIVE
+#define DEFAULT_SLEEP_ADAPTIVE 0 // scale the back-off by steal success rate
+#endif
+
+_Static_assert((DEFAULT_SENTINEL_THRESHOLD & (DEFAULT_SENTINEL_THRESHOLD - 1)) == 0, "Invalid Cheetah RTS config: DEFAULT_SENTINEL_THRESHOLD must be a power of 2");
+_Static_assert(DEFAULT_STEAL_ATTEMPTS >= 1 && DEFAULT_SENTINEL_THRESHOLD % DEFAULT_STEAL_ATTEMPTS == 0, "Invalid Cheetah RTS config: DEFAULT_STEAL_ATTEMPTS must divide DEFAULT_SENTINEL_THRESHOLD");
+_Static_assert(DEFAULT_SLEEP_HISTORY_LENGTH >= 4 && DEFAULT_SLEEP_HISTORY_LENGTH <= MAX_SLEEP_HISTORY_LENGTH, "Invalid Cheetah RTS config: DEFAULT_SLEEP_HISTORY_LENGTH must be between 4 and MAX_SLEEP_HISTORY_LENGTH");
+
 #ifndef MAX_CALLBACKS
 #define MAX_CALLBACKS 32 // Maximum number of init or exit callbacks
 #endif
@@ -60,6 +60,7 @@ void cilk_global_sched_stats_init(struct global_sched_stats *s) {
     s->boss_end = 0;
     s->exit_time = 0;
     s->steals = 0;
+    s->steal_frames = 0;
     s->repos = 0;
     s->reeng_rqsts = 0;
     s->onesen_rqsts = 0;
@@ -77,6 +78,7 @@ void cilk_sched_stats_init(struct sched_stats *s) {
         s->count[i] = 0;
     }
     s->steals = 0;
+    s->steal_frames = 0;
     s->repos = 0;
     s->reeng_rqsts = 0;
     s->onesen_rqsts = 0;
@@ -164,6 +166,7 @@ static void sched_stats_reset_worker(__cilkrts_worker *w,
         l->stats.count[t] = 0;
     }
     l->stats.steals = 0;
+    l->stats.steal_frames = 0;
     l->stats.repos = 0;
     l->stats.reeng_rqsts = 0;
     l->stats.onesen_rqsts = 0;
@@ -189,11 +192,13 @@ static void sched_stats_print_worker(__cilkrts_worker *w, void *data) {
         fprintf(fp, FIELD_DESC, tmp, tmp_count);
     }
     g->stats.steals += l->stats.steals;
+    g->stats.steal_frames += l->stats.steal_frames;
     g->stats.repos += l->stats.repos;
     g->stats.reeng_rqsts += l->stats.reeng_rqsts;
     g->stats.onesen_rqsts += l->stats.onesen_rqsts;
 
     fprintf(stderr, COUNT_DESC, l->stats.steals);
+    fprintf(stderr, COUNT_DESC, l->stats.steal_frames);
     fprintf(stderr, COUNT_DESC, l->stats.repos);
     fprintf(stderr, COUNT_DESC, l->stats.reeng_rqsts);
     fprintf(stderr, COUNT_DESC, l->stats.onesen_rqsts);
@@ -206,6 +211,7 @@ void cilk_sched_stats_print(struct global_state *g) {
         g->stats.count[t] = 0;
     }
     g->stats.steals = 0;
+    g->stats.steal_frames = 0;
     g->stats.repos = 0;
     g->stats.reeng_rqsts = 0;
     g->stats.onesen_rqsts = 0;
@@ -224,6 +230,7 @@ void cilk_sched_stats_print(struct global_state *g) {
         fprintf(stderr, HDR_DESC, enum_to_str(t), "count");
     }
     fprintf(stderr, COUNT_HDR_DESC, "steals");
+    fprintf(stderr, COUNT_HDR_DESC, "frames");
     fprintf(stderr, COUNT_HDR_DESC, "reposses");
     fprintf(stderr, COUNT_HDR_DESC, "reengs");
     fprintf(stderr, COUNT_HDR_DESC, "onesen");
@@ -236,6 +243,7 @@ void cilk_sched_stats_print(struct global_state *g) {
         fprintf(stderr, FIELD_DESC, g->stats.time[t], g->stats.count[t]);
     }
     fprintf(stderr, COUNT_DESC, g->stats.steals);
+    fprintf(stderr, COUNT_DESC, g->stats.steal_frames);
     fprintf(stderr, COUNT_DESC, g->stats.repos);
     fprintf(stderr, COUNT_DESC, g->stats.reeng_rqsts);
     fprintf(stderr, COUNT_DESC, g->stats.onesen_rqsts);
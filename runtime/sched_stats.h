@@ -26,6 +26,7 @@ struct sched_stats {
     uint64_t end[NUMBER_OF_STATS];   // End time of current measurement
 
     uint64_t steals;
+    uint64_t steal_frames; // frames promoted by successful steals
     uint64_t repos;
     uint64_t reeng_rqsts;
     uint64_t onesen_rqsts;
@@ -39,6 +40,7 @@ struct global_sched_stats {
     uint64_t exit_time;
     uint64_t boss_end;
     uint64_t steals;
+    uint64_t steal_frames; // frames promoted by successful steals
     uint64_t repos;
     uint64_t reeng_rqsts;
     uint64_t onesen_rqsts;
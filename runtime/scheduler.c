@@ -8,6 +8,7 @@
 #endif
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unwind.h>
 
 #ifdef __APPLE__
@@ -26,6 +27,7 @@
 #include "local.h"
 #include "readydeque.h"
 #include "scheduler.h"
+#include "topology.h"
 #include "worker_coord.h"
 #include "worker_sleep.h"
 
@@ -37,8 +39,10 @@
 // pedigrees.
 bool __cilkrts_use_extension = false;
 
-// Boolean tracking whether the execution is currently in a cilkified region.
-bool __cilkrts_need_to_cilkify = true;
+// Boolean tracking whether this thread is currently executing in a cilkified
+// region.  It is thread-local so that threads can start cilkified regions on
+// different runtime instances independently.
+__thread bool __cilkrts_need_to_cilkify = true;
 
 // TLS pointer to the current worker structure.
 __thread __cilkrts_worker *__cilkrts_tls_worker = &default_worker;
@@ -322,6 +326,25 @@ static Closure *provably_good_steal_maybe(__cilkrts_worker *const w,
     return NULL;
 }
 
+// Join the hypertables of two strands, left and right, at a return or a sync.
+// With CILK_LAZY_REDUCE, the views are not reduced until a strand needs them.
+// With CILK_PARALLEL_REDUCE, the views of large tables are reduced in parallel
+// once the frame resumes after its sync, by __cilkrts_reduce_after_sync.
+static inline hyper_table *join_hts(__cilkrts_worker *w, hyper_table *left,
+                                    hyper_table *right) {
+    int32_t max_chain = w->g->options.lazy_reduce;
+    if (max_chain > 0)
+        return defer_merge_two_hts(left, right, max_chain);
+    if (left && right) {
+        int32_t min_parallel = w->g->options.parallel_reduce;
+        if (left->deferred || right->deferred ||
+            (min_parallel > 0 && left->occupancy >= min_parallel &&
+             right->occupancy >= min_parallel))
+            return defer_merge_two_hts(left, right, MAX_LAZY_REDUCE);
+    }
+    return merge_two_hts(left, right);
+}
+
 /***
  * Return protocol for a spawned child.
  *
@@ -420,10 +443,10 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
 
         // merge reducers
         if (lht) {
-            active_ht = merge_two_hts(lht, active_ht);
+            active_ht = join_hts(w, lht, active_ht);
         }
         if (rht) {
-            active_ht = merge_two_hts(active_ht, rht);
+            active_ht = join_hts(w, active_ht, rht);
         }
 
         Closure_lock(self, parent);
@@ -491,7 +514,7 @@ static Closure *Closure_return(__cilkrts_worker *const w, worker_id self,
         hyper_table *active_ht = parent->user_ht;
         parent->child_ht = NULL;
         parent->user_ht = NULL;
-        w->hyper_table = merge_two_hts(child_ht, active_ht);
+        w->hyper_table = join_hts(w, child_ht, active_ht);
 
         setup_for_execution(w, res);
     }
@@ -767,8 +790,7 @@ static Closure *promote_child(__cilkrts_stack_frame **head, ReadyDeque *deques,
      * stacklet is stolen, and it's call parent is promoted into full and
      * suspended
      */
-    CILK_ASSERT(cl == w->g->root_closure || cl->spawn_parent ||
-                       cl->call_parent);
+    CILK_ASSERT(cl->root || cl->spawn_parent || cl->call_parent);
 
     Closure *spawn_parent = NULL;
     __cilkrts_stack_frame *frame_to_steal = *head;
@@ -984,6 +1006,90 @@ static Closure *extract_top_spawning_closure(__cilkrts_stack_frame **head,
     return res;
 }
 
+/***
+ * Continue a successful steal from the victim by promoting up to max_frames
+ * more of the oldest frames on the victim's shadow stack.  Each frame is
+ * promoted exactly as a separate steal would promote it, including the
+ * exception-pointer handshake, but without releasing and reacquiring the
+ * victim's deque lock or searching for a new victim.  The promoted closures are
+ * stored in extra[], oldest first, and are ready to execute.
+ *
+ * Assumes that w holds the lock on the victim's deque, which remains locked.
+ ***/
+static unsigned int steal_more_frames(ReadyDeque *deques,
+                                      __cilkrts_worker *const w,
+                                      __cilkrts_worker *const victim_w,
+                                      worker_id self, worker_id victim,
+                                      unsigned int max_frames,
+                                      Closure **extra) {
+    unsigned int n = 0;
+    while (n < max_frames) {
+        Closure *cl = deque_peek_top(deques, w, self, victim);
+        if (!cl || Closure_trylock(self, cl) == 0)
+            break;
+        if (cl->status != CLOSURE_RUNNING) {
+            Closure_unlock(self, cl);
+            break;
+        }
+        __cilkrts_stack_frame **head = do_dekker_on(self, victim_w, cl);
+        if (!head) {
+            Closure_unlock(self, cl);
+            break;
+        }
+        Closure *res = extract_top_spawning_closure(head, deques, w, victim_w,
+                                                    cl, self, victim);
+        CILK_ASSERT(res->fiber);
+        Closure_assert_ownership(self, res);
+        finish_promote(w, self, victim_w, res,
+                       /* has_frames_to_promote */ false);
+        Closure_unlock(self, res);
+        extra[n++] = res;
+    }
+    return n;
+}
+
+/*
+ * Place the ready closures produced by a batched steal onto this worker's own
+ * deque, oldest on top, where other thieves can steal them and from which this
+ * worker will resume them once it runs out of work.
+ */
+static void push_ready_closures(ReadyDeque *deques, worker_id self,
+                                Closure **extra, unsigned int n) {
+    deque_lock_self(deques, self);
+    for (unsigned int i = 0; i < n; ++i)
+        deque_add_bottom(deques, extra[i], self, self);
+    deque_add_num_ready(deques, self, self, n);
+    deque_unlock_self(deques, self);
+}
+
+/*
+ * Take the youngest ready closure that a batched steal left on this worker's
+ * own deque, and prepare it for execution.  Returns NULL if there is none.
+ */
+static Closure *take_ready_closure(ReadyDeque *deques,
+                                   __cilkrts_worker *const w, worker_id self) {
+    if (__builtin_expect(deque_num_ready(deques, self) == 0, true))
+        return NULL;
+
+    // Extract the closure before locking it, since a thief may take it from
+    // the top of an array deque without the deque lock.
+    deque_lock_self(deques, self);
+    Closure *t = deque_xtract_bottom(deques, self, self);
+    if (t) {
+        Closure_lock(self, t);
+        CILK_ASSERT(t->status == CLOSURE_READY);
+        deque_add_num_ready(deques, self, self, -1);
+    }
+    deque_unlock_self(deques, self);
+
+    if (t) {
+        cilkrts_alert(STEAL, "(take_ready_closure) resuming %p", (void *)t);
+        setup_for_execution(w, t);
+        Closure_unlock(self, t);
+    }
+    return t;
+}
+
 /*
  * stealing protocol.  Tries to steal from the victim; returns a
  * stolen closure, or NULL if none.
@@ -1005,9 +1111,35 @@ static Closure *Closure_steal(__cilkrts_worker **workers,
     __cilkrts_stack_frame **tail =
         atomic_load_explicit(&victim_w->tail, memory_order_relaxed);
     if (head >= tail) {
+        // A batched steal may have left ready closures on the victim's deque,
+        // independent of the victim's shadow stack.
+        if (w->g->options.steal_batch == 1 ||
+            deque_num_ready(deques, victim) == 0)
+            return NULL;
+    }
+
+    // Likewise, avoid writing to the lock of a deque that is empty.
+    if (!deque_maybe_nonempty(deques, victim)) {
         return NULL;
     }
 
+    // A ready closure left on the victim's deque by a batched steal can be
+    // taken without the deque lock, if the deque supports it.
+    if (deque_num_ready(deques, victim) > 0) {
+        cl = deque_steal_ready_top(deques, victim);
+        if (cl) {
+            Closure_lock(self, cl);
+            CILK_ASSERT(cl->status == CLOSURE_READY);
+            deque_add_num_ready(deques, self, victim, -1);
+            cilkrts_alert(STEAL,
+                          "(Closure_steal) took ready closure %p from W%d",
+                          (void *)cl, victim);
+            setup_for_execution(w, cl);
+            Closure_unlock(self, cl);
+            return cl;
+        }
+    }
+
     //----- EVENT_STEAL_ATTEMPT
     if (deque_trylock(deques, self, victim) == 0) {
         return NULL;
@@ -1036,6 +1168,23 @@ static Closure *Closure_steal(__cilkrts_worker **workers,
                 res = extract_top_spawning_closure(head, deques, w, victim_w,
                                                    cl, self, victim);
 
+                // In batched steal mode, promote up to half of the victim's
+                // remaining stealable frames while we still hold the lock.
+                Closure *extra[MAX_STEAL_BATCH];
+                unsigned int n_extra = 0;
+                unsigned int steal_batch = w->g->options.steal_batch;
+                if (steal_batch > 1) {
+                    unsigned int avail =
+                        tail > head ? (unsigned int)(tail - head) / 2 : 0;
+                    unsigned int max_extra =
+                        (avail < steal_batch ? avail : steal_batch);
+                    if (max_extra > 1) {
+                        n_extra = steal_more_frames(deques, w, victim_w, self,
+                                                    victim, max_extra - 1,
+                                                    extra);
+                    }
+                }
+
                 // at this point, more steals can happen from the victim.
                 deque_unlock(deques, self, victim);
 
@@ -1054,11 +1203,35 @@ static Closure *Closure_steal(__cilkrts_worker **workers,
                               (void *)res->right_most_child->fiber);
                 setup_for_execution(w, res);
                 Closure_unlock(self, res);
+
+                // Follow rule A in file PROTOCOLS: res must be unlocked before
+                // this worker locks its own deque.
+                if (n_extra > 0)
+                    push_ready_closures(deques, self, extra, n_extra);
+                WHEN_SCHED_STATS(w->l->stats.steal_frames += 1 + n_extra);
             } else {
                 goto give_up;
             }
             break;
         }
+        case CLOSURE_READY:
+            // A closure left on the victim's deque by a batched steal.  Take
+            // it without any handshake, since no worker is executing it.
+            if (cl->root)
+                goto not_ready;
+            {
+                Closure *cl1 = deque_xtract_top(deques, self, victim);
+                USE_UNUSED(cl1);
+                CILK_ASSERT_POINTER_EQUAL(cl, cl1);
+                deque_add_num_ready(deques, self, victim, -1);
+            }
+            deque_unlock(deques, self, victim);
+            cilkrts_alert(STEAL, "(Closure_steal) took ready closure %p from W%d",
+                          (void *)cl, victim);
+            setup_for_execution(w, cl);
+            Closure_unlock(self, cl);
+            res = cl;
+            break;
         case CLOSURE_RETURNING: /* ok, let it leave alone */
         give_up:
             // MUST unlock the closure before the queue;
@@ -1068,10 +1241,11 @@ static Closure *Closure_steal(__cilkrts_worker **workers,
             break;
 
         default:
-            // It's possible that this steal attempt peeked the root closure
+        not_ready:
+            // It's possible that this steal attempt peeked a root closure
             // from the top of a deque while a new Cilkified region was
             // starting.
-            if (cl != w->g->root_closure)
+            if (!cl->root)
                 cilkrts_bug("Bug: %s closure in ready deque",
                             Closure_status_to_str(cl->status));
         }
@@ -1277,7 +1451,7 @@ int Cilk_sync(__cilkrts_worker *const w, __cilkrts_stack_frame *frame) {
         hyper_table *child_ht = t->child_ht;
         if (child_ht) {
             t->child_ht = NULL;
-            w->hyper_table = merge_two_hts(child_ht, w->hyper_table);
+            w->hyper_table = join_hts(w, child_ht, w->hyper_table);
         }
 
 #if CILK_ENABLE_ASAN_HOOKS
@@ -1342,9 +1516,15 @@ static void do_what_it_says(ReadyDeque *deques, __cilkrts_worker *w,
                 // originally cilkified the execution.
                 if (l->exiting) {
                     l->exiting = false;
-                    global_state *g = w->g;
-                    CILK_EXIT_WORKER_TIMING(g);
-                    signal_uncilkified(g);
+                    struct cilk_region *r = l->exiting_region;
+                    if (r) {
+                        l->exiting_region = NULL;
+                        signal_region_done(r);
+                    } else {
+                        global_state *g = w->g;
+                        CILK_EXIT_WORKER_TIMING(g);
+                        signal_uncilkified(g);
+                    }
                     return;
                 }
 
@@ -1398,6 +1578,156 @@ void do_what_it_says_boss(__cilkrts_worker *w, Closure *t) {
     worker_scheduler(w);
 }
 
+// Choose a random victim from the topology domain of this worker at its current
+// steal level.  Returns NO_WORKER if the domain has no other engaged worker, in
+// which case the caller should move up to the next level.
+static worker_id choose_local_victim(global_state *rts, local_state *l,
+                                     worker_id self, uint32_t stealable,
+                                     unsigned int *rand_state) {
+    int domain = (l->steal_level == STEAL_LEVEL_LLC) ? l->llc_domain
+                                                     : l->node_domain;
+    struct steal_domain *d =
+        topology_domain(rts->topology, l->steal_level, domain);
+    if (!d)
+        return NO_WORKER;
+    uint32_t nmembers =
+        atomic_load_explicit(&d->nmembers, memory_order_acquire);
+    if (nmembers <= 1)
+        return NO_WORKER;
+
+    // Pick uniformly among the other members: this worker is a member, so draw
+    // from all but the last slot and take the last member in place of this
+    // worker.  If the pick is disengaged, take the next engaged member, so that
+    // the level only escalates when no other member of the domain is engaged.
+    uint32_t start = get_rand(*rand_state) % (nmembers - 1);
+    *rand_state = update_rand_state(*rand_state);
+    if (d->members[start] == self)
+        start = nmembers - 1;
+    for (uint32_t i = 0; i < nmembers; ++i) {
+        worker_id victim = d->members[(start + i) % nmembers];
+        if (victim != self && rts->worker_to_index[victim] < stealable)
+            return victim;
+    }
+    return NO_WORKER;
+}
+
+// Update the steal level of this worker after a steal attempt.  A successful
+// steal returns the worker to its LLC domain, and steal_local consecutive
+// failures at a level move the worker up to the next level.
+static inline void update_steal_level(global_state *rts, local_state *l,
+                                      bool success) {
+    if (success) {
+        l->steal_level = STEAL_LEVEL_LLC;
+        l->local_fails = 0;
+    } else if (l->steal_level < STEAL_LEVEL_ALL &&
+               ++l->local_fails >= rts->options.steal_local) {
+        l->steal_level++;
+        l->local_fails = 0;
+    }
+}
+
+// Fixed-point representation of 1 for the adaptive back-off scale.
+#define BACKOFF_SCALE_ONE 16
+#define BACKOFF_SCALE_MIN (BACKOFF_SCALE_ONE / 4)
+#define BACKOFF_SCALE_MAX (BACKOFF_SCALE_ONE * 4)
+// Number of rounds of steal attempts over which to measure the success rate.
+#define BACKOFF_WINDOW 16
+
+// Record the outcome of a round of steal attempts, and at the end of each
+// window of rounds, return a new back-off scale.  The delay between rounds
+// shrinks while at least a quarter of rounds find work and grows while none
+// do.
+static inline unsigned int adapt_backoff_scale(unsigned int scale,
+                                               unsigned int *rounds,
+                                               unsigned int *steals,
+                                               bool success) {
+    *steals += success;
+    if (++*rounds < BACKOFF_WINDOW)
+        return scale;
+    if (*steals * 4 >= *rounds)
+        scale -= scale / 4;
+    else if (*steals == 0)
+        scale += scale / 4;
+    *rounds = 0;
+    *steals = 0;
+    if (scale < BACKOFF_SCALE_MIN)
+        return BACKOFF_SCALE_MIN;
+    if (scale > BACKOFF_SCALE_MAX)
+        return BACKOFF_SCALE_MAX;
+    return scale;
+}
+
+// Spin while the computation appears done, for BUSY_LOOP_SPIN pauses or, in
+// hot-region mode, until rts->options.hot_spin_usec microseconds have passed.
+static void spin_while_done(global_state *rts) {
+    unsigned int busy_fail = 0;
+    while (busy_fail++ < BUSY_LOOP_SPIN &&
+           atomic_load_explicit(&rts->done, memory_order_relaxed)) {
+        busy_pause();
+    }
+    unsigned int hot_spin_usec = rts->options.hot_spin_usec;
+    if (hot_spin_usec == 0)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t deadline = now.tv_sec * 1000000000ULL + now.tv_nsec +
+                        hot_spin_usec * 1000ULL;
+    while (atomic_load_explicit(&rts->done, memory_order_relaxed)) {
+        // Read the clock only occasionally.
+        for (int i = 0; i < 64; ++i)
+            busy_pause();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec * 1000000000ULL + now.tv_nsec >= deadline)
+            return;
+    }
+}
+
+// Returns true if a worker should leave the work-stealing loop, because no
+// region is running or, for the boss, because the boss's own region is done.
+static inline bool stop_stealing(global_state *rts, bool is_boss) {
+    return atomic_load_explicit(&rts->done, memory_order_acquire) ||
+           (is_boss &&
+            !atomic_load_explicit(&rts->cilkified, memory_order_acquire));
+}
+
+// Returns true if worker self should park because it is beyond the worker
+// limit.  Workers stay while guest regions are waiting for a thief, since a
+// guest region queued before the limit dropped might otherwise never start.
+static inline bool should_park(global_state *rts, worker_id self) {
+    return worker_beyond_limit(rts, self) &&
+           !atomic_load_explicit(&rts->npending, memory_order_acquire);
+}
+
+// Take the root closure of a guest region that is waiting for a thief to start
+// it, or return NULL if there is none.
+static Closure *take_pending_region(global_state *rts, __cilkrts_worker *w,
+                                    worker_id self) {
+    if (!atomic_load_explicit(&rts->npending, memory_order_acquire))
+        return NULL;
+
+    pthread_mutex_lock(&rts->region_lock);
+    struct cilk_region *r = rts->pending_regions;
+    if (r) {
+        rts->pending_regions = r->next;
+        if (!r->next)
+            rts->pending_tail = NULL;
+        r->next = rts->running_regions;
+        rts->running_regions = r;
+        atomic_fetch_sub_explicit(&rts->npending, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&rts->region_lock);
+    if (!r)
+        return NULL;
+
+    cilkrts_alert(SCHED, "(take_pending_region) root closure %p",
+                  (void *)r->root_closure);
+    Closure *t = r->root_closure;
+    Closure_lock(self, t);
+    setup_for_execution(w, t);
+    Closure_unlock(self, t);
+    return t;
+}
+
 void worker_scheduler(__cilkrts_worker *w) {
     Closure *t = NULL;
     CILK_ASSERT_POINTER_EQUAL(w, __cilkrts_get_tls_worker());
@@ -1413,14 +1743,29 @@ void worker_scheduler(__cilkrts_worker *w) {
     // reduce sharing on the worker structure.
     local_state *l = w->l;
     unsigned int rand_state = l->rand_next;
+    const bool steal_local = rts->options.steal_local > 0;
+    l->steal_level = STEAL_LEVEL_LLC;
+    l->local_fails = 0;
 
-    // Get the number of workers.  We don't currently support changing the
-    // number of workers dynamically during execution of a Cilkified region.
+    // Get the number of workers.  The number of workers never changes once they
+    // have started; workers beyond the worker limit leave this loop and park.
     unsigned int nworkers = rts->nworkers;
 
+    // Take a local copy of the sleep policy.  Changes to the policy take effect
+    // the next time this worker enters the work-stealing loop.
+    const __cilkrts_sleep_policy policy = rts->sleep_policy;
+    const unsigned int steal_attempts = policy.steal_attempts;
+    // Scale factor for the delay between rounds of steal attempts, in
+    // sixteenths, which the adaptive policy adjusts.
+    unsigned int backoff_scale = BACKOFF_SCALE_ONE;
+    unsigned int backoff_rounds = 0, backoff_steals = 0;
+    // Number of thieves this worker wakes after its first successful steal.
+    // The boss wakes the first thieves when it starts the region.
+    unsigned int wake_fanout = is_boss ? 0 : rts->options.wake_fanout;
+
     // Initialize count of consecutive failed steal attempts.
-    unsigned int fails = init_fails(l->wake_val, rts);
-    unsigned int sample_threshold = SENTINEL_THRESHOLD;
+    unsigned int fails = init_fails(l->wake_val, rts, &policy);
+    unsigned int sample_threshold = policy.sentinel_threshold;
     // Local history information of the state of the system, for sentinel
     // workers to use to determine when to disengage and how many workers to
     // reengage.
@@ -1435,18 +1780,29 @@ void worker_scheduler(__cilkrts_worker *w) {
     __cilkrts_worker **workers = rts->workers;
     ReadyDeque *deques = rts->deques;
 
-    while (!atomic_load_explicit(&rts->done, memory_order_acquire)) {
+    while (!stop_stealing(rts, is_boss)) {
         /* A worker entering the steal loop must have saved its reducer map into
            the frame to which it belongs. */
         CILK_ASSERT(!w->hyper_table ||
-                           (is_boss && atomic_load_explicit(
-                                           &rts->done, memory_order_acquire)));
+                           (is_boss && stop_stealing(rts, is_boss)));
 
         CILK_STOP_TIMING(w, INTERVAL_SCHED);
 
-        while (!t && !atomic_load_explicit(&rts->done, memory_order_acquire)) {
+        while (!t && !stop_stealing(rts, is_boss)) {
             CILK_START_TIMING(w, INTERVAL_SCHED);
             CILK_START_TIMING(w, INTERVAL_IDLE);
+            // Before looking for a victim, resume any ready closure that a
+            // batched steal left on this worker's own deque.
+            t = take_ready_closure(deques, w, self);
+            // Then start any guest region waiting for a thief.  The boss leaves
+            // guest regions to the other workers, so that it can return to its
+            // caller as soon as its own region is done.
+            if (!t && !is_boss)
+                t = take_pending_region(rts, w, self);
+            // Park once this worker is out of work and beyond the worker
+            // limit.
+            if (!t && !is_boss && should_park(rts, self))
+                break;
 #if ENABLE_THIEF_SLEEP
             // Get the set of workers we can steal from and a local copy of the
             // index-to-worker map.  We'll attempt a few steals using these
@@ -1458,7 +1814,7 @@ void worker_scheduler(__cilkrts_worker *w) {
             __attribute__((unused))
             uint32_t sentinel = recent_sentinel_count / SENTINEL_COUNT_HISTORY;
 
-            if (__builtin_expect(stealable == 1, false))
+            if (__builtin_expect(stealable == 1, false) && !t)
                 // If this worker detects only 1 stealable worker, then its the
                 // only worker in the work-stealing loop.
                 continue;
@@ -1477,28 +1833,50 @@ void worker_scheduler(__cilkrts_worker *w) {
                               : (sentinel >> (8 * sizeof(lg_sentinel) -
                                               __builtin_clz(lg_sentinel)));
 #endif
-            const unsigned int NAP_THRESHOLD = SENTINEL_THRESHOLD * 64;
+            const unsigned int NAP_THRESHOLD = policy.sentinel_threshold * 64;
 
 #if !defined(__aarch64__) && !defined(__APPLE__)
             uint64_t start = __builtin_readcyclecounter();
 #endif // !defined(__aarch64__) && !defined(__APPLE__)
-            int attempt = ATTEMPTS;
-            do {
-                // Choose a random victim not equal to self.
-                worker_id victim =
-                        index_to_worker[get_rand(rand_state) % stealable];
-                rand_state = update_rand_state(rand_state);
-                while (victim == self) {
+            int attempt = steal_attempts;
+            while (!t && attempt-- > 0) {
+                worker_id victim = NO_WORKER;
+                // With topology-aware stealing, first look for a victim near
+                // this worker.
+                while (steal_local && victim == NO_WORKER &&
+                       l->steal_level < STEAL_LEVEL_ALL) {
+                    victim = choose_local_victim(rts, l, self, stealable,
+                                                 &rand_state);
+                    if (victim == NO_WORKER) {
+                        l->steal_level++;
+                        l->local_fails = 0;
+                    }
+                }
+                if (victim == NO_WORKER) {
+                    // Choose a random victim not equal to self.
                     victim = index_to_worker[get_rand(rand_state) % stealable];
                     rand_state = update_rand_state(rand_state);
+                    while (victim == self) {
+                        victim =
+                            index_to_worker[get_rand(rand_state) % stealable];
+                        rand_state = update_rand_state(rand_state);
+                    }
                 }
                 // Attempt to steal from that victim.
                 t = Closure_steal(workers, deques, w, self, victim);
+                if (steal_local)
+                    update_steal_level(rts, l, t != NULL);
                 if (!t) {
                     // Pause inside this busy loop.
                     busy_loop_pause();
                 }
-            } while (!t && --attempt > 0);
+            }
+
+            if (t && wake_fanout > 0) {
+                // This thief found work, so wake more thieves to help.
+                request_more_thieves(rts, wake_fanout);
+                wake_fanout = 0;
+            }
 
 #if SCHED_STATS
             if (t) { // steal successful
@@ -1512,11 +1890,15 @@ void worker_scheduler(__cilkrts_worker *w) {
 #endif
 
             fails = go_to_sleep_maybe(
-                rts, self, nworkers, NAP_THRESHOLD, w, t, fails,
+                rts, self, nworkers, &policy, NAP_THRESHOLD, w, t, fails,
                 &sample_threshold, &inefficient_history, &efficient_history,
                 sentinel_count_history, &sentinel_count_history_tail,
                 &recent_sentinel_count);
 
+            if (policy.adaptive)
+                backoff_scale = adapt_backoff_scale(
+                    backoff_scale, &backoff_rounds, &backoff_steals, t != NULL);
+
             if (!t) {
                 // Add some delay to the time a worker takes between steal
                 // attempts.  On a variety of systems, this delay seems to
@@ -1536,10 +1918,11 @@ void worker_scheduler(__cilkrts_worker *w) {
                 //   practice.
 #ifndef __APPLE__
 #ifndef __aarch64__
-                uint64_t stop = 450 * ATTEMPTS;
+                uint64_t stop = policy.backoff * steal_attempts;
                 if (fails > stealable)
-                    stop += 650 * ATTEMPTS;
+                    stop += policy.backoff_fail * steal_attempts;
                 stop *= sentinel_div_lg_sentinel;
+                stop = stop * backoff_scale / BACKOFF_SCALE_ONE;
                 // On x86-64, the latency of a pause instruction varies between
                 // microarchitectures.  We use the cycle counter to delay by a
                 // certain amount of time, regardless of the latency of pause.
@@ -1547,14 +1930,15 @@ void worker_scheduler(__cilkrts_worker *w) {
                     busy_pause();
                 }
 #else
-                int pause_count = 200 * ATTEMPTS;
+                unsigned int pause_count = policy.backoff * steal_attempts;
                 if (fails > stealable)
-                    pause_count += 50 * ATTEMPTS;
+                    pause_count += policy.backoff_fail * steal_attempts;
                 pause_count *= sentinel_div_lg_sentinel;
+                pause_count = pause_count * backoff_scale / BACKOFF_SCALE_ONE;
                 // On arm64, we can't necessarily read the cycle counter without
                 // a kernel patch.  Instead, we just perform some number of
                 // pause instructions.
-                for (int i = 0; i < pause_count; ++i)
+                for (unsigned int i = 0; i < pause_count; ++i)
                     busy_pause();
 #endif // __aarch64__
 #endif // __APPLE__
@@ -1566,7 +1950,7 @@ void worker_scheduler(__cilkrts_worker *w) {
         // that t is not NULL before calling do_what_it_says.
         if (t) {
 #if ENABLE_THIEF_SLEEP
-            const unsigned int MIN_FAILS = 2 * ATTEMPTS;
+            const unsigned int MIN_FAILS = 2 * steal_attempts;
             uint64_t start, end;
             // Executing do_what_it_says involves some minimum amount of work,
             // which can be used to amortize the cost of some failed steal
@@ -1583,28 +1967,26 @@ void worker_scheduler(__cilkrts_worker *w) {
                 uint64_t elapsed = end - start;
                 // Decrement the count of failed steal attempts based on the
                 // amount of work done.
-                fails = decrease_fails_by_work(rts, fails, elapsed,
+                fails = decrease_fails_by_work(rts, &policy, fails, elapsed,
                                                &sample_threshold);
-                if (fails < SENTINEL_THRESHOLD) {
+                if (fails < policy.sentinel_threshold) {
                     inefficient_history = 0;
                     efficient_history = 0;
                 }
             } else {
                 fails = 0;
-                sample_threshold = SENTINEL_THRESHOLD;
+                sample_threshold = policy.sentinel_threshold;
             }
 #endif // ENABLE_THIEF_SLEEP
             t = NULL;
+        } else if (!is_boss && should_park(rts, self)) {
+            break;
         } else if (!is_boss &&
                    atomic_load_explicit(&rts->done, memory_order_relaxed)) {
             // If it appears the computation is done, busy-wait for a while
             // before exiting the work-stealing loop, in case another cilkified
             // region is started soon.
-            unsigned int busy_fail = 0;
-            while (busy_fail++ < BUSY_LOOP_SPIN &&
-                   atomic_load_explicit(&rts->done, memory_order_relaxed)) {
-                busy_pause();
-            }
+            spin_while_done(rts);
             if (thief_should_wait(rts)) {
                 break;
             }
@@ -1613,7 +1995,7 @@ void worker_scheduler(__cilkrts_worker *w) {
 
     // Reset the fail count.
 #if ENABLE_THIEF_SLEEP
-    reset_fails(rts, fails);
+    reset_fails(rts, &policy, fails);
 #endif
     l->rand_next = rand_state;
 
@@ -1630,12 +2012,24 @@ void *scheduler_thread_proc(void *arg) {
 
     cilkrts_alert(BOOT, "scheduler_thread_proc");
     __cilkrts_set_tls_worker(w);
+    // Workers only execute Cilk code within cilkified regions.
+    __cilkrts_need_to_cilkify = false;
 
     CILK_ASSERT(w->self != 0);
 
+    // Pin the worker to its CPU, if any, before it initializes its fiber pool.
+    if (w->g->topology) {
+        cilk_topology_pin_worker(w);
+        cilk_topology_register_worker(w);
+    }
+
     // Initialize the worker's fiber pool.  We have each worker do this itself
     // to improve the locality of the initial fibers.
     cilk_fiber_pool_per_worker_init(w);
+    cilk_fiber_stack_check_thread_init();
+    // Likewise fill the worker's pools, if the instance is being warmed up,
+    // before the worker first goes to sleep.
+    worker_warmup(w);
 
     // Avoid redundant lookups of these commonly accessed worker fields.
     const worker_id self = w->self;
@@ -1648,17 +2042,36 @@ void *scheduler_thread_proc(void *arg) {
 
     CILK_START_TIMING(w, INTERVAL_SLEEP_UNCILK);
     do {
+        // While this worker is beyond the worker limit, park it, disengaged so
+        // that thieves do not try to steal from it.
+        if (should_park(rts, self)) {
+            cilkrts_alert(SCHED, "(scheduler_thread_proc) parking");
+            disengage_worker(rts, nworkers, self);
+            cilk_fiber_pool_trim_idle(w);
+            wait_while_parked(rts, self);
+            reengage_worker(rts, nworkers, self);
+        }
+
         l->wake_val = nworkers;
         // Wait for g->start == 1 to start executing the work-stealing loop.  We
         // use a condition variable to wait on g->start, because this approach
         // seems to result in better performance.
         if (thief_should_wait(rts)) {
             disengage_worker(rts, nworkers, self);
+            cilk_fiber_pool_trim_idle(w);
             l->wake_val = thief_wait(rts);
             reengage_worker(rts, nworkers, self);
         }
         CILK_STOP_TIMING(w, INTERVAL_SLEEP_UNCILK);
 
+        // If the worker limit dropped while this worker was waiting, pass its
+        // wake-up on to a worker within the limit and go park.
+        if (!rts->terminate && should_park(rts, self)) {
+            request_more_thieves(rts, 1);
+            CILK_START_TIMING(w, INTERVAL_SLEEP_UNCILK);
+            continue;
+        }
+
         // Check if we should exit this scheduling function.
         if (rts->terminate) {
             return NULL;
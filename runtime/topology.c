@@ -0,0 +1,304 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <pthread.h>
+#ifdef __FreeBSD__
+#include <pthread_np.h>
+#endif
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "global.h"
+#include "local.h"
+#include "topology.h"
+
+#if defined __FreeBSD__ && __FreeBSD__ < 13
+typedef cpuset_t cpu_set_t;
+#endif
+
+#define SYSFS_CPU_DIR "/sys/devices/system/cpu"
+
+// Read the first line of the sysfs file at path into buf.  Returns false if the
+// file cannot be read.
+static bool read_sysfs_line(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    bool ok = (fgets(buf, len, f) != NULL);
+    fclose(f);
+    if (ok)
+        buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+// Parse a CPU list, such as "0-3,8-11", and return the smallest CPU ID in the
+// list, or -1 if the list is malformed.
+static int first_cpu_in_list(const char *list) {
+    char *end;
+    long cpu = strtol(list, &end, 10);
+    if (end == list || cpu < 0)
+        return -1;
+    return (int)cpu;
+}
+
+// Find the LLC domain of the given CPU, which we identify by the smallest CPU
+// ID sharing the highest-level cache of that CPU.
+static int read_cpu_llc(int cpu) {
+    char path[128];
+    char buf[256];
+    int best_level = -1;
+    int domain = -1;
+    for (int index = 0;; ++index) {
+        snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/cache/index%d/level",
+                 cpu, index);
+        if (!read_sysfs_line(path, buf, sizeof(buf)))
+            break;
+        int level = atoi(buf);
+        if (level <= best_level)
+            continue;
+        snprintf(path, sizeof(path),
+                 SYSFS_CPU_DIR "/cpu%d/cache/index%d/shared_cpu_list", cpu,
+                 index);
+        if (!read_sysfs_line(path, buf, sizeof(buf)))
+            continue;
+        best_level = level;
+        domain = first_cpu_in_list(buf);
+    }
+    return domain;
+}
+
+// Read a nonnegative integer from a file in the sysfs directory of the given
+// CPU.  Returns -1 if the file cannot be read.
+static int read_cpu_int(int cpu, const char *file) {
+    char path[128];
+    char buf[32];
+    snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/%s", cpu, file);
+    if (!read_sysfs_line(path, buf, sizeof(buf)))
+        return -1;
+    char *end;
+    long val = strtol(buf, &end, 10);
+    if (end == buf || val < 0)
+        return -1;
+    return (int)val;
+}
+
+// Find the NUMA node of the given CPU from the nodeN link in its sysfs
+// directory.
+static int read_cpu_node(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir)
+        return -1;
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0 &&
+            entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+static void init_domains(struct steal_domain *domains, const int *cpu_domain,
+                         int ncpus, unsigned int nworkers) {
+    for (int cpu = 0; cpu < ncpus; ++cpu) {
+        int d = cpu_domain[cpu];
+        if (d >= 0 && !domains[d].members) {
+            domains[d].members =
+                (worker_id *)calloc(nworkers, sizeof(worker_id));
+            atomic_store_explicit(&domains[d].nmembers, 0,
+                                  memory_order_relaxed);
+        }
+    }
+}
+
+struct cilk_topology *cilk_topology_init(unsigned int nworkers) {
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpus <= 0)
+        return NULL;
+
+    struct cilk_topology *topo =
+        (struct cilk_topology *)calloc(1, sizeof(struct cilk_topology));
+    topo->ncpus = (int)ncpus;
+    topo->cpu_llc = (int *)calloc(ncpus, sizeof(int));
+    topo->cpu_node = (int *)calloc(ncpus, sizeof(int));
+    topo->cpu_core = (int *)calloc(ncpus, sizeof(int));
+    topo->cpu_package = (int *)calloc(ncpus, sizeof(int));
+    topo->llc = (struct steal_domain *)calloc(ncpus, sizeof(struct steal_domain));
+    topo->node =
+        (struct steal_domain *)calloc(ncpus, sizeof(struct steal_domain));
+    cilk_mutex_init(&topo->lock);
+
+    bool found = false;
+    for (int cpu = 0; cpu < ncpus; ++cpu) {
+        int llc = read_cpu_llc(cpu);
+        int node = read_cpu_node(cpu);
+        // Domain IDs index arrays of size ncpus.
+        topo->cpu_llc[cpu] = (llc < ncpus) ? llc : -1;
+        topo->cpu_node[cpu] = (node < ncpus) ? node : -1;
+        if (topo->cpu_node[cpu] >= topo->nnodes)
+            topo->nnodes = topo->cpu_node[cpu] + 1;
+        topo->cpu_core[cpu] = read_cpu_int(cpu, "topology/core_id");
+        topo->cpu_package[cpu] =
+            read_cpu_int(cpu, "topology/physical_package_id");
+        found |= (llc >= 0 || node >= 0 || topo->cpu_core[cpu] >= 0);
+    }
+    if (!found) {
+        cilkrts_alert(BOOT, "(cilk_topology_init) No topology in " SYSFS_CPU_DIR);
+        cilk_topology_destroy(topo);
+        return NULL;
+    }
+
+    init_domains(topo->llc, topo->cpu_llc, ncpus, nworkers);
+    init_domains(topo->node, topo->cpu_node, ncpus, nworkers);
+    return topo;
+}
+
+void cilk_topology_destroy(struct cilk_topology *topo) {
+    if (!topo)
+        return;
+    for (int d = 0; d < topo->ncpus; ++d) {
+        free(topo->llc[d].members);
+        free(topo->node[d].members);
+    }
+    free(topo->llc);
+    free(topo->node);
+    free(topo->cpu_llc);
+    free(topo->cpu_node);
+    free(topo->cpu_core);
+    free(topo->cpu_package);
+    cilk_mutex_destroy(&topo->lock);
+    free(topo);
+}
+
+static void add_to_domain(struct steal_domain *d, worker_id self) {
+    uint32_t n = atomic_load_explicit(&d->nmembers, memory_order_relaxed);
+    for (uint32_t i = 0; i < n; ++i)
+        if (d->members[i] == self)
+            return;
+    d->members[n] = self;
+    atomic_store_explicit(&d->nmembers, n + 1, memory_order_release);
+}
+
+// Pin worker w, which must be the calling worker, to the CPU chosen for it by
+// the pinning policy, if any.
+void cilk_topology_pin_worker(__cilkrts_worker *w) {
+#ifdef CPU_SETSIZE
+    local_state *l = w->l;
+    if (l->pinned_cpu < 0)
+        return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(l->pinned_cpu, &mask);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (err != 0) {
+        cilkrts_alert(BOOT, "(cilk_topology_pin_worker) Cannot pin to cpu %d",
+                      l->pinned_cpu);
+        l->pinned_cpu = -1;
+    }
+#endif
+}
+
+// Record the LLC domain and NUMA node of the CPU that worker w is running on,
+// and add w to those domains.  Called by each worker on its own thread when it
+// starts.  The result is only accurate for the lifetime of the worker if the
+// worker is pinned to a CPU in a single domain.
+void cilk_topology_register_worker(__cilkrts_worker *w) {
+    struct cilk_topology *topo = w->g->topology;
+    local_state *l = w->l;
+    int cpu = l->pinned_cpu >= 0 ? l->pinned_cpu : sched_getcpu();
+    if (!topo || cpu < 0 || cpu >= topo->ncpus)
+        return;
+
+    int llc = topo->cpu_llc[cpu];
+    int node = topo->cpu_node[cpu];
+    cilk_mutex_lock(&topo->lock);
+    if (llc >= 0)
+        add_to_domain(&topo->llc[llc], w->self);
+    if (node >= 0)
+        add_to_domain(&topo->node[node], w->self);
+    cilk_mutex_unlock(&topo->lock);
+    l->llc_domain = llc;
+    l->node_domain = node;
+    cilkrts_alert(BOOT, "(cilk_topology_register_worker) cpu %d llc %d node %d",
+                  cpu, llc, node);
+}
+
+// Sort key for ordering CPUs under a pinning policy.
+struct pin_key {
+    int cpu;
+    int key[3];
+};
+
+static int compare_pin_keys(const void *a, const void *b) {
+    const struct pin_key *x = (const struct pin_key *)a;
+    const struct pin_key *y = (const struct pin_key *)b;
+    for (int i = 0; i < 3; ++i)
+        if (x->key[i] != y->key[i])
+            return x->key[i] < y->key[i] ? -1 : 1;
+    return x->cpu - y->cpu;
+}
+
+// Returns true if CPUs a and b are hardware threads of the same core.
+static bool same_core(const struct cilk_topology *topo, int a, int b) {
+    return topo->cpu_core[a] >= 0 && topo->cpu_core[a] == topo->cpu_core[b] &&
+           topo->cpu_package[a] == topo->cpu_package[b];
+}
+
+// Reorder cpus, the ncpus CPUs available to the process in increasing order,
+// into the order in which workers should be pinned to them under the given
+// policy.  Returns the length of the resulting list, which is less than ncpus
+// for PIN_CORES_ONLY if some cores have more than one hardware thread.
+int cilk_topology_pin_order(const struct cilk_topology *topo,
+                            enum cilk_pin_policy policy, int *cpus,
+                            int ncpus) {
+    struct pin_key *keys =
+        (struct pin_key *)calloc(ncpus, sizeof(struct pin_key));
+    int n = 0;
+    for (int i = 0; i < ncpus; ++i) {
+        int cpu = cpus[i];
+        if (cpu < 0 || cpu >= topo->ncpus)
+            continue;
+        // Rank of this CPU among the available hardware threads of its core.
+        int thread = 0;
+        for (int j = 0; j < i; ++j)
+            if (cpus[j] >= 0 && cpus[j] < topo->ncpus &&
+                same_core(topo, cpus[j], cpu))
+                ++thread;
+        if (policy == PIN_CORES_ONLY && thread > 0)
+            continue;
+
+        struct pin_key *k = &keys[n++];
+        int core = topo->cpu_core[cpu];
+        int package = topo->cpu_package[cpu];
+        k->cpu = cpu;
+        if (policy == PIN_SCATTER) {
+            // Use the first hardware thread of every core before the second,
+            // alternating between packages.
+            k->key[0] = thread;
+            k->key[1] = core;
+            k->key[2] = package;
+        } else {
+            // Keep the hardware threads of a core, and the cores of a package,
+            // together.
+            k->key[0] = package;
+            k->key[1] = core;
+            k->key[2] = thread;
+        }
+    }
+    qsort(keys, n, sizeof(struct pin_key), compare_pin_keys);
+    for (int i = 0; i < n; ++i)
+        cpus[i] = keys[i].cpu;
+    free(keys);
+    return n;
+}
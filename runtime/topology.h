@@ -0,0 +1,69 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+// Machine topology, read from /sys/devices/system/cpu, for placing workers and
+// for choosing nearby victims to steal from.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "rts-config.h"
+#include "types.h"
+
+// Levels of the victim-selection hierarchy.  A thief starts at
+// STEAL_LEVEL_LLC and moves up one level after a number of failed steal
+// attempts at the current level.
+enum steal_level {
+    STEAL_LEVEL_LLC = 0, // workers sharing this worker's last-level cache
+    STEAL_LEVEL_NODE,    // workers on this worker's NUMA node
+    STEAL_LEVEL_ALL,     // any worker
+};
+
+// Policies for pinning workers to CPUs, selected with CILK_PIN.
+enum cilk_pin_policy {
+    PIN_NONE = 0,   // do not pin workers
+    PIN_COMPACT,    // fill each core, then each package, before the next
+    PIN_SCATTER,    // spread workers across packages and cores
+    PIN_CORES_ONLY, // one worker per physical core, compactly
+};
+
+// A set of workers running in the same topology domain.  Workers add
+// themselves to the set when they start, and the set never shrinks.
+struct steal_domain {
+    _Atomic uint32_t nmembers;
+    worker_id *members;
+};
+
+struct cilk_topology {
+    int ncpus;
+    int nnodes; // 1 + the largest NUMA node ID, or 0 if unknown
+    int *cpu_llc;  // LLC domain of each CPU, or -1 if unknown
+    int *cpu_node; // NUMA node of each CPU, or -1 if unknown
+    int *cpu_core; // core ID of each CPU within its package, or -1
+    int *cpu_package; // physical package of each CPU, or -1
+
+    // Domains, indexed by the values in cpu_llc and cpu_node.
+    struct steal_domain *llc;
+    struct steal_domain *node;
+    cilk_mutex lock; // serializes additions to the domains
+};
+
+CHEETAH_INTERNAL struct cilk_topology *cilk_topology_init(unsigned int nworkers);
+CHEETAH_INTERNAL void cilk_topology_destroy(struct cilk_topology *topo);
+CHEETAH_INTERNAL void cilk_topology_register_worker(__cilkrts_worker *w);
+CHEETAH_INTERNAL void cilk_topology_pin_worker(__cilkrts_worker *w);
+CHEETAH_INTERNAL int cilk_topology_pin_order(const struct cilk_topology *topo,
+                                             enum cilk_pin_policy policy,
+                                             int *cpus, int ncpus);
+
+static inline struct steal_domain *
+topology_domain(struct cilk_topology *topo, enum steal_level level,
+                int domain) {
+    if (domain < 0)
+        return NULL;
+    return level == STEAL_LEVEL_LLC ? &topo->llc[domain] : &topo->node[domain];
+}
+
+#endif /* _TOPOLOGY_H */
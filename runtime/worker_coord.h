@@ -60,6 +60,21 @@ static inline void fpost(_Atomic uint32_t *futexp) {
         errExit("futex-FUTEX_WAKE");
 }
 
+// Wake up to `count` threads waiting on the futex pointed to by `futexp`,
+// whose value the caller has already updated.  Skip the system call if no
+// thread has announced in `*waiters` that it might be waiting on the futex.
+// Waiters increment `*waiters` before they check the futex value, so either
+// this routine sees the increment or the waiter sees the new value.
+static inline void fwake_waiters(_Atomic uint32_t *futexp,
+                                 _Atomic uint32_t *waiters, int count) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) == 0)
+        return;
+    long s = futex(futexp, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    if (s == -1)
+        errExit("futex-FUTEX_WAKE");
+}
+
 // Set the futex pointed to by `futexp` to 1, and wake up all threads waiting on
 // that futex.
 static inline void fbroadcast(_Atomic uint32_t *futexp) {
@@ -103,51 +118,108 @@ static inline void set_cilkified(global_state *g) {
 #endif
 }
 
-// Mark the computation as no longer cilkified and signal the thread that
-// originally cilkified the execution.
-static inline void signal_uncilkified(global_state *g) {
+// Clear a flag that is set while something is running, and signal the thread
+// waiting for it to finish, if any.
+static inline void signal_flag_cleared(atomic_bool *flag,
+                                       _Atomic uint32_t *futexp,
+                                       _Atomic uint32_t *waiters,
+                                       pthread_mutex_t *lock,
+                                       pthread_cond_t *cond_var) {
 #if USE_FUTEX
-    atomic_store_explicit(&g->cilkified, 0, memory_order_release);
-    fpost(&g->cilkified_futex);
+    (void)lock;
+    (void)cond_var;
+    atomic_store_explicit(flag, 0, memory_order_release);
+    // The waiting thread is usually still spinning in wait_while_flag_set for
+    // a short region, in which case it needs no system call to wake it.
+    atomic_store_explicit(futexp, 1, memory_order_release);
+    fwake_waiters(futexp, waiters, 1);
 #else
-    pthread_mutex_lock(&(g->cilkified_lock));
-    atomic_store_explicit(&g->cilkified, 0, memory_order_release);
-    pthread_cond_signal(&g->cilkified_cond_var);
-    pthread_mutex_unlock(&(g->cilkified_lock));
+    (void)futexp;
+    (void)waiters;
+    pthread_mutex_lock(lock);
+    atomic_store_explicit(flag, 0, memory_order_release);
+    pthread_cond_signal(cond_var);
+    pthread_mutex_unlock(lock);
 #endif
 }
 
-// Wait on g->cilkified to be set to 0, indicating the end of the Cilkified
-// region.
-static inline void wait_while_cilkified(global_state *g) {
+// Wait for a flag to be cleared by signal_flag_cleared.
+static inline void wait_while_flag_set(atomic_bool *flag,
+                                       _Atomic uint32_t *futexp,
+                                       _Atomic uint32_t *waiters,
+                                       pthread_mutex_t *lock,
+                                       pthread_cond_t *cond_var) {
     unsigned int fail = 0;
     while (fail++ < BUSY_LOOP_SPIN) {
-        if (!atomic_load_explicit(&g->cilkified, memory_order_acquire)) {
+        if (!atomic_load_explicit(flag, memory_order_acquire)) {
             return;
         }
         busy_pause();
     }
 #if USE_FUTEX
-    while (atomic_load_explicit(&g->cilkified, memory_order_acquire)) {
-        fwait(&g->cilkified_futex);
+    (void)lock;
+    (void)cond_var;
+    atomic_fetch_add_explicit(waiters, 1, memory_order_seq_cst);
+    while (atomic_load_explicit(flag, memory_order_acquire)) {
+        fwait(futexp);
     }
+    atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
 #else
+    (void)futexp;
+    (void)waiters;
     // TODO: Convert pthread_mutex_lock, pthread_mutex_unlock, and
     // pthread_cond_wait to cilk_* equivalents.
-    pthread_mutex_lock(&(g->cilkified_lock));
+    pthread_mutex_lock(lock);
 
     // There may be a *very unlikely* scenario where the Cilk computation has
     // already been completed before even starting to wait.  In that case, do
     // not wait and continue directly.  Also handle spurious wakeups with a
     // 'while' instead of an 'if'.
-    while (atomic_load_explicit(&g->cilkified, memory_order_acquire)) {
-        pthread_cond_wait(&(g->cilkified_cond_var), &(g->cilkified_lock));
+    while (atomic_load_explicit(flag, memory_order_acquire)) {
+        pthread_cond_wait(cond_var, lock);
     }
 
-    pthread_mutex_unlock(&(g->cilkified_lock));
+    pthread_mutex_unlock(lock);
+#endif
+}
+
+// Mark the computation as no longer cilkified and signal the thread that
+// originally cilkified the execution.
+static inline void signal_uncilkified(global_state *g) {
+    signal_flag_cleared(&g->cilkified, &g->cilkified_futex,
+                        &g->cilkified_waiters, &g->cilkified_lock,
+                        &g->cilkified_cond_var);
+}
+
+// Wait on g->cilkified to be set to 0, indicating the end of the Cilkified
+// region.
+static inline void wait_while_cilkified(global_state *g) {
+    wait_while_flag_set(&g->cilkified, &g->cilkified_futex,
+                        &g->cilkified_waiters, &g->cilkified_lock,
+                        &g->cilkified_cond_var);
+}
+
+// Routines to control the running state of a guest region.
+
+static inline void set_region_running(struct cilk_region *r) {
+    atomic_store_explicit(&r->running, 1, memory_order_release);
+#if USE_FUTEX
+    atomic_store_explicit(&r->running_futex, 0, memory_order_release);
 #endif
 }
 
+// Mark guest region r as finished and signal the thread that started it.
+static inline void signal_region_done(struct cilk_region *r) {
+    signal_flag_cleared(&r->running, &r->running_futex, &r->waiters,
+                        &r->running_lock, &r->running_cond_var);
+}
+
+// Wait for guest region r to finish.
+static inline void wait_while_region_running(struct cilk_region *r) {
+    wait_while_flag_set(&r->running, &r->running_futex, &r->waiters,
+                        &r->running_lock, &r->running_cond_var);
+}
+
 //=========================================================
 // Operations to disengage and reengage workers within the work-stealing loop.
 //=========================================================
@@ -191,10 +263,8 @@ static inline void request_more_thieves(global_state *g, uint32_t count) {
                 memory_order_relaxed)) {
             // We successfully updated the futex.  Wake the thief threads
             // waiting on this futex.
-            long s = futex(&g->disengaged_thieves_futex, FUTEX_WAKE_PRIVATE,
-                           to_wake, NULL, NULL, 0);
-            if (s == -1)
-                errExit("futex-FUTEX_WAKE");
+            fwake_waiters(&g->disengaged_thieves_futex, &g->disengaged_waiters,
+                          to_wake);
             return;
         }
     }
@@ -220,7 +290,8 @@ static inline void request_more_thieves(global_state *g, uint32_t count) {
 }
 
 #if USE_FUTEX
-static inline uint32_t thief_disengage_futex(_Atomic uint32_t *futexp) {
+static inline uint32_t thief_disengage_futex(_Atomic uint32_t *futexp,
+                                             _Atomic uint32_t *waiters) {
     // This step synchronizes with calls to request_more_thieves.
     while (true) {
         // Decrement the futex when woken up.  The loop and compare-exchange are
@@ -237,7 +308,9 @@ static inline uint32_t thief_disengage_futex(_Atomic uint32_t *futexp) {
         }
 
         // Wait on the futex.
+        atomic_fetch_add_explicit(waiters, 1, memory_order_seq_cst);
         long s = futex(futexp, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+        atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
         if (__builtin_expect(s == -1 && errno != EAGAIN, false))
             errExit("futex-FUTEX_WAIT");
     }
@@ -261,7 +334,8 @@ static inline uint32_t thief_disengage_cond_var(_Atomic uint32_t *count,
 #endif
 static inline uint32_t thief_disengage(global_state *g) {
 #if USE_FUTEX
-    return thief_disengage_futex(&g->disengaged_thieves_futex);
+    return thief_disengage_futex(&g->disengaged_thieves_futex,
+                                 &g->disengaged_waiters);
 #else
     return thief_disengage_cond_var(&g->disengaged_thieves_futex,
                                     &g->disengaged_lock,
@@ -334,22 +408,67 @@ static inline bool thief_should_wait(global_state *g) {
 }
 
 // Signal the thief threads to start work-stealing (or terminate, if
-// g->terminate == 1).
+// g->terminate == 1).  Workers beyond the worker limit are parked and need no
+// signal.
 static inline void wake_thieves(global_state *g) {
+    uint32_t nthieves =
+        atomic_load_explicit(&g->worker_limit, memory_order_relaxed) - 1;
 #if USE_FUTEX
-    atomic_store_explicit(&g->disengaged_thieves_futex, g->nworkers - 1,
+    atomic_store_explicit(&g->disengaged_thieves_futex, nthieves,
                           memory_order_release);
-    long s = futex(&g->disengaged_thieves_futex, FUTEX_WAKE_PRIVATE, INT_MAX,
-                   NULL, NULL, 0);
-    if (s == -1)
-        errExit("futex-FUTEX_WAKE");
+    // Thieves still spinning after the previous region will see the new futex
+    // value without a system call.
+    fwake_waiters(&g->disengaged_thieves_futex, &g->disengaged_waiters,
+                  INT_MAX);
 #else
     pthread_mutex_lock(&g->disengaged_lock);
-    atomic_store_explicit(&g->disengaged_thieves_futex, g->nworkers - 1,
+    atomic_store_explicit(&g->disengaged_thieves_futex, nthieves,
                           memory_order_release);
     pthread_cond_broadcast(&g->disengaged_cond_var);
     pthread_mutex_unlock(&g->disengaged_lock);
 #endif
 }
 
+//=========================================================
+// Operations to park and unpark workers beyond the worker limit.
+//=========================================================
+
+// Returns true if worker self is not below the worker limit, so it should park
+// once it runs out of work.  The boss is never parked.
+static inline bool worker_beyond_limit(global_state *g, worker_id self) {
+    return self >= atomic_load_explicit(&g->worker_limit, memory_order_acquire);
+}
+
+// Called by a thief thread.  Wait until the worker limit is raised above self.
+static inline void wait_while_parked(global_state *g, worker_id self) {
+#if USE_FUTEX
+    atomic_fetch_add_explicit(&g->parked_waiters, 1, memory_order_seq_cst);
+    uint32_t limit;
+    while (self >= (limit = atomic_load_explicit(&g->worker_limit,
+                                                 memory_order_acquire))) {
+        long s = futex(&g->worker_limit, FUTEX_WAIT_PRIVATE, limit, NULL, NULL,
+                       0);
+        if (__builtin_expect(s == -1 && errno != EAGAIN, false))
+            errExit("futex-FUTEX_WAIT");
+    }
+    atomic_fetch_sub_explicit(&g->parked_waiters, 1, memory_order_relaxed);
+#else
+    pthread_mutex_lock(&g->park_lock);
+    while (worker_beyond_limit(g, self))
+        pthread_cond_wait(&g->park_cond_var, &g->park_lock);
+    pthread_mutex_unlock(&g->park_lock);
+#endif
+}
+
+// Wake the parked workers after the caller has raised the worker limit.
+static inline void wake_parked(global_state *g) {
+#if USE_FUTEX
+    fwake_waiters(&g->worker_limit, &g->parked_waiters, INT_MAX);
+#else
+    pthread_mutex_lock(&g->park_lock);
+    pthread_cond_broadcast(&g->park_cond_var);
+    pthread_mutex_unlock(&g->park_lock);
+#endif
+}
+
 #endif /* _WORKER_COORD_H */
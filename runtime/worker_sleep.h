@@ -20,39 +20,30 @@
 #include <mach/mach_time.h>
 #endif // APPLE_ARM64
 
-// Nanoseconds that a sentinel worker should sleep if it reaches the disengage
-// threshold but does not disengage.
-/* #define NAP_NSEC 12500 */
-#define NAP_NSEC 25000
-/* #define NAP_NSEC 50000 */
-/* #define SLEEP_NSEC 4 * NAP_NSEC */
-#define SLEEP_NSEC NAP_NSEC
-
-// Ratio of active workers over sentinels that the system aims to maintain.
-#define AS_RATIO 2
-
-// Threshold for number of consective failed steal attempts to declare a
-// thief as sentinel.  Must be a power of 2.
-#define SENTINEL_THRESHOLD 128
-
-// Number of attempted steals the thief should do each time it copies the
-// worker state.  ATTEMPTS must divide SENTINEL_THRESHOLD.
-#define ATTEMPTS 4
+// The parameters of the sleep logic come from a __cilkrts_sleep_policy, which
+// each thief copies from the global state when it starts stealing.  See
+// cilk_api.h for their meanings and rts-config.h for their defaults.
 
 // Information for histories of efficient and inefficient worker-count samples
 // and for sentinel counts.
 typedef uint32_t history_t;
-#define HISTORY_LENGTH 32
 #define SENTINEL_COUNT_HISTORY 4
+_Static_assert(sizeof(history_t) * CHAR_BIT >= MAX_SLEEP_HISTORY_LENGTH,
+               "history_t is too small for MAX_SLEEP_HISTORY_LENGTH");
 
 // Amount of history that must be efficient/inefficient to reengage/disengage
 // workers.
-#define HISTORY_THRESHOLD (3 * HISTORY_LENGTH / 4)
-/* #define HISTORY_THRESHOLD (1 * HISTORY_LENGTH / 2) */
+__attribute__((always_inline)) static inline int32_t
+history_threshold(const __cilkrts_sleep_policy *policy) {
+    return 3 * policy->history_length / 4;
+}
 
 // Threshold for number of consecutive failed steal attempts to try disengaging
-// this worker.  Must be a multiple of SENTINEL_THRESHOLD and a power of 2.
-#define DISENGAGE_THRESHOLD HISTORY_THRESHOLD * SENTINEL_THRESHOLD
+// this worker.  A multiple of the sentinel threshold.
+__attribute__((always_inline)) static inline unsigned int
+disengage_threshold(const __cilkrts_sleep_policy *policy) {
+    return history_threshold(policy) * policy->sentinel_threshold;
+}
 
 static inline __attribute__((always_inline)) uint64_t gettime_fast(void) {
     // __builtin_readcyclecounter triggers "illegal instruction" errors on ARM64
@@ -197,31 +188,44 @@ get_worker_counts(uint64_t disengaged_sentinel, unsigned int nworkers) {
     return counts;
 }
 
+// Weight of each sentinel in the checks below.  Sentinels count for more while
+// the cgroup of the process is being throttled, because thieves then burn CPU
+// quota that the active workers need.
+__attribute__((always_inline)) static inline int32_t
+sentinel_weight(global_state *const rts) {
+    return atomic_load_explicit(&rts->throttled, memory_order_relaxed)
+               ? THROTTLED_SENTINEL_WEIGHT
+               : 1;
+}
+
 // Check if the given worker counts are inefficient, i.e., if active <
 // sentinels.
 __attribute__((const, always_inline)) static inline history_t
-is_inefficient(worker_counts counts) {
+is_inefficient(worker_counts counts, int32_t as_ratio, int32_t weight) {
     return counts.sentinels > 1 && counts.active >= 1 &&
-           counts.active * AS_RATIO < counts.sentinels * 1;
+           counts.active * as_ratio < counts.sentinels * weight;
 }
 
 // Check if the given worker counts are efficient, i.e., if active >= 2 *
 // sentinels.
 __attribute__((const, always_inline)) static inline history_t
-is_efficient(worker_counts counts) {
-    return (counts.active * 1 >= counts.sentinels * AS_RATIO) ||
+is_efficient(worker_counts counts, int32_t as_ratio, int32_t weight) {
+    return (counts.active * 1 >= counts.sentinels * weight * as_ratio) ||
            (counts.sentinels <= 1);
 }
 
 // Convert the elapsed time spent working into a fail count.
-__attribute__((const, always_inline)) static inline unsigned int
-get_scaled_elapsed(unsigned int elapsed) {
+__attribute__((pure, always_inline)) static inline unsigned int
+get_scaled_elapsed(const __cilkrts_sleep_policy *policy,
+                   unsigned int elapsed) {
 #ifdef __aarch64__
-    return ((elapsed * (2 * SENTINEL_THRESHOLD) / (1 * 65536)) / ATTEMPTS) *
-           ATTEMPTS;
+    return ((elapsed * (2 * policy->sentinel_threshold) / (1 * 65536)) /
+            policy->steal_attempts) *
+           policy->steal_attempts;
 #else
-    return ((elapsed * (1 * SENTINEL_THRESHOLD) / (1 * 65536)) / ATTEMPTS) *
-           ATTEMPTS;
+    return ((elapsed * (1 * policy->sentinel_threshold) / (1 * 65536)) /
+            policy->steal_attempts) *
+           policy->steal_attempts;
 #endif // APPLE_ARM64
 }
 
@@ -229,7 +233,9 @@ get_scaled_elapsed(unsigned int elapsed) {
 // reengage workers.
 __attribute__((always_inline)) static inline unsigned int
 maybe_reengage_workers(global_state *const rts, worker_id self,
-                       unsigned int nworkers, __cilkrts_worker *const w,
+                       unsigned int nworkers,
+                       const __cilkrts_sleep_policy *const policy,
+                       __cilkrts_worker *const w,
                        unsigned int fails,
                        unsigned int *const sample_threshold,
                        history_t *const inefficient_history,
@@ -242,7 +248,7 @@ maybe_reengage_workers(global_state *const rts, worker_id self,
 #endif
     (void)w; // unused if scheduling stats not enabled
 
-    if (fails >= SENTINEL_THRESHOLD) {
+    if (fails >= policy->sentinel_threshold) {
         // This thief is no longer a sentinel.  Decrement the number of
         // sentinels.
         uint64_t disengaged_sentinel = add_to_sentinels(rts, -1);
@@ -256,14 +262,17 @@ maybe_reengage_workers(global_state *const rts, worker_id self,
         unsigned int my_sentinel_count = *recent_sentinel_count;
         if (fails >= *sample_threshold) {
             // Update the inefficient history.
-            history_t curr_ineff = is_inefficient(counts);
-            my_inefficient_history = (my_inefficient_history >> 1) |
-                                     (curr_ineff << (HISTORY_LENGTH - 1));
+            int32_t weight = sentinel_weight(rts);
+            history_t curr_ineff =
+                is_inefficient(counts, policy->as_ratio, weight);
+            my_inefficient_history =
+                (my_inefficient_history >> 1) |
+                (curr_ineff << (policy->history_length - 1));
 
             // Update the efficient history.
-            history_t curr_eff = is_efficient(counts);
+            history_t curr_eff = is_efficient(counts, policy->as_ratio, weight);
             my_efficient_history = (my_efficient_history >> 1) |
-                                   (curr_eff << (HISTORY_LENGTH - 1));
+                                   (curr_eff << (policy->history_length - 1));
 
             // Update the sentinel count.
             unsigned int current_sentinel_count = counts.sentinels + 1;
@@ -289,7 +298,7 @@ maybe_reengage_workers(global_state *const rts, worker_id self,
         int32_t eff_steps = __builtin_popcount(my_efficient_history);
         int32_t ineff_steps = __builtin_popcount(my_inefficient_history);
         int32_t eff_diff = eff_steps - ineff_steps;
-        if (eff_diff < HISTORY_THRESHOLD) {
+        if (eff_diff < history_threshold(policy)) {
             request = 0;
             *efficient_history = my_efficient_history;
             *inefficient_history = my_inefficient_history;
@@ -324,14 +333,14 @@ maybe_reengage_workers(global_state *const rts, worker_id self,
         }
 
         // Set a cap on the fail count.
-        if (fails > SENTINEL_THRESHOLD) {
-            fails = SENTINEL_THRESHOLD;
+        if (fails > policy->sentinel_threshold) {
+            fails = policy->sentinel_threshold;
         }
 
         // Update request threshold so that, in case this worker ends up
         // executing a small task, it still adds samples to its history that
         // are spread out in time.
-        *sample_threshold = fails + (SENTINEL_THRESHOLD / 1);
+        *sample_threshold = fails + (policy->sentinel_threshold / 1);
     }
 
     return fails;
@@ -341,7 +350,8 @@ maybe_reengage_workers(global_state *const rts, worker_id self,
 // Attempt to disengage this thief thread.  The __cilkrts_worker parameter is only
 // used for debugging.
 static bool maybe_disengage_thief(global_state *g, worker_id self,
-                                  unsigned int nworkers) {
+                                  unsigned int nworkers,
+                                  const __cilkrts_sleep_policy *policy) {
     // Check the number of active and sentinel workers, and disengage this
     // worker if there are too many sentinel workers.
     while (true) {
@@ -352,7 +362,7 @@ static bool maybe_disengage_thief(global_state *g, worker_id self,
         worker_counts counts = get_worker_counts(disengaged_sentinel, nworkers);
 
         // Make sure that we don't inadvertently disengage the last sentinel.
-        if (is_inefficient(counts)) {
+        if (is_inefficient(counts, policy->as_ratio, sentinel_weight(g))) {
             // Too many sentinels.  Try to disengage this worker.  If it fails,
             // repeat the loop.
             if (try_to_disengage_thief(g, self, disengaged_sentinel)) {
@@ -373,7 +383,9 @@ static bool maybe_disengage_thief(global_state *g, worker_id self,
 // possibly disengage this worker.
 __attribute__((always_inline)) static inline unsigned int
 handle_failed_steal_attempts(global_state *const rts, worker_id self,
-                             unsigned int nworkers, const unsigned int NAP_THRESHOLD,
+                             unsigned int nworkers,
+                             const __cilkrts_sleep_policy *const policy,
+                             const unsigned int NAP_THRESHOLD,
                              __cilkrts_worker *const w,
                              unsigned int fails,
                              unsigned int *const sample_threshold,
@@ -386,29 +398,31 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
 
     const bool is_boss = (0 == self);
     // Threshold for number of failed steal attempts to put this thief to sleep
-    // for an extended amount of time.  Must be at least SENTINEL_THRESHOLD and
-    // a power of 2.
+    // for an extended amount of time.  Must be at least the sentinel threshold
+    // and a power of 2.
     const unsigned int SLEEP_THRESHOLD = NAP_THRESHOLD;
     const unsigned int MAX_FAILS =
-        2 * ((SLEEP_THRESHOLD > DISENGAGE_THRESHOLD) ? SLEEP_THRESHOLD
-                                                     : DISENGAGE_THRESHOLD);
+        2 * ((SLEEP_THRESHOLD > disengage_threshold(policy))
+                 ? SLEEP_THRESHOLD
+                 : disengage_threshold(policy));
 
     CILK_START_TIMING(w, INTERVAL_SLEEP);
-    fails += ATTEMPTS;
+    fails += policy->steal_attempts;
 
-    // Every SENTINEL_THRESHOLD consecutive failed steal attempts, update the
+    // Every sentinel_threshold consecutive failed steal attempts, update the
     // set of sentinel workers, and maybe disengage this worker if there are too
     // many sentinel workers.
-    if (fails % SENTINEL_THRESHOLD == 0) {
+    if (fails % policy->sentinel_threshold == 0) {
         if (fails > MAX_FAILS) {
             // Prevent the fail count from exceeding this maximum, so we don't
             // have to worry about the fail count overflowing.
             fails = MAX_FAILS;
-            const struct timespec sleeptime = {.tv_sec = 0, .tv_nsec = SLEEP_NSEC};
+            const struct timespec sleeptime = {.tv_sec = 0,
+                                               .tv_nsec = policy->sleep_nsec};
             nanosleep(&sleeptime, NULL);
         } else {
 #if ENABLE_THIEF_SLEEP
-            if (SENTINEL_THRESHOLD == fails) {
+            if (policy->sentinel_threshold == fails) {
                 add_to_sentinels(rts, 1);
             }
 
@@ -428,18 +442,21 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
             *sentinel_count_history_tail = (tail + 1) % SENTINEL_COUNT_HISTORY;
 
             // Update the efficient history.
-            history_t curr_eff = is_efficient(counts);
+            int32_t weight = sentinel_weight(rts);
+            history_t curr_eff = is_efficient(counts, policy->as_ratio, weight);
             history_t my_efficient_history = *efficient_history;
             my_efficient_history = (my_efficient_history >> 1) |
-                                   (curr_eff << (HISTORY_LENGTH - 1));
+                                   (curr_eff << (policy->history_length - 1));
             int32_t eff_steps = __builtin_popcount(my_efficient_history);
             *efficient_history = my_efficient_history;
 
             // Update the inefficient history.
-            history_t curr_ineff = is_inefficient(counts);
+            history_t curr_ineff =
+                is_inefficient(counts, policy->as_ratio, weight);
             history_t my_inefficient_history = *inefficient_history;
-            my_inefficient_history = (my_inefficient_history >> 1) |
-                                     (curr_ineff << (HISTORY_LENGTH - 1));
+            my_inefficient_history =
+                (my_inefficient_history >> 1) |
+                (curr_ineff << (policy->history_length - 1));
             int32_t ineff_steps =
                 __builtin_popcount(my_inefficient_history);
             *inefficient_history = my_inefficient_history;
@@ -450,18 +467,19 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
                     // The boss thread should never disengage.  Sleep instead.
                     const struct timespec sleeptime = {
                         .tv_sec = 0,
-                        .tv_nsec =
-                            (fails > SLEEP_THRESHOLD) ? SLEEP_NSEC : NAP_NSEC};
+                        .tv_nsec = (fails > SLEEP_THRESHOLD)
+                                       ? policy->sleep_nsec
+                                       : policy->nap_nsec};
                     nanosleep(&sleeptime, NULL);
                 }
             } else {
 #if ENABLE_THIEF_SLEEP
 
                 if (ENABLE_THIEF_SLEEP && curr_ineff &&
-                    (ineff_steps - eff_steps) > HISTORY_THRESHOLD) {
+                    (ineff_steps - eff_steps) > history_threshold(policy)) {
                     uint64_t start, end;
                     start = gettime_fast();
-                    if (maybe_disengage_thief(rts, self, nworkers)) {
+                    if (maybe_disengage_thief(rts, self, nworkers, policy)) {
                         // The semaphore for reserving workers may have been
                         // non-zero due to past successful steals, rather than a
                         // recent successful steal.  Decrement fails so we try
@@ -469,13 +487,13 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
                         // still nothing to steal.
                         end = gettime_fast();
                         unsigned int scaled_elapsed =
-                            get_scaled_elapsed(end - start);
+                            get_scaled_elapsed(policy, end - start);
 
                         // Update histories
-                        if (scaled_elapsed > SENTINEL_THRESHOLD) {
+                        if (scaled_elapsed > policy->sentinel_threshold) {
                             uint32_t samples =
-                                scaled_elapsed / SENTINEL_THRESHOLD;
-                            if (samples >= HISTORY_LENGTH) {
+                                scaled_elapsed / policy->sentinel_threshold;
+                            if (samples >= policy->history_length) {
                                 *efficient_history = 0;
                                 *inefficient_history = 0;
 
@@ -500,12 +518,13 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
                         }
 
                         // Update fail count
-                        if (scaled_elapsed < SENTINEL_THRESHOLD) {
+                        if (scaled_elapsed < policy->sentinel_threshold) {
                             fails -= scaled_elapsed;
                         } else {
-                            fails = DISENGAGE_THRESHOLD - SENTINEL_THRESHOLD;
+                            fails = disengage_threshold(policy) -
+                                    policy->sentinel_threshold;
                         }
-                        *sample_threshold = SENTINEL_THRESHOLD;
+                        *sample_threshold = policy->sentinel_threshold;
                     } else if (fails % NAP_THRESHOLD == 0) {
                         // We have enough active workers to keep this worker
                         // engaged, but this worker was still unable to steal
@@ -514,8 +533,9 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
                         // approximately 50 us.
                         const struct timespec sleeptime = {
                             .tv_sec = 0,
-                            .tv_nsec = (fails > SLEEP_THRESHOLD) ? SLEEP_NSEC
-                                                                 : NAP_NSEC};
+                            .tv_nsec = (fails > SLEEP_THRESHOLD)
+                                           ? policy->sleep_nsec
+                                           : policy->nap_nsec};
                         nanosleep(&sleeptime, NULL);
                     }
 #else
@@ -529,8 +549,9 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
                     // approximately 50 us.
                     const struct timespec sleeptime = {
                         .tv_sec = 0,
-                        .tv_nsec =
-                            (fails > SLEEP_THRESHOLD) ? SLEEP_NSEC : NAP_NSEC};
+                        .tv_nsec = (fails > SLEEP_THRESHOLD)
+                                       ? policy->sleep_nsec
+                                       : policy->nap_nsec};
                     nanosleep(&sleeptime, NULL);
                 }
             }
@@ -543,6 +564,7 @@ handle_failed_steal_attempts(global_state *const rts, worker_id self,
 __attribute__((always_inline))
 static unsigned int go_to_sleep_maybe(global_state *const rts, worker_id self,
                                       unsigned int nworkers,
+                                      const __cilkrts_sleep_policy *policy,
                                       const unsigned int NAP_THRESHOLD,
                                       __cilkrts_worker *const w,
                                       Closure *const t, unsigned int fails,
@@ -554,12 +576,13 @@ static unsigned int go_to_sleep_maybe(global_state *const rts, worker_id self,
                                       unsigned int *const recent_sentinel_count) {
     if (t) {
         return maybe_reengage_workers(
-            rts, self, nworkers, w, fails, sample_threshold,
+            rts, self, nworkers, policy, w, fails, sample_threshold,
             inefficient_history, efficient_history, sentinel_count_history,
             sentinel_count_history_tail, recent_sentinel_count);
     } else {
         return handle_failed_steal_attempts(
-            rts, self, nworkers, NAP_THRESHOLD, w, fails, sample_threshold,
+            rts, self, nworkers, policy, NAP_THRESHOLD, w, fails,
+            sample_threshold,
             inefficient_history, efficient_history, sentinel_count_history,
             sentinel_count_history_tail, recent_sentinel_count);
     }
@@ -568,9 +591,10 @@ static unsigned int go_to_sleep_maybe(global_state *const rts, worker_id self,
 #if ENABLE_THIEF_SLEEP
 __attribute__((always_inline)) static unsigned int
 decrease_fails_by_work(global_state *const rts,
+                       const __cilkrts_sleep_policy *const policy,
                        unsigned int fails, uint64_t elapsed,
                        unsigned int *const sample_threshold) {
-    uint64_t scaled_elapsed = get_scaled_elapsed(elapsed);
+    uint64_t scaled_elapsed = get_scaled_elapsed(policy, elapsed);
 
     // Decrease the number of fails based on the work done.
     if (scaled_elapsed > (uint64_t)fails) {
@@ -579,24 +603,26 @@ decrease_fails_by_work(global_state *const rts,
         fails -= scaled_elapsed;
     }
 
-    // The fail count must be a multiple of ATTEMPTS for the sleep logic to
-    // work.
-    CILK_ASSERT(fails % ATTEMPTS == 0);
+    // The fail count must be a multiple of the number of steal attempts per
+    // round for the sleep logic to work.
+    CILK_ASSERT(fails % policy->steal_attempts == 0);
 
-    if (scaled_elapsed > (uint64_t)(*sample_threshold) - SENTINEL_THRESHOLD)
-        *sample_threshold = SENTINEL_THRESHOLD;
+    if (scaled_elapsed >
+        (uint64_t)(*sample_threshold) - policy->sentinel_threshold)
+        *sample_threshold = policy->sentinel_threshold;
     else
         *sample_threshold -= scaled_elapsed;
 
     // If this worker is still sentinel, update sentinel-worker count.
-    if (fails >= SENTINEL_THRESHOLD)
+    if (fails >= policy->sentinel_threshold)
         add_to_sentinels(rts, 1);
     return fails;
 }
 #endif // ENABLE_THIEF_SLEEP
 
 __attribute__((always_inline)) static unsigned int
-init_fails(uint32_t wake_val, global_state *rts) {
+init_fails(uint32_t wake_val, global_state *rts,
+           const __cilkrts_sleep_policy *const policy) {
     // It's possible that a disengaged worker is woken up by a call to
     // request_more_thieves, in which case it should be a sentinel.  But there
     // isn't a direct way to tell how whether the worker should be active or a
@@ -610,15 +636,16 @@ init_fails(uint32_t wake_val, global_state *rts) {
     if (wake_val <= (rts->nworkers / 2)) {
         atomic_fetch_add_explicit(&rts->disengaged_sentinel, 1,
                                   memory_order_release);
-        return SENTINEL_THRESHOLD;
+        return policy->sentinel_threshold;
     }
     return 0;
 }
 
 #if ENABLE_THIEF_SLEEP
 __attribute__((always_inline)) static unsigned int
-reset_fails(global_state *rts, unsigned int fails) {
-    if (fails >= SENTINEL_THRESHOLD) {
+reset_fails(global_state *rts, const __cilkrts_sleep_policy *const policy,
+            unsigned int fails) {
+    if (fails >= policy->sentinel_threshold) {
         // If this worker was sentinel, decrement the number of sentinel
         // workers, effectively making this worker active.
         add_to_sentinels(rts, -1);
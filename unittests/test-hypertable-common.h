@@ -3,12 +3,26 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define TRACE 0
 
 // Dummy implementation of __cilkrts_get_worker_number.
 unsigned __cilkrts_get_worker_number(void) { return 0; }
 
+// Dummy implementations of the reducer-view allocators.
+struct __cilkrts_worker;
+void *cilk_view_alloc(struct __cilkrts_worker *w) { return malloc(16); }
+void cilk_view_free(struct __cilkrts_worker *w, void *p) { free(p); }
+void *cilk_internal_malloc(struct __cilkrts_worker *w, size_t size, int tag) {
+    return malloc(size);
+}
+void cilk_internal_free(struct __cilkrts_worker *w, void *p, size_t size,
+                        int tag) {
+    free(p);
+}
+
 #define CHEETAH_INTERNAL
 #include "../runtime/local-hypertable.h"
 
@@ -46,15 +60,15 @@ typedef struct table_command {
 void verify_hypertable(hyper_table *table, uintptr_t key, int32_t expected_count) {
     int32_t key_count = 0;
     int32_t capacity = table->capacity;
-    struct bucket *buckets = table->buckets;
-    PRINT_TRACE("table(%p): cap %d, occ %d, ins_rm %d\n", buckets, capacity,
+    uintptr_t *keys = table->keys;
+    PRINT_TRACE("table(%p): cap %d, occ %d, ins_rm %d\n", keys, capacity,
                 table->occupancy, table->ins_rm_count);
     if (capacity < MIN_HT_CAPACITY) {
         int32_t occupancy = table->occupancy;
         for (int32_t i = 0; i < occupancy; ++i) {
-            PRINT_TRACE("table(%p)[%d] = { 0x%lx, %p }\n", buckets, i,
-                        buckets[i].key, buckets[i].value.view);
-            if (is_valid(key) && buckets[i].key == key)
+            PRINT_TRACE("table(%p)[%d] = { 0x%lx, %p }\n", keys, i, keys[i],
+                        table->values[i].view);
+            if (is_valid(key) && keys[i] == key)
                 key_count++;
         }
         if (key_count != expected_count)
@@ -65,10 +79,10 @@ void verify_hypertable(hyper_table *table, uintptr_t key, int32_t expected_count
     }
 
     for (int32_t i = 0; i < capacity; ++i) {
-        PRINT_TRACE("table(%p)[%d] = { 0x%lx, %d, %p }\n", buckets, i,
-                    buckets[i].key, buckets[i].hash,
-                    is_valid(buckets[i].key) ? buckets[i].value.view : NULL);
-        if (is_valid(key) && buckets[i].key == key)
+        PRINT_TRACE("table(%p)[%d] = { 0x%lx, %d, %p }\n", keys, i, keys[i],
+                    table->hashes[i],
+                    is_valid(keys[i]) ? table->values[i].view : NULL);
+        if (is_valid(key) && keys[i] == key)
             key_count++;
     }
     if (key_count != expected_count)
@@ -83,18 +97,18 @@ bool check_hypertable(hyper_table *table, uintptr_t key,
                       int32_t expected_count) {
     int32_t key_count = 0;
     int32_t capacity = table->capacity;
-    struct bucket *buckets = table->buckets;
+    uintptr_t *keys = table->keys;
     if (capacity < MIN_HT_CAPACITY) {
         int32_t occupancy = table->occupancy;
         for (int32_t i = 0; i < occupancy; ++i) {
-            if (is_valid(key) && buckets[i].key == key)
+            if (is_valid(key) && keys[i] == key)
                 key_count++;
         }
         return key_count == expected_count;
     }
 
     for (int32_t i = 0; i < capacity; ++i) {
-        if (is_valid(key) && buckets[i].key == key)
+        if (is_valid(key) && keys[i] == key)
             key_count++;
     }
     return key_count == expected_count;
@@ -119,7 +133,7 @@ void do_table_command(hyper_table *table, table_command cmd) {
     }
     case TABLE_LOOKUP: {
         PRINT_TRACE("LOOKUP 0x%lx\n", cmd.key);
-        struct bucket *b = find_hyperobject(table, cmd.key);
+        reducer_base *b = find_hyperobject(table, cmd.key);
         verify_hypertable(table, cmd.key, NULL != b);
         break;
     }
@@ -165,8 +179,8 @@ void test_set_insert_remove(const uintptr_t *keys, int num_keys,
     for (int i = 0; i < num_keys; ++i) {
         num_valid += is_valid(keys[i]);
         num_tomb += is_tombstone(keys[i]);
-        table->buckets[i].key = keys[i];
-        table->buckets[i].hash = hash(keys[i]) % num_keys;
+        table->keys[i] = keys[i];
+        table->hashes[i] = hash(keys[i]) % num_keys;
     }
     table->occupancy = num_valid;
     table->ins_rm_count = num_tomb;
@@ -178,3 +192,218 @@ void test_set_insert_remove(const uintptr_t *keys, int num_keys,
     }
     local_hyper_table_free(table);
 }
+
+// Reduce function for test_merge that records the order of its arguments.
+static void merge_reduce(void *left, void *right) {
+    *(long *)left = *(long *)left * 10 + *(long *)right;
+}
+
+// Keys for test_merge, spread over the table.
+uintptr_t merge_key(int i) {
+    return (((uintptr_t)(i + 1) * 0x9e3779b97f4a7c15UL) >> 16) << 3;
+}
+
+static hyper_table *merge_table(uintptr_t (*key)(int), int begin, int end,
+                                long value) {
+    hyper_table *table = __cilkrts_local_hyper_table_alloc();
+    for (int i = begin; i < end; ++i) {
+        long *view = malloc(sizeof(long));
+        *view = value;
+        struct bucket b = {.key = key(i),
+                           .value = {.view = view, .reduce_fn = merge_reduce}};
+        bool success = insert_hyperobject(table, b);
+        assert(success && "insert_hyperobject failed");
+    }
+    return table;
+}
+
+// Merge a table of n keys with a table of m keys, shared of which are in both
+// tables, reducing the views during the merge or, if defer, afterwards.  Check
+// that the merged table contains every key once, and that the views of keys in
+// both tables were reduced in left-to-right order.
+void test_merge_with(uintptr_t (*key)(int), int n, int m, int shared,
+                     bool defer) {
+    hyper_table *left = merge_table(key, 0, n, 1);
+    hyper_table *right = merge_table(key, n - shared, n - shared + m, 2);
+    hyper_table *merged;
+    if (defer) {
+        struct view_pair *pairs;
+        int32_t npairs;
+        merged = __cilkrts_merge_hts_deferring(left, right, &pairs, &npairs);
+        assert(npairs == shared);
+        // Reduce the pairs in reverse order, as parallel reductions might.
+        for (int32_t i = npairs - 1; i >= 0; --i)
+            __cilkrts_reduce_view_pairs(&pairs[i], 1);
+        free(pairs);
+    } else {
+        merged = merge_two_hts(left, right);
+    }
+    assert(merged->occupancy == n + m - shared);
+    for (int i = 0; i < n + m - shared; ++i) {
+        reducer_base *b = find_hyperobject(merged, key(i));
+        assert(b && "key missing after merge");
+        long expected = (i < n - shared) ? 1 : (i < n) ? 12 : 2;
+        assert(*(long *)b->view == expected);
+        free(b->view);
+    }
+    local_hyper_table_free(merged);
+}
+
+void test_merge(uintptr_t (*key)(int), int n, int m, int shared) {
+    test_merge_with(key, n, m, shared, false);
+}
+
+// Reduce function for test_defer that appends the decimal digits of right to
+// left, so the views record the order of all their reductions.
+static void concat_reduce(void *left, void *right) {
+    long r = *(long *)right;
+    for (long d = r; d > 0; d /= 10)
+        *(long *)left *= 10;
+    *(long *)left += r;
+}
+
+// Join the tables lo to hi - 1 by splitting the range in half, deferring
+// reductions in chains of at most max_chain tables.  Table t holds keys t * 4
+// to t * 4 + 7 with views of t + 1.
+static hyper_table *defer_tables(int lo, int hi, int32_t max_chain) {
+    if (hi - lo == 1) {
+        hyper_table *table = __cilkrts_local_hyper_table_alloc();
+        for (int i = lo * 4; i < lo * 4 + 8; ++i) {
+            long *view = malloc(sizeof(long));
+            *view = lo + 1;
+            struct bucket b = {
+                .key = merge_key(i),
+                .value = {.view = view, .reduce_fn = concat_reduce}};
+            bool success = insert_hyperobject(table, b);
+            assert(success && "insert_hyperobject failed");
+        }
+        return table;
+    }
+    int mid = lo + (hi - lo) / 2;
+    hyper_table *left = defer_tables(lo, mid, max_chain);
+    hyper_table *right = defer_tables(mid, hi, max_chain);
+    hyper_table *joined = defer_merge_two_hts(left, right, max_chain);
+    assert(joined->chain_length <= max_chain);
+    return joined;
+}
+
+// Join n tables, at most 9, lazily and reduce the deferred tables.  Check that
+// every view was reduced with its neighbors in left-to-right order.
+void test_defer(int n, int32_t max_chain) {
+    hyper_table *table = defer_tables(0, n, max_chain);
+    if (table->deferred)
+        table = __cilkrts_reduce_deferred_hts(table);
+    assert(!table->deferred && table->chain_length == 0);
+    assert(table->occupancy == n * 4 + 4);
+    for (int i = 0; i < n * 4 + 4; ++i) {
+        reducer_base *b = find_hyperobject(table, merge_key(i));
+        assert(b && "key missing after deferred merge");
+        // Key i is in table i / 4, and also in table i / 4 - 1 if i >= 4.
+        long t = i / 4;
+        long expected = (t == 0) ? 1 : (t == n) ? n : t * 10 + t + 1;
+        assert(*(long *)b->view == expected);
+        free(b->view);
+    }
+    local_hyper_table_free(table);
+}
+
+// Performance mode: time lookups in, and merges of, tables of random keys.
+
+static uint64_t perf_seed = 0x2545f4914f6cdd1dUL;
+
+// Return a random key that looks like a pointer to an 8-byte aligned object.
+static uintptr_t perf_key(void) {
+    // splitmix64
+    uint64_t x = (perf_seed += 0x9e3779b97f4a7c15UL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    x ^= x >> 31;
+    return (uintptr_t)((x & 0x00007ffffffffff8UL) | 0x8);
+}
+
+static double perf_nsec(const struct timespec *begin,
+                        const struct timespec *end) {
+    return (end->tv_sec - begin->tv_sec) * 1e9 +
+           (end->tv_nsec - begin->tv_nsec);
+}
+
+static void perf_reduce(void *left, void *right) {}
+
+static hyper_table *perf_table(const uintptr_t *keys, int n) {
+    hyper_table *table = __cilkrts_local_hyper_table_alloc();
+    for (int i = 0; i < n; ++i)
+        insert_hyperobject(
+            table, (struct bucket){
+                       .key = keys[i],
+                       .value = {.view = NULL, .reduce_fn = perf_reduce}});
+    return table;
+}
+
+// Time successful and failed lookups in a table of n keys.
+static void perf_lookup(int n) {
+    const int lookups = 1 << 22;
+    uintptr_t *keys = malloc(2 * n * sizeof(uintptr_t));
+    for (int i = 0; i < 2 * n; ++i)
+        keys[i] = perf_key();
+    hyper_table *table = perf_table(keys, n);
+
+    struct timespec begin, mid, end;
+    int found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < lookups; ++i) {
+        // Read the view, as a reducer lookup does.
+        reducer_base *b = find_hyperobject(table, keys[(i * 7919L) % n]);
+        found += NULL != b && NULL == b->view;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    for (int i = 0; i < lookups; ++i)
+        found += NULL != find_hyperobject(table, keys[n + (i * 7919L) % n]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(found == lookups);
+
+    printf("lookup %6d keys: hit %6.1f ns, miss %6.1f ns\n", n,
+           perf_nsec(&begin, &mid) / lookups, perf_nsec(&mid, &end) / lookups);
+    local_hyper_table_free(table);
+    free(keys);
+}
+
+// Time merges of a table of n keys with a table of m keys, a quarter of which
+// are also in the first table.
+static void perf_merge(int n, int m) {
+    const int merges = (1 << 22) / (n + m) + 1;
+    uintptr_t *keys = malloc((n + m) * sizeof(uintptr_t));
+    for (int i = 0; i < n + m; ++i)
+        keys[i] = perf_key();
+    int shared = m / 4 < n ? m / 4 : n;
+
+    double nsec = 0;
+    int occupancy = 0;
+    for (int i = 0; i < merges; ++i) {
+        hyper_table *left = perf_table(keys, n);
+        hyper_table *right = perf_table(keys + n - shared, m);
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        hyper_table *merged = merge_two_hts(left, right);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        nsec += perf_nsec(&begin, &end);
+        occupancy = merged->occupancy;
+        local_hyper_table_free(merged);
+    }
+    assert(occupancy == n + m - shared);
+
+    printf("merge %6d + %6d keys: %10.1f ns, %6.1f ns per key\n", n, m,
+           nsec / merges, nsec / merges / (n + m));
+    free(keys);
+}
+
+void perf_hypertable(void) {
+    for (int n = 4; n <= (1 << 16); n *= 4)
+        perf_lookup(n);
+    // A table at the maximum load factor.
+    perf_lookup(15 << 10);
+    for (int n = 4; n <= (1 << 16); n *= 4) {
+        perf_merge(n, n);
+        if (n >= 64)
+            perf_merge(n, n / 16);
+    }
+}
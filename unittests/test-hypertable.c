@@ -220,7 +220,49 @@ void test5(void) {
     test_insert_remove(test, sizeof(test)/sizeof(table_command));
 }
 
+// Keys that all hash to the last entry of tables of up to 1024 entries.
+uintptr_t last_entry_key(int i) { return ((uintptr_t)(i + 1) << 10) | 0x3ff; }
+
+void test6(void) {
+    // Merge tables of various sizes, both by probing the larger table and by
+    // merging runs, with and without keys in both tables.
+    test_merge(merge_key, 4, 4, 2);
+    test_merge(merge_key, 64, 4, 1);
+    test_merge(merge_key, 4, 64, 4);
+    test_merge(merge_key, 100, 100, 50);
+    test_merge(merge_key, 1000, 200, 100);
+    test_merge(merge_key, 200, 1000, 0);
+    test_merge(merge_key, 5000, 5000, 5000);
+    // Merge runs that wrap around the end of the table.
+    test_merge(last_entry_key, 20, 20, 10);
+    test_merge(last_entry_key, 300, 200, 100);
+}
+
+void test7(void) {
+    // Join tables lazily, with chains that are reduced only at the end and
+    // chains that are reduced as they grow.
+    test_defer(2, 1);
+    test_defer(9, 16);
+    test_defer(9, 3);
+    test_defer(9, 1);
+}
+
+void test8(void) {
+    // Merge tables, leaving the reductions of shared keys for afterwards.
+    test_merge_with(merge_key, 4, 4, 2, true);
+    test_merge_with(merge_key, 64, 4, 4, true);
+    test_merge_with(merge_key, 4, 64, 0, true);
+    test_merge_with(merge_key, 1000, 200, 100, true);
+    test_merge_with(merge_key, 5000, 5000, 5000, true);
+    test_merge_with(last_entry_key, 300, 200, 100, true);
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && 0 == strcmp(argv[1], "perf")) {
+        perf_hypertable();
+        return 0;
+    }
+
     int to_run = -1;
     if (argc > 1)
         to_run = atoi(argv[1]);
@@ -249,5 +291,17 @@ int main(int argc, char *argv[]) {
         test5();
         printf("test5 PASSED\n");
     }
+    if (to_run < 0 || to_run == 6) {
+        test6();
+        printf("test6 PASSED\n");
+    }
+    if (to_run < 0 || to_run == 7) {
+        test7();
+        printf("test7 PASSED\n");
+    }
+    if (to_run < 0 || to_run == 8) {
+        test8();
+        printf("test8 PASSED\n");
+    }
     return 0;
 }
@@ -0,0 +1,334 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Dummy implementation of __cilkrts_get_worker_number.
+unsigned __cilkrts_get_worker_number(void) { return 0; }
+
+#define CHEETAH_INTERNAL
+#include "../runtime/readydeque.h"
+
+// Stress test for the ReadyDeque operations.  Every thread owns one deque and
+// also acts as a thief on the other threads' deques, following the same
+// locking discipline as the scheduler: the owner locks its own deque to add
+// and remove Closures at the bottom, and a thief trylocks the victim's deque,
+// extracts the top Closure, and sometimes pushes a new Closure onto the
+// victim's bottom, as promote_child does.  Each deque is shadowed by a simple
+// reference model, protected by the same deque lock, that checks the result of
+// every operation.
+
+#define NUM_THREADS 8
+#define NUM_ITERS 200000
+// Keep the model below the capacity of the circular-array deque.
+#define MODEL_CAPACITY 8
+
+typedef struct model_deque {
+    Closure *entries[MODEL_CAPACITY];
+    unsigned int top;
+    unsigned int bottom;
+} model_deque;
+
+static ReadyDeque deques[NUM_THREADS];
+static model_deque models[NUM_THREADS];
+static global_state g;
+// Only used by the assertions in deque_peek_top.
+static __cilkrts_worker worker = {.g = &g};
+
+static _Atomic long num_added = 0;
+static _Atomic long num_extracted = 0;
+
+static unsigned int model_size(const model_deque *m) {
+    return m->bottom - m->top;
+}
+
+static Closure *new_closure(void) {
+    Closure *cl = calloc(1, sizeof(Closure));
+    assert(cl);
+    cl->owner_ready_deque = NO_WORKER;
+    return cl;
+}
+
+static void check_consistent(worker_id pn) {
+    if (model_size(&models[pn]) > 0)
+        assert(deque_maybe_nonempty(deques, pn));
+}
+
+static void add_bottom(worker_id self, worker_id pn) {
+    model_deque *m = &models[pn];
+    if (model_size(m) >= MODEL_CAPACITY)
+        return;
+    Closure *cl = new_closure();
+    deque_add_bottom(deques, cl, self, pn);
+    m->entries[m->bottom++ % MODEL_CAPACITY] = cl;
+    atomic_fetch_add(&num_added, 1);
+    check_consistent(pn);
+}
+
+static void xtract_bottom(worker_id self, worker_id pn) {
+    model_deque *m = &models[pn];
+    Closure *expected = NULL;
+    if (model_size(m) > 0)
+        expected = m->entries[(m->bottom - 1) % MODEL_CAPACITY];
+    Closure *peeked = deque_peek_bottom(deques, self, pn);
+    assert(peeked == expected);
+    Closure *cl = deque_xtract_bottom(deques, self, pn);
+    assert(cl == expected);
+    if (cl) {
+        --m->bottom;
+        atomic_fetch_add(&num_extracted, 1);
+        free(cl);
+    }
+    check_consistent(pn);
+}
+
+static void xtract_top(worker_id self, worker_id pn) {
+    model_deque *m = &models[pn];
+    Closure *expected = NULL;
+    if (model_size(m) > 0)
+        expected = m->entries[m->top % MODEL_CAPACITY];
+    Closure *peeked = deque_peek_top(deques, &worker, self, pn);
+    assert(peeked == expected);
+    Closure *cl = deque_xtract_top(deques, self, pn);
+    assert(cl == expected);
+    if (cl) {
+        ++m->top;
+        atomic_fetch_add(&num_extracted, 1);
+        free(cl);
+    }
+    check_consistent(pn);
+}
+
+static void *stress_thread(void *arg) {
+    worker_id self = (worker_id)(uintptr_t)arg;
+    unsigned int seed = self + 1;
+
+    for (int i = 0; i < NUM_ITERS; ++i) {
+        unsigned int r = rand_r(&seed);
+        if (r % 2) {
+            // Act as the owner of this deque.
+            deque_lock_self(deques, self);
+            if (r & 0x2)
+                add_bottom(self, self);
+            else
+                xtract_bottom(self, self);
+            deque_unlock_self(deques, self);
+        } else {
+            // Act as a thief on a random victim.
+            worker_id victim = (self + 1 + (r >> 8) % (NUM_THREADS - 1)) %
+                               NUM_THREADS;
+            if (!deque_maybe_nonempty(deques, victim))
+                continue;
+            if (deque_trylock(deques, self, victim) == 0)
+                continue;
+            xtract_top(self, victim);
+            if (r & 0x2)
+                add_bottom(self, victim);
+            deque_unlock(deques, self, victim);
+        }
+    }
+    return NULL;
+}
+
+void test_stress(void) {
+    pthread_t threads[NUM_THREADS];
+
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        deque_init(deques, i);
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(uintptr_t)i);
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    // Drain the remaining Closures, alternating between the top and bottom.
+    for (worker_id i = 0; i < NUM_THREADS; ++i) {
+        deque_lock_self(deques, i);
+        while (model_size(&models[i]) > 0) {
+            if (model_size(&models[i]) % 2)
+                xtract_top(i, i);
+            else
+                xtract_bottom(i, i);
+        }
+        assert(deque_peek_top(deques, &worker, i, i) == NULL);
+        assert(deque_peek_bottom(deques, i, i) == NULL);
+        assert(!deque_maybe_nonempty(deques, i) || !ENABLE_ARRAY_DEQUE);
+        deque_unlock_self(deques, i);
+        assert(atomic_load(&deques[i].mutex_owner) == NO_WORKER);
+    }
+    assert(atomic_load(&num_added) == atomic_load(&num_extracted));
+}
+
+void test_reset(void) {
+    deque_init(deques, 0);
+    models[0].top = models[0].bottom = 0;
+    deque_lock_self(deques, 0);
+    for (int i = 0; i < 3; ++i)
+        add_bottom(0, 0);
+    for (int i = 0; i < 3; ++i)
+        free(models[0].entries[i]);
+    deque_reset(deques, 0, 0);
+    models[0].top = models[0].bottom;
+    assert(deque_peek_top(deques, &worker, 0, 0) == NULL);
+    assert(deque_peek_bottom(deques, 0, 0) == NULL);
+
+    // The deque remains usable after a reset.
+    add_bottom(0, 0);
+    xtract_top(0, 0);
+    deque_unlock_self(deques, 0);
+}
+
+#if ENABLE_ARRAY_DEQUE
+// Stress test for taking ready Closures from the top of an array deque without
+// the deque lock.  Every thread owns one deque, onto which it pushes Closures,
+// most of them ready, and from which it extracts Closures at the bottom, both
+// under the deque lock.  It also acts as a thief on the other threads' deques,
+// either taking the top Closure without the lock, which must succeed only for a
+// ready Closure, or extracting it under the lock, as promote_child does.  Every
+// Closure must be extracted exactly once, and the Closures extracted from the
+// top of a deque must come out in the order in which they were pushed.
+
+#define NUM_STEAL_ITERS 200000
+
+typedef struct seq_closure {
+    Closure cl; // must be first
+    worker_id owner;
+    unsigned long seq;
+    _Atomic int extracted;
+} seq_closure;
+
+static unsigned long next_seq[NUM_THREADS];
+static _Atomic long num_ready_taken = 0;
+
+static void extract(Closure *cl) {
+    seq_closure *s = (seq_closure *)cl;
+    assert(atomic_exchange(&s->extracted, 1) == 0);
+    atomic_fetch_add(&num_extracted, 1);
+    free(s);
+}
+
+static void push_seq(worker_id self, bool ready) {
+    seq_closure *s = calloc(1, sizeof(seq_closure));
+    assert(s);
+    s->cl.owner_ready_deque = NO_WORKER;
+    s->cl.status = ready ? CLOSURE_READY : CLOSURE_RUNNING;
+    s->owner = self;
+    s->seq = next_seq[self]++;
+    deque_lock_self(deques, self);
+    uint32_t top = atomic_load(&deques[self].top);
+    uint32_t bottom = atomic_load(&deques[self].bottom);
+    if (bottom - top < MODEL_CAPACITY) {
+        deque_add_bottom(deques, &s->cl, self, self);
+        atomic_fetch_add(&num_added, 1);
+    } else {
+        free(s);
+    }
+    deque_unlock_self(deques, self);
+}
+
+static void *steal_ready_thread(void *arg) {
+    worker_id self = (worker_id)(uintptr_t)arg;
+    unsigned int seed = self + 1;
+    // The last sequence number this thread extracted from the top of each
+    // deque.
+    long last_top[NUM_THREADS];
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        last_top[i] = -1;
+
+    for (int i = 0; i < NUM_STEAL_ITERS; ++i) {
+        unsigned int r = rand_r(&seed);
+        if (r % 2) {
+            // Act as the owner of this deque.
+            if (r & 0x2) {
+                push_seq(self, (r & 0xc) != 0);
+            } else {
+                deque_lock_self(deques, self);
+                Closure *cl = deque_xtract_bottom(deques, self, self);
+                deque_unlock_self(deques, self);
+                if (cl)
+                    extract(cl);
+            }
+        } else {
+            // Act as a thief on a random victim.
+            worker_id victim = (self + 1 + (r >> 8) % (NUM_THREADS - 1)) %
+                               NUM_THREADS;
+            if (!deque_maybe_nonempty(deques, victim))
+                continue;
+            Closure *cl = NULL;
+            if (r & 0x2) {
+                cl = deque_steal_ready_top(deques, victim);
+                if (cl) {
+                    assert(cl->status == CLOSURE_READY);
+                    atomic_fetch_add(&num_ready_taken, 1);
+                }
+            } else if (deque_trylock(deques, self, victim)) {
+                // A ready top Closure is left for the lock-free path.
+                Closure *top = deque_peek_top(deques, &worker, self, victim);
+                if (top) {
+                    assert(top->status != CLOSURE_READY);
+                    cl = deque_xtract_top(deques, self, victim);
+                    assert(cl == top);
+                }
+                deque_unlock(deques, self, victim);
+            }
+            if (cl) {
+                seq_closure *s = (seq_closure *)cl;
+                assert(s->owner == victim);
+                assert((long)s->seq > last_top[victim]);
+                last_top[victim] = s->seq;
+                extract(cl);
+            }
+        }
+    }
+    return NULL;
+}
+
+void test_steal_ready(void) {
+    pthread_t threads[NUM_THREADS];
+
+    atomic_store(&num_added, 0);
+    atomic_store(&num_extracted, 0);
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        deque_init(deques, i);
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        pthread_create(&threads[i], NULL, steal_ready_thread,
+                       (void *)(uintptr_t)i);
+    for (worker_id i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    // Drain the remaining Closures.
+    for (worker_id i = 0; i < NUM_THREADS; ++i) {
+        deque_lock_self(deques, i);
+        Closure *cl;
+        while ((cl = deque_xtract_bottom(deques, i, i)))
+            extract(cl);
+        assert(!deque_maybe_nonempty(deques, i));
+        assert(deque_steal_ready_top(deques, i) == NULL);
+        deque_unlock_self(deques, i);
+    }
+    assert(atomic_load(&num_ready_taken) > 0);
+    assert(atomic_load(&num_added) == atomic_load(&num_extracted));
+}
+#endif // ENABLE_ARRAY_DEQUE
+
+int main(int argc, char *argv[]) {
+    int to_run = -1;
+    if (argc > 1)
+        to_run = atoi(argv[1]);
+
+    if (to_run < 0 || to_run == 0) {
+        test_stress();
+        printf("test_stress PASSED\n");
+    }
+    if (to_run < 0 || to_run == 1) {
+        test_reset();
+        printf("test_reset PASSED\n");
+    }
+#if ENABLE_ARRAY_DEQUE
+    if (to_run < 0 || to_run == 2) {
+        test_steal_ready();
+        printf("test_steal_ready PASSED\n");
+    }
+#endif
+    return 0;
+}